@@ -0,0 +1,967 @@
+/*
+ * Copyright (c) 2004-2013 Sergey Lyubka <valenok@gmail.com>
+ * Copyright (c) 2013 Cesanta Software Limited
+ * Copyright (c) 2020 Julian Smythe <sausage@tehsausage.com>
+ * All rights reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "elsa.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Target running time of a single benchmark, in seconds */
+#define BENCH_SECONDS 0.25
+
+struct bench {
+  const char *name;
+  clock_t start;
+  long iterations;
+  size_t bytes;
+};
+
+static void bench_start(struct bench *b, const char *name, size_t bytes) {
+  b->name = name;
+  b->iterations = 0;
+  b->bytes = bytes;
+  b->start = clock();
+}
+
+/* Return non-0 while the benchmark should keep running */
+static int bench_running(struct bench *b) {
+  return (double) (clock() - b->start) / CLOCKS_PER_SEC < BENCH_SECONDS ||
+         b->iterations == 0;
+}
+
+static void bench_end(struct bench *b) {
+  double secs = (double) (clock() - b->start) / CLOCKS_PER_SEC;
+  double us = secs * 1e6 / b->iterations;
+  printf("%-40s %10.2f us/op", b->name, us);
+  if (b->bytes > 0) {
+    printf(" %10.2f MB/s", b->bytes * b->iterations / secs / 1e6);
+  }
+  printf("\n");
+}
+
+/*
+ * Make a JSON object of about `size` bytes with fields f0, f1, ..., each
+ * holding a small object with a number, a string and an array.
+ */
+static char *make_object(size_t size, int *len) {
+  char *buf = (char *) malloc(size + 256);
+  struct json_out out = JSON_OUT_BUF(buf, size + 256);
+  int i;
+  json_printf(&out, "{");
+  for (i = 0; out.u.buf.len < size; i++) {
+    char key[20];
+    snprintf(key, sizeof(key), "f%d", i);
+    json_printf(&out, "%s%Q: {id: %d, name: %Q, tags: [%d, %d, %d]}",
+                i > 0 ? ", " : "", key, i, "some longer string value", i,
+                i + 1, i + 2);
+  }
+  json_printf(&out, "}");
+  *len = (int) out.u.buf.len;
+  return buf;
+}
+
+static void bench_scanf(void) {
+  static const char *fmts[] = {
+      "{f0: {id: %d}}",
+      "{f0: {id: %d}, f1: {id: %d}}",
+      "{f0: {id: %d}, f1: {id: %d}, f2: {id: %d}, f3: {id: %d}}",
+      "{f0: {id: %d}, f1: {id: %d}, f2: {id: %d}, f3: {id: %d}, "
+      "f4: {id: %d}, f5: {id: %d}, f6: {id: %d}, f7: {id: %d}}",
+      "{f0: {id: %d}, f1: {id: %d}, f2: {id: %d}, f3: {id: %d}, "
+      "f4: {id: %d}, f5: {id: %d}, f6: {id: %d}, f7: {id: %d}, "
+      "f8: {id: %d}, f9: {id: %d}, f10: {id: %d}, f11: {id: %d}}",
+  };
+  static const char *names[] = {
+      "json_scanf 40KB,  1 field", "json_scanf 40KB,  2 fields",
+      "json_scanf 40KB,  4 fields", "json_scanf 40KB,  8 fields",
+      "json_scanf 40KB, 12 fields",
+  };
+  int v[12], len;
+  size_t i;
+  char *s = make_object(40 * 1024, &len);
+  struct bench b;
+
+  for (i = 0; i < sizeof(fmts) / sizeof(fmts[0]); i++) {
+    bench_start(&b, names[i], len);
+    while (bench_running(&b)) {
+      json_scanf(s, len, fmts[i], &v[0], &v[1], &v[2], &v[3], &v[4], &v[5],
+                 &v[6], &v[7], &v[8], &v[9], &v[10], &v[11]);
+      b.iterations++;
+    }
+    bench_end(&b);
+  }
+
+  free(s);
+}
+
+/* Make a JSON array of `n` small objects */
+static char *make_array(int n, int *len) {
+  size_t size = n * 32 + 16;
+  char *buf = (char *) malloc(size);
+  struct json_out out = JSON_OUT_BUF(buf, size);
+  int i;
+  json_printf(&out, "[");
+  for (i = 0; i < n; i++) {
+    json_printf(&out, "%s{id: %d, ok: %B}", i > 0 ? ", " : "", i, i & 1);
+  }
+  json_printf(&out, "]");
+  *len = (int) out.u.buf.len;
+  return buf;
+}
+
+static void bench_iter(void) {
+  int len, idx;
+  char *s = make_array(5000, &len);
+  struct json_token val;
+  struct json_iter it;
+  struct bench b;
+  void *h;
+
+  bench_start(&b, "json_next_elem 5000 elements", len);
+  while (bench_running(&b)) {
+    h = NULL;
+    while ((h = json_next_elem(s, len, h, "", &idx, &val)) != NULL) {
+    }
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_iter_next 5000 elements", len);
+  while (bench_running(&b)) {
+    json_iter_init(&it, s, len, "");
+    while (json_iter_next(&it, NULL, &val) > 0) {
+    }
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  free(s);
+}
+
+/* Make a JSON array of about `size` bytes of long log-like strings */
+static char *make_strings(size_t size, int *len) {
+  char *buf = (char *) malloc(size + 1024);
+  struct json_out out = JSON_OUT_BUF(buf, size + 1024);
+  char line[512];
+  int i;
+  for (i = 0; i < (int) sizeof(line) - 1; i++) line[i] = 'a' + i % 26;
+  line[sizeof(line) - 1] = '\0';
+  json_printf(&out, "[");
+  for (i = 0; out.u.buf.len < size; i++) {
+    json_printf(&out, "%s%Q", i > 0 ? ", " : "", line);
+  }
+  json_printf(&out, "]");
+  *len = (int) out.u.buf.len;
+  return buf;
+}
+
+static int skip_all_cb(void *data, const char *name, size_t name_len,
+                       const char *path, const struct json_token *token) {
+  (void) data;
+  (void) name;
+  (void) name_len;
+  return path[0] != '\0' && token->ptr == NULL ? JSON_WALK_SKIP_SUBTREE
+                                               : JSON_WALK_CONTINUE;
+}
+
+static int count_cb(void *data, const char *name, size_t name_len,
+                    const char *path, const struct json_token *token) {
+  (void) name;
+  (void) name_len;
+  (void) path;
+  (void) token;
+  (*(long *) data)++;
+  return JSON_WALK_CONTINUE;
+}
+
+static void bench_walk_path(void) {
+  int len;
+  char *s = make_array(50000, &len);
+  long count = 0;
+  struct bench b;
+
+  bench_start(&b, "json_walk_ex 50000 elements", len);
+  while (bench_running(&b)) {
+    json_walk_ex(s, len, count_cb, &count, 0);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_walk_ex 50000 elements, no path", len);
+  while (bench_running(&b)) {
+    json_walk_ex(s, len, count_cb, &count, JSON_WALK_NO_PATH);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  free(s);
+}
+
+/* Make an array of `n` arrays, each nested `depth` levels deep */
+static char *make_nested(int n, int depth, int *len) {
+  char *buf = (char *) malloc(n * (depth * 2 + 2) + 3);
+  char *p = buf;
+  int i;
+  *p++ = '[';
+  for (i = 0; i < n; i++) {
+    if (i > 0) *p++ = ',';
+    memset(p, '[', depth);
+    p += depth;
+    *p++ = '1';
+    memset(p, ']', depth);
+    p += depth;
+  }
+  *p++ = ']';
+  *len = p - buf;
+  return buf;
+}
+
+static void bench_walk(void) {
+  int len, pretty_len, strings_len, nested_len;
+  char *s = make_object(1024 * 1024, &len);
+  char *strings = make_strings(1024 * 1024, &strings_len);
+  char *nested = make_nested(2600, 200, &nested_len);
+  long count = 0;
+  char *pretty = (char *) malloc(len * 4);
+  struct json_out out = JSON_OUT_BUF(pretty, len * 4);
+  struct bench b;
+
+  json_prettify(s, len, &out);
+  pretty_len = (int) out.u.buf.len;
+
+  bench_start(&b, "json_walk 1MB", len);
+  while (bench_running(&b)) {
+    json_walk(s, len, NULL, NULL);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_walk 1MB, pretty-printed", pretty_len);
+  while (bench_running(&b)) {
+    json_walk(pretty, pretty_len, NULL, NULL);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_walk 1MB, long strings", strings_len);
+  while (bench_running(&b)) {
+    json_walk(strings, strings_len, NULL, NULL);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_walk_ex 1MB, skipping all subtrees", len);
+  while (bench_running(&b)) {
+    json_walk_ex(s, len, skip_all_cb, NULL, 0);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_walk 1MB, nested 200 deep", nested_len);
+  while (bench_running(&b)) {
+    json_walk(nested, nested_len, NULL, NULL);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_walk_ex 1MB, nested 200 deep", nested_len);
+  while (bench_running(&b)) {
+    json_walk_ex(nested, nested_len, count_cb, &count, 0);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  free(nested);
+  free(strings);
+  free(pretty);
+  free(s);
+}
+
+static void bench_lookup(void) {
+  int len;
+  char *s = make_array(5000, &len);
+  struct json_token t, *tokens;
+  struct bench b;
+
+  bench_start(&b, "json_scanf_array_elem [10] of 5000", len);
+  while (bench_running(&b)) {
+    json_scanf_array_elem(s, len, "", 10, &t);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_scanf_array_elem [4990] of 5000", len);
+  while (bench_running(&b)) {
+    json_scanf_array_elem(s, len, "", 4990, &t);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_scanf_array_elem loop, 500 of 5000", len);
+  while (bench_running(&b)) {
+    int i;
+    for (i = 0; i < 500 && json_scanf_array_elem(s, len, "", i, &t) > 0; i++) {
+    }
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  tokens = (struct json_token *) malloc(5000 * sizeof(*tokens));
+  bench_start(&b, "json_scanf_array 5000 of 5000", len);
+  while (bench_running(&b)) {
+    json_scanf_array(s, len, "", tokens, 5000);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  free(tokens);
+  free(s);
+}
+
+static void bench_tape(void) {
+  static const char *fmt =
+      "{f0: {id: %d}, f1: {id: %d}, f2: {id: %d}, f3: {id: %d}, "
+      "f4: {id: %d}, f5: {id: %d}, f6: {id: %d}, f7: {id: %d}, "
+      "f8: {id: %d}, f9: {id: %d}, f10: {id: %d}, f11: {id: %d}}";
+  int v[12], len, n;
+  char *s = make_object(40 * 1024, &len);
+  int max_tokens = json_tokenize(s, len, NULL, 0);
+  struct json_tape_token *tape = (struct json_tape_token *) malloc(
+      max_tokens * sizeof(*tape));
+  struct bench b;
+
+  bench_start(&b, "json_tokenize 40KB", len);
+  while (bench_running(&b)) {
+    n = json_tokenize(s, len, tape, max_tokens);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_tape_scanf 40KB, 12 fields", 0);
+  while (bench_running(&b)) {
+    json_tape_scanf(s, tape, n, fmt, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5],
+                    &v[6], &v[7], &v[8], &v[9], &v[10], &v[11]);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_tape_find 40KB, last field", 0);
+  while (bench_running(&b)) {
+    json_tape_find(s, tape, n, ".f500.tags[2]");
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  free(tape);
+  free(s);
+}
+
+static void bench_query(void) {
+  char paths[40][20];
+  int i, v, len;
+  char *s = make_object(1024 * 1024, &len);
+  struct json_query_set *q = json_query_new();
+  struct json_token tokens[40];
+  struct bench b;
+
+  for (i = 0; i < 40; i++) {
+    snprintf(paths[i], sizeof(paths[i]), ".f%d.id", i * 300);
+    json_query_add(q, paths[i], &tokens[i], NULL, NULL);
+  }
+
+  bench_start(&b, "json_scanf 1MB, 40 separate fields", len);
+  while (bench_running(&b)) {
+    for (i = 0; i < 40; i++) {
+      char fmt[40];
+      snprintf(fmt, sizeof(fmt), "{f%d: {id: %%d}}", i * 300);
+      json_scanf(s, len, fmt, &v);
+    }
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_query_run 1MB, 40 fields", len);
+  while (bench_running(&b)) {
+    json_query_run(q, s, len);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  json_query_free(q);
+  free(s);
+}
+
+static void count_void_cb(void *data, const char *name, size_t name_len,
+                          const char *path, const struct json_token *token) {
+  count_cb(data, name, name_len, path, token);
+}
+
+static void bench_stream(void) {
+  static const int chunk_sizes[] = {4096, 64};
+  static struct json_stream st;
+  int i, off, len;
+  char *s = make_object(1024 * 1024, &len);
+  long count = 0;
+  struct bench b;
+
+  bench_start(&b, "json_walk 1MB, callback", len);
+  while (bench_running(&b)) {
+    json_walk(s, len, count_void_cb, &count);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  for (i = 0; i < (int) (sizeof(chunk_sizes) / sizeof(chunk_sizes[0])); i++) {
+    int k = chunk_sizes[i];
+    char name[50];
+    snprintf(name, sizeof(name), "json_stream_feed 1MB, %d byte chunks", k);
+    bench_start(&b, name, len);
+    while (bench_running(&b)) {
+      json_stream_init(&st, count_void_cb, &count);
+      for (off = 0; off < len; off += k) {
+        json_stream_feed(&st, s + off, off + k > len ? len - off : k);
+      }
+      json_stream_finish(&st);
+      b.iterations++;
+    }
+    bench_end(&b);
+  }
+
+  free(s);
+}
+
+static void bench_numbers(void) {
+  static const char *nums[] = {"0",     "42",          "-17",
+                               "3.14",  "1234567890",  "-0.000123",
+                               "6.02e23", "98765.4321", "1e-7"};
+  const int n = sizeof(nums) / sizeof(nums[0]);
+  struct json_number num;
+  struct bench b;
+  double sum = 0;
+  int i;
+
+  bench_start(&b, "sscanf %lf, 9 numbers", 0);
+  while (bench_running(&b)) {
+    for (i = 0; i < n; i++) {
+      double d;
+      sscanf(nums[i], "%lf", &d);
+      sum += d;
+    }
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_parse_number, 9 numbers", 0);
+  while (bench_running(&b)) {
+    for (i = 0; i < n; i++) {
+      json_parse_number(nums[i], strlen(nums[i]), &num);
+      sum += num.d;
+    }
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  if (sum == 0) printf("\n");
+}
+
+static void bench_arena(void) {
+  static const char *s =
+      "{a: \"first string\", b: \"second string\", c: \"third\\tstring\","
+      " d: \"fourth string\", e: \"fifth string\", f: \"sixth string\"}";
+  static const char *fmt = "{a: %Q, b: %Q, c: %Q, d: %Q, e: %Q, f: %Q}";
+  int i, len = strlen(s);
+  char *v[6], mem[1024];
+  struct json_arena arena;
+  struct bench b;
+
+  bench_start(&b, "json_scanf 6 x %Q, malloc/free", len);
+  while (bench_running(&b)) {
+    json_scanf(s, len, fmt, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]);
+    for (i = 0; i < 6; i++) free(v[i]);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  json_arena_init(&arena, mem, sizeof(mem));
+  bench_start(&b, "json_scanf_arena 6 x %Q", len);
+  while (bench_running(&b)) {
+    json_scanf_arena(s, len, &arena, fmt, &v[0], &v[1], &v[2], &v[3], &v[4],
+                     &v[5]);
+    json_arena_reset(&arena);
+    b.iterations++;
+  }
+  bench_end(&b);
+}
+
+static void bench_plan(void) {
+  static const char *s =
+      "{id: 42, name: \"sensor\", on: true, temp: 21.5, loc: {x: 1, y: 2}}";
+  static const char *fmt =
+      "{id: %d, name: %.*Q, on: %B, temp: %f, loc: {x: %d, y: %d}}";
+  int i, len = strlen(s), x, y;
+  char name[16];
+  bool on;
+  float temp;
+  struct json_scanf_plan *plan = json_scanf_compile(fmt);
+  struct bench b;
+
+  bench_start(&b, "json_scanf 6 fields", len);
+  while (bench_running(&b)) {
+    json_scanf(s, len, fmt, &i, (int) sizeof(name), name, &on, &temp, &x, &y);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_scanf_exec 6 fields", len);
+  while (bench_running(&b)) {
+    json_scanf_exec(plan, s, len, NULL, &i, (int) sizeof(name), name, &on,
+                    &temp, &x, &y);
+    b.iterations++;
+  }
+  bench_end(&b);
+  json_scanf_plan_free(plan);
+}
+
+static void bench_printf(void) {
+  static const char *fmt =
+      "{id: %d, name: %Q, active: %B, score: %d, tags: [%Q, %Q], "
+      "owner: {user_id: %d, display_name: %Q}, created_at: %Q}";
+  char buf[512];
+  struct json_out out = JSON_OUT_BUF(buf, sizeof(buf));
+  struct json_printf_plan *plan = json_printf_compile(fmt);
+  struct bench b;
+  int len = json_printf(&out, fmt, 42, "sensor", 1, 97, "a", "b", 7, "root",
+                        "2020-01-01T00:00:00Z");
+
+  bench_start(&b, "json_printf 9 fields", len);
+  while (bench_running(&b)) {
+    out.u.buf.len = 0;
+    json_printf(&out, fmt, 42, "sensor", 1, 97, "a", "b", 7, "root",
+                "2020-01-01T00:00:00Z");
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_printf_exec 9 fields", len);
+  while (bench_running(&b)) {
+    out.u.buf.len = 0;
+    json_printf_exec(&out, plan, 42, "sensor", 1, 97, "a", "b", 7, "root",
+                     "2020-01-01T00:00:00Z");
+    b.iterations++;
+  }
+  bench_end(&b);
+  json_printf_plan_free(plan);
+}
+
+/* Number of calls to count_file_printer() */
+static long printer_calls;
+
+static int count_file_printer(struct json_out *out, const char *buf,
+                              size_t len) {
+  printer_calls++;
+  return json_printer_file(out, buf, len);
+}
+
+static void bench_buffered(void) {
+  int len;
+  char *s = make_object(40 * 1024, &len), stage[4096];
+  FILE *fp = fopen("/dev/null", "wb");
+  struct json_out out = {count_file_printer, {{NULL, 0, 0, NULL}}};
+  struct json_out_buffered b;
+  struct bench bn;
+
+  if (fp == NULL) return;
+  out.u.fp = fp;
+  printer_calls = 0;
+  bench_start(&bn, "json_prettify 40KB to FILE", len);
+  while (bench_running(&bn)) {
+    json_prettify(s, len, &out);
+    bn.iterations++;
+  }
+  bench_end(&bn);
+  printf("%-40s %10.4f calls/byte\n", "  printer calls",
+         (double) printer_calls / bn.iterations / len);
+
+  json_out_buffered_init(&b, &out, stage, sizeof(stage));
+  printer_calls = 0;
+  bench_start(&bn, "json_prettify 40KB to FILE, buffered", len);
+  while (bench_running(&bn)) {
+    json_prettify(s, len, &b.out);
+    json_out_flush(&b);
+    bn.iterations++;
+  }
+  bench_end(&bn);
+  printf("%-40s %10.4f calls/byte\n", "  printer calls",
+         (double) printer_calls / bn.iterations / len);
+
+  fclose(fp);
+  free(s);
+}
+
+/* Print a response of about 4KB */
+static int print_response(struct json_out *out) {
+  int i, n = json_printf(out, "{items: [");
+  for (i = 0; i < 50; i++) {
+    n += json_printf(out, "%s{id: %d, name: %Q, ok: %B}", i > 0 ? ", " : "", i,
+                     "some longer string value", i & 1);
+  }
+  return n + json_printf(out, "]}");
+}
+
+static void bench_dynbuf(void) {
+  struct json_out out = JSON_OUT_DYNBUF(NULL);
+  struct bench b;
+  int len = print_response(&out);
+
+  bench_start(&b, "print 4KB twice, measure and malloc", len);
+  while (bench_running(&b)) {
+    struct json_out sizer = JSON_OUT_BUF(NULL, 0);
+    int n = print_response(&sizer);
+    char *buf = (char *) malloc(n + 1);
+    struct json_out out2 = JSON_OUT_BUF(buf, n + 1);
+    print_response(&out2);
+    free(buf);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "print 4KB to JSON_OUT_DYNBUF, reused", len);
+  while (bench_running(&b)) {
+    json_out_dynbuf_reset(&out);
+    print_response(&out);
+    b.iterations++;
+  }
+  bench_end(&b);
+  json_out_dynbuf_free(&out);
+}
+
+static void bench_dtoa(void) {
+  static const double v[8] = {21.5,   -3.25e-5, 1013.25, 0.1,
+                              1e21,   42,       3.14159, 299792458};
+  static const long long n[8] = {0, -1, 42, 1000000, -987654321,
+                                 1LL << 40, 7, 1234567890123LL};
+  char buf[512];
+  struct json_out out = JSON_OUT_BUF(buf, sizeof(buf));
+  struct bench b;
+
+  bench_start(&b, "json_printf 8 x %.17g", 0);
+  while (bench_running(&b)) {
+    out.u.buf.len = 0;
+    json_printf(&out, "[%.17g, %.17g, %.17g, %.17g, %.17g, %.17g, %.17g, %.17g]",
+                v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_printf 8 x %D", 0);
+  while (bench_running(&b)) {
+    out.u.buf.len = 0;
+    json_printf(&out, "[%D, %D, %D, %D, %D, %D, %D, %D]", v[0], v[1], v[2],
+                v[3], v[4], v[5], v[6], v[7]);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_printf 8 x %05lld, system printf", 0);
+  while (bench_running(&b)) {
+    out.u.buf.len = 0;
+    json_printf(&out, "[%05lld, %05lld, %05lld, %05lld, %05lld, %05lld, "
+                "%05lld, %05lld]", n[0], n[1], n[2], n[3], n[4], n[5], n[6],
+                n[7]);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_printf 8 x %lld, native", 0);
+  while (bench_running(&b)) {
+    out.u.buf.len = 0;
+    json_printf(&out, "[%lld, %lld, %lld, %lld, %lld, %lld, %lld, %lld]", n[0],
+                n[1], n[2], n[3], n[4], n[5], n[6], n[7]);
+    b.iterations++;
+  }
+  bench_end(&b);
+}
+
+static void bench_array(void) {
+  size_t i, n = 100000;
+  double *v = (double *) malloc(n * sizeof(*v));
+  int32_t *ids = (int32_t *) malloc(n * sizeof(*ids));
+  struct json_out out = JSON_OUT_DYNBUF(NULL);
+  struct bench b;
+  int len;
+
+  for (i = 0; i < n; i++) {
+    v[i] = 20 + (double) (i % 1000) / 64;
+    ids[i] = (int32_t) (i * 7919);
+  }
+  len = json_printf(&out, "%M", json_printf_array_double, v, n);
+
+  bench_start(&b, "json_printf_array 100k doubles, %.17g", len);
+  while (bench_running(&b)) {
+    json_out_dynbuf_reset(&out);
+    json_printf(&out, "%M", json_printf_array, v, n * sizeof(*v), sizeof(*v),
+                "%.17g");
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_printf_array 100k doubles, %D", len);
+  while (bench_running(&b)) {
+    json_out_dynbuf_reset(&out);
+    json_printf(&out, "%M", json_printf_array, v, n * sizeof(*v), sizeof(*v),
+                "%D");
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_printf_array_double 100k doubles", len);
+  while (bench_running(&b)) {
+    json_out_dynbuf_reset(&out);
+    json_printf(&out, "%M", json_printf_array_double, v, n);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  json_out_dynbuf_reset(&out);
+  len = json_printf(&out, "%M", json_printf_array_int32, ids, n);
+  bench_start(&b, "json_printf_array 100k ints, %d", len);
+  while (bench_running(&b)) {
+    json_out_dynbuf_reset(&out);
+    json_printf(&out, "%M", json_printf_array, ids, n * sizeof(*ids),
+                sizeof(*ids), "%d");
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  json_out_dynbuf_free(&out);
+  free(ids);
+  free(v);
+}
+
+static void bench_writer(void) {
+  static const char *names[4] = {"kitchen", "hall", "garage", "attic"};
+  struct json_out out = JSON_OUT_DYNBUF(NULL);
+  struct json_writer w;
+  struct bench b;
+  int i, len;
+
+  for (i = 0; i < 1000; i++) {
+    json_printf(&out, i == 0 ? "[{id: %d, name: %Q, temp: %D}"
+                             : ", {id: %d, name: %Q, temp: %D}",
+                i, names[i % 4], 20 + i % 50 * 0.25);
+  }
+  json_printf(&out, "]");
+  len = out.u.buf.len;
+
+  bench_start(&b, "json_printf 1000 rows", len);
+  while (bench_running(&b)) {
+    json_out_dynbuf_reset(&out);
+    json_printf(&out, "[");
+    for (i = 0; i < 1000; i++) {
+      json_printf(&out, i == 0 ? "{id: %d, name: %Q, temp: %D}"
+                               : ", {id: %d, name: %Q, temp: %D}",
+                  i, names[i % 4], 20 + i % 50 * 0.25);
+    }
+    json_printf(&out, "]");
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_writer 1000 rows", len);
+  while (bench_running(&b)) {
+    json_out_dynbuf_reset(&out);
+    json_writer_init(&w, &out, 0);
+    json_writer_begin_array(&w);
+    for (i = 0; i < 1000; i++) {
+      json_writer_begin_object(&w);
+      json_writer_key(&w, "id");
+      json_writer_int(&w, i);
+      json_writer_key(&w, "name");
+      json_writer_string(&w, names[i % 4]);
+      json_writer_key(&w, "temp");
+      json_writer_double(&w, 20 + i % 50 * 0.25);
+      json_writer_end_object(&w);
+    }
+    json_writer_end_array(&w);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  json_out_dynbuf_free(&out);
+}
+
+static void bench_escape(void) {
+  static const char *chunk =
+      "The quick brown fox jumps over the lazy dog. \"Quoted\" text, "
+      "a tab\tand a newline\n, then caf\xc3\xa9 and more plain ASCII. ";
+  size_t i, len = 0, chunk_len = strlen(chunk);
+  char *s = (char *) malloc(64 * 1024), *dst = (char *) malloc(80 * 1024);
+  struct json_out out = JSON_OUT_BUF(dst, 80 * 1024);
+  struct bench b;
+
+  for (i = 0; len + chunk_len <= 64 * 1024; i++, len += chunk_len) {
+    memcpy(s + len, chunk, chunk_len);
+  }
+
+  bench_start(&b, "json_escape 64KB text", len);
+  while (bench_running(&b)) {
+    out.u.buf.len = 0;
+    json_escape(&out, s, len);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  free(s);
+  free(dst);
+}
+
+static void bench_base64(void) {
+  int i, n = 4 * 1024 * 1024, len;
+  unsigned char *data = (unsigned char *) malloc(n);
+  char *json, *blob = NULL;
+  struct json_out out = JSON_OUT_DYNBUF(NULL);
+  struct bench b;
+
+  for (i = 0; i < n; i++) data[i] = (unsigned char) (i * 2654435761U >> 24);
+  json_printf(&out, "{a: %V}", data, n);
+  json = out.u.buf.buf;
+  len = (int) out.u.buf.len;
+
+  bench_start(&b, "json_printf %V 4MB", n);
+  while (bench_running(&b)) {
+    json_out_dynbuf_reset(&out);
+    json_printf(&out, "{a: %V}", data, n);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_scanf %V 4MB", n);
+  while (bench_running(&b)) {
+    int blob_len;
+    json_scanf(json, len, "{a: %V}", &blob, &blob_len);
+    free(blob);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  json_out_dynbuf_free(&out);
+  free(data);
+}
+
+static void bench_hex(void) {
+  unsigned char digest[32];
+  char json[128], *hex = NULL;
+  struct json_out out = JSON_OUT_BUF(json, sizeof(json));
+  struct bench b;
+  int i, len;
+
+  for (i = 0; i < (int) sizeof(digest); i++) digest[i] = (unsigned char) i;
+  len = json_printf(&out, "{sha256: %H}", (int) sizeof(digest), digest);
+
+  bench_start(&b, "json_printf %H 32-byte digest", len);
+  while (bench_running(&b)) {
+    out.u.buf.len = 0;
+    json_printf(&out, "{sha256: %H}", (int) sizeof(digest), digest);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_scanf %H 32-byte digest", len);
+  while (bench_running(&b)) {
+    int n;
+    json_scanf(json, len, "{sha256: %H}", &n, &hex);
+    free(hex);
+    b.iterations++;
+  }
+  bench_end(&b);
+}
+
+static void bench_map_file(void) {
+  const char *fname = "bench.json";
+  FILE *fp = fopen(fname, "wb");
+  struct json_out out = JSON_OUT_FILE(fp);
+  struct json_file f;
+  struct bench b;
+  int i, len;
+  char *p;
+
+  len = json_printf(&out, "[");
+  for (i = 0; i < 200000; i++) {
+    len += json_printf(&out, "%s{id: %d, name: %Q, tags: [%Q, %Q], v: %D}",
+                       i == 0 ? "" : ", ", i, "sensor", "indoor", "temp",
+                       i * 0.25);
+  }
+  len += json_printf(&out, "]");
+  fclose(fp);
+
+  bench_start(&b, "json_fread + json_walk", len);
+  while (bench_running(&b)) {
+    p = json_fread(fname);
+    json_walk(p, len, NULL, NULL);
+    free(p);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_map_file + json_walk", len);
+  while (bench_running(&b)) {
+    json_map_file(&f, fname, 0);
+    json_walk(f.data, f.len, NULL, NULL);
+    json_unmap_file(&f);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  bench_start(&b, "json_map_file POPULATE + json_walk", len);
+  while (bench_running(&b)) {
+    json_map_file(&f, fname, JSON_MAP_POPULATE);
+    json_walk(f.data, f.len, NULL, NULL);
+    json_unmap_file(&f);
+    b.iterations++;
+  }
+  bench_end(&b);
+
+  remove(fname);
+}
+
+int main(void) {
+  bench_walk();
+  bench_walk_path();
+  bench_stream();
+  bench_scanf();
+  bench_numbers();
+  bench_arena();
+  bench_plan();
+  bench_printf();
+  bench_buffered();
+  bench_dynbuf();
+  bench_dtoa();
+  bench_array();
+  bench_writer();
+  bench_escape();
+  bench_base64();
+  bench_hex();
+  bench_tape();
+  bench_query();
+  bench_iter();
+  bench_lookup();
+  bench_map_file();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2004-2013 Sergey Lyubka <valenok@gmail.com>
+ * Copyright (c) 2013 Cesanta Software Limited
+ * Copyright (c) 2020 Julian Smythe <sausage@tehsausage.com>
+ * All rights reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "elsa.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Alignment of the blocks returned by json_arena_alloc() */
+#define JSON_ARENA_ALIGN sizeof(void *)
+
+/* Heap chunk, followed by its data */
+struct json_arena_chunk {
+  struct json_arena_chunk *next;
+  void *align; /* Keeps the data aligned */
+};
+
+void json_arena_init(struct json_arena *a, void *buf, size_t size) {
+  a->user_buf = (char *) buf;
+  a->user_size = buf == NULL ? 0 : size;
+  a->chunks = NULL;
+  a->buf = a->user_buf;
+  a->size = a->user_size;
+  a->used = 0;
+}
+
+void *json_arena_alloc(struct json_arena *a, size_t n) {
+  struct json_arena_chunk *c;
+  size_t pad = 0;
+
+  if (a->buf != NULL) {
+    pad = (0 - (uintptr_t) (a->buf + a->used)) & (JSON_ARENA_ALIGN - 1);
+  }
+  if (a->buf == NULL || pad + n > a->size - a->used) {
+    /* Start a new chunk, the rest of the current one is lost */
+    size_t size = n > JSON_ARENA_CHUNK_SIZE ? n : JSON_ARENA_CHUNK_SIZE;
+    if ((c = (struct json_arena_chunk *) malloc(sizeof(*c) + size)) == NULL) {
+      return NULL;
+    }
+    c->next = a->chunks;
+    a->chunks = c;
+    a->buf = (char *) (c + 1);
+    a->size = size;
+    a->used = pad = 0;
+  }
+
+  a->used += pad + n;
+  return a->buf + a->used - n;
+}
+
+void json_arena_reset(struct json_arena *a) {
+  while (a->chunks != NULL) {
+    struct json_arena_chunk *next = a->chunks->next;
+    free(a->chunks);
+    a->chunks = next;
+  }
+  a->buf = a->user_buf;
+  a->size = a->user_size;
+  a->used = 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2004-2013 Sergey Lyubka <valenok@gmail.com>
+ * Copyright (c) 2013 Cesanta Software Limited
+ * Copyright (c) 2020 Julian Smythe <sausage@tehsausage.com>
+ * All rights reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "elsa.h"
+#include <stdint.h>
+#include <string.h>
+#include "simd.h"
+
+/*
+ * SSSE3 byte shuffles, which AVX2 implies, drive the vectorised codecs of
+ * W. Mula and D. Lemire, "Faster Base64 Encoding and Decoding Using AVX2
+ * Instructions" (2018), 12 bytes to 16 characters at a time.
+ */
+#if defined(JSON_SIMD_AVX2) || (defined(JSON_SIMD_SSE2) && defined(__SSSE3__))
+#define JSON_BASE64_SSSE3
+#include <tmmintrin.h>
+#endif
+
+static const char b64_chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Values of the base64 characters, 0xff for other characters */
+static const unsigned char b64_values[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12,
+    0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24,
+    0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+    0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff
+};
+
+#if defined(JSON_BASE64_SSSE3)
+/* Encode the first 12 of the 16 bytes at `src` into 16 characters at `dst` */
+static void b64_encode_block(const unsigned char *src, char *dst) {
+  __m128i in = _mm_loadu_si128((const __m128i *) src);
+  __m128i t0, t1, t2, t3, idx, shift;
+
+  /* Spread 3 bytes into 4 bytes of 6 bits each */
+  in = _mm_shuffle_epi8(
+      in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+  t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+  t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+  t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+  in = _mm_or_si128(t1, t3);
+
+  /* Offset of the character of each range of values, looked up by range */
+  idx = _mm_subs_epu8(in, _mm_set1_epi8(51));
+  idx = _mm_sub_epi8(idx, _mm_cmpgt_epi8(in, _mm_set1_epi8(25)));
+  shift = _mm_shuffle_epi8(_mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4,
+                                         -4, -4, -4, -19, -16, 0, 0),
+                           idx);
+  _mm_storeu_si128((__m128i *) dst, _mm_add_epi8(in, shift));
+}
+
+/*
+ * Decode the 16 characters at `src` into 12 bytes at `dst`, which must have
+ * room for 16. Return 0 if a character is not a base64 one.
+ */
+static int b64_decode_block(const char *src, unsigned char *dst) {
+  __m128i in = _mm_loadu_si128((const __m128i *) src);
+  __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4),
+                                     _mm_set1_epi8(0x0f));
+  __m128i lo_nibbles = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+  __m128i lo, hi, roll, ab_bc, out;
+
+  /* Each character class has a bit, set for both of its nibbles */
+  lo = _mm_shuffle_epi8(
+      _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                    0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a),
+      lo_nibbles);
+  hi = _mm_shuffle_epi8(
+      _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10,
+                    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10),
+      hi_nibbles);
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi),
+                                       _mm_setzero_si128())) != 0xffff) {
+    return 0;
+  }
+
+  /* Characters to values: an offset per high nibble, '/' is special */
+  roll = _mm_shuffle_epi8(
+      _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0),
+      _mm_add_epi8(_mm_cmpeq_epi8(in, _mm_set1_epi8('/')), hi_nibbles));
+  in = _mm_add_epi8(in, roll);
+
+  /* Pack 4 values of 6 bits into 3 bytes */
+  ab_bc = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+  out = _mm_madd_epi16(ab_bc, _mm_set1_epi32(0x00011000));
+  out = _mm_shuffle_epi8(out, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13,
+                                            12, -1, -1, -1, -1));
+  _mm_storeu_si128((__m128i *) dst, out);
+  return 1;
+}
+#endif
+
+int json_base64_encode(const unsigned char *src, int len, char *dst) {
+  const unsigned char *end = src + len;
+  char *p = dst;
+
+#if defined(JSON_BASE64_SSSE3)
+  for (; end - src >= 16; src += 12, p += 16) b64_encode_block(src, p);
+#endif
+  for (; end - src >= 3; src += 3, p += 4) {
+    uint32_t v = (uint32_t) src[0] << 16 | (uint32_t) src[1] << 8 | src[2];
+    p[0] = b64_chars[v >> 18];
+    p[1] = b64_chars[(v >> 12) & 63];
+    p[2] = b64_chars[(v >> 6) & 63];
+    p[3] = b64_chars[v & 63];
+  }
+  if (end - src > 0) {
+    uint32_t v = (uint32_t) src[0] << 16 | (end - src > 1 ? src[1] << 8 : 0);
+    p[0] = b64_chars[v >> 18];
+    p[1] = b64_chars[(v >> 12) & 63];
+    p[2] = end - src > 1 ? b64_chars[(v >> 6) & 63] : '=';
+    p[3] = '=';
+    p += 4;
+  }
+
+  return p - dst;
+}
+
+int json_base64_decode(const char *src, int len, unsigned char *dst) {
+  const unsigned char *s = (const unsigned char *) src;
+  unsigned char *p = dst;
+  uint32_t v;
+  int tail;
+
+  /* Padding makes the length a multiple of 4, without it 1 is left at most */
+  if (len % 4 == 0 && len > 0 && s[len - 1] == '=') {
+    len -= s[len - 2] == '=' ? 2 : 1;
+  }
+  tail = len % 4;
+  if (tail == 1) return JSON_STRING_INVALID;
+
+#if defined(JSON_BASE64_SSSE3)
+  /* Keep 8 characters for the scalar loop, so that 16 bytes can be stored */
+  for (; len - (s - (const unsigned char *) src) >= 24; s += 16, p += 12) {
+    if (!b64_decode_block((const char *) s, p)) return JSON_STRING_INVALID;
+  }
+#endif
+  for (; len - (s - (const unsigned char *) src) >= 4; s += 4, p += 3) {
+    uint32_t a = b64_values[s[0]], b = b64_values[s[1]], c = b64_values[s[2]],
+             d = b64_values[s[3]];
+    if ((a | b | c | d) & 0x80) return JSON_STRING_INVALID;
+    v = a << 18 | b << 12 | c << 6 | d;
+    p[0] = (unsigned char) (v >> 16);
+    p[1] = (unsigned char) (v >> 8);
+    p[2] = (unsigned char) v;
+  }
+  if (tail > 0) {
+    uint32_t a = b64_values[s[0]], b = b64_values[s[1]],
+             c = tail > 2 ? b64_values[s[2]] : 0;
+    if ((a | b | c) & 0x80) return JSON_STRING_INVALID;
+    v = a << 18 | b << 12 | c << 6;
+    *p++ = (unsigned char) (v >> 16);
+    if (tail > 2) *p++ = (unsigned char) (v >> 8);
+  }
+
+  return p - dst;
+}
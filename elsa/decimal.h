@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2004-2013 Sergey Lyubka <valenok@gmail.com>
+ * Copyright (c) 2013 Cesanta Software Limited
+ * Copyright (c) 2020 Julian Smythe <sausage@tehsausage.com>
+ * All rights reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef ELSA_DECIMAL_H_
+#define ELSA_DECIMAL_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Exact decimal arithmetic, as in the strconv package of Go: the slow paths
+ * of `json_parse_number()` and `json_dtoa()`, for the numbers that 64-bit
+ * arithmetic cannot round. Every double, and every number halfway between
+ * two doubles, fits the digits exactly.
+ */
+
+/* Digits of a decimal, enough to round any double correctly */
+#define DECIMAL_DIGITS 800
+
+/* Largest shift of a decimal at a time, so that 10 << it fits 64 bits */
+#define DECIMAL_MAX_SHIFT 60
+
+/* The decimal 0.d[0]d[1]...d[nd - 1] * 10^dp */
+struct decimal {
+  unsigned char d[DECIMAL_DIGITS + 20]; /* Digits, room to shift left */
+  int nd;                               /* Number of digits */
+  int dp;                               /* Position of the decimal point */
+  int trunc; /* Nonzero digits were dropped after the last one */
+};
+
+static void decimal_trim(struct decimal *a) {
+  while (a->nd > 0 && a->d[a->nd - 1] == 0) a->nd--;
+  if (a->nd == 0) a->dp = 0;
+}
+
+static void decimal_push(struct decimal *a, int ch) {
+  if (a->nd < DECIMAL_DIGITS) {
+    a->d[a->nd++] = (unsigned char) (ch - '0');
+  } else if (ch != '0') {
+    a->trunc = 1;
+  }
+}
+
+/* Set `a` to the integer `v` */
+static void decimal_set(struct decimal *a, uint64_t v) {
+  char buf[20];
+  int n = 0;
+  for (; v > 0; v /= 10) buf[n++] = (char) (v % 10);
+  for (a->nd = 0; n > 0; a->nd++) a->d[a->nd] = (unsigned char) buf[--n];
+  a->dp = a->nd;
+  a->trunc = 0;
+  decimal_trim(a);
+}
+
+/* Multiply `a` by 2^k */
+static void decimal_shl(struct decimal *a, int k) {
+  int r = a->nd - 1, w = a->nd + 19, n, i;
+  uint64_t acc = 0, quo;
+
+  /* From the last digit, writing ahead of the reads */
+  for (; r >= 0; r--) {
+    acc += (uint64_t) a->d[r] << k;
+    quo = acc / 10;
+    a->d[w--] = (unsigned char) (acc - quo * 10);
+    acc = quo;
+  }
+  for (; acc > 0; acc = quo) {
+    quo = acc / 10;
+    a->d[w--] = (unsigned char) (acc - quo * 10);
+  }
+
+  n = a->nd + 19 - w;
+  memmove(a->d, a->d + w + 1, n);
+  a->dp += n - a->nd;
+  if (n > DECIMAL_DIGITS) {
+    for (i = DECIMAL_DIGITS; i < n; i++) {
+      if (a->d[i] != 0) a->trunc = 1;
+    }
+    n = DECIMAL_DIGITS;
+  }
+  a->nd = n;
+  decimal_trim(a);
+}
+
+/* Divide `a` by 2^k */
+static void decimal_shr(struct decimal *a, int k) {
+  uint64_t acc = 0, mask = ((uint64_t) 1 << k) - 1;
+  int r = 0, w = 0;
+
+  /* Read enough digits for the first digit of the quotient */
+  for (; (acc >> k) == 0; r++) {
+    if (r >= a->nd) {
+      if (acc == 0) {
+        a->nd = 0;
+        return;
+      }
+      while ((acc >> k) == 0) acc *= 10, r++;
+      break;
+    }
+    acc = acc * 10 + a->d[r];
+  }
+  a->dp -= r - 1;
+
+  for (; r < a->nd; r++) {
+    a->d[w++] = (unsigned char) (acc >> k);
+    acc = (acc & mask) * 10 + a->d[r];
+  }
+  for (; acc > 0; acc = (acc & mask) * 10) {
+    if (w < DECIMAL_DIGITS) {
+      a->d[w++] = (unsigned char) (acc >> k);
+    } else if ((acc >> k) > 0) {
+      a->trunc = 1;
+    }
+  }
+  a->nd = w;
+  decimal_trim(a);
+}
+
+/* Multiply `a` by 2^k, or divide it by 2^-k if k is negative */
+static void decimal_shift(struct decimal *a, int k) {
+  if (a->nd == 0) return;
+  for (; k > DECIMAL_MAX_SHIFT; k -= DECIMAL_MAX_SHIFT) {
+    decimal_shl(a, DECIMAL_MAX_SHIFT);
+  }
+  for (; k < -DECIMAL_MAX_SHIFT; k += DECIMAL_MAX_SHIFT) {
+    decimal_shr(a, DECIMAL_MAX_SHIFT);
+  }
+  if (k > 0) decimal_shl(a, k);
+  if (k < 0) decimal_shr(a, -k);
+}
+
+#endif /* ELSA_DECIMAL_H_ */
@@ -0,0 +1,513 @@
+/*
+ * Copyright (c) 2004-2013 Sergey Lyubka <valenok@gmail.com>
+ * Copyright (c) 2013 Cesanta Software Limited
+ * Copyright (c) 2020 Julian Smythe <sausage@tehsausage.com>
+ * All rights reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "elsa.h"
+#include <stdint.h>
+#include <string.h>
+#include "decimal.h"
+
+/* Pairs of decimal digits, "00" to "99" */
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536"
+    "37383940414243444546474849505152535455565758596061626364656667686970717273"
+    "7475767778798081828384858687888990919293949596979899";
+
+int json_utoa(uint64_t v, char *buf) {
+  char tmp[20], *p = tmp + sizeof(tmp);
+  int n;
+
+  /* Two digits at a time, from the right */
+  while (v >= 100) {
+    const char *d = digit_pairs + (v % 100) * 2;
+    v /= 100;
+    *--p = d[1];
+    *--p = d[0];
+  }
+  if (v >= 10) {
+    const char *d = digit_pairs + v * 2;
+    *--p = d[1];
+    *--p = d[0];
+  } else {
+    *--p = (char) ('0' + v);
+  }
+
+  n = tmp + sizeof(tmp) - p;
+  memcpy(buf, p, n);
+  buf[n] = '\0';
+  return n;
+}
+
+int json_itoa(int64_t v, char *buf) {
+  if (v >= 0) return json_utoa((uint64_t) v, buf);
+  buf[0] = '-';
+  return json_utoa(0 - (uint64_t) v, buf + 1) + 1;
+}
+
+/*
+ * Shortest round-trip formatting of doubles with the Grisu3 algorithm of
+ * Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately
+ * with Integers" (2010). It proves its digits the shortest that read back as
+ * the same double, and the closest to it of those, for all but about 0.5% of
+ * doubles. The others are formatted with exact decimal arithmetic.
+ */
+
+/* A floating point number f * 2^e, with a 64-bit significand */
+struct diy_fp {
+  uint64_t f;
+  int e;
+};
+
+#define DOUBLE_SIGNIFICAND_SIZE 52
+#define DOUBLE_EXPONENT_BIAS (0x3ff + DOUBLE_SIGNIFICAND_SIZE)
+#define DOUBLE_HIDDEN_BIT ((uint64_t) 1 << DOUBLE_SIGNIFICAND_SIZE)
+#define DOUBLE_SIGNIFICAND_MASK (DOUBLE_HIDDEN_BIT - 1)
+
+#define FLOAT_SIGNIFICAND_SIZE 23
+#define FLOAT_EXPONENT_BIAS (0x7f + FLOAT_SIGNIFICAND_SIZE)
+#define FLOAT_HIDDEN_BIT ((uint32_t) 1 << FLOAT_SIGNIFICAND_SIZE)
+#define FLOAT_SIGNIFICAND_MASK (FLOAT_HIDDEN_BIT - 1)
+
+/* Normalized powers of ten 10^-348, 10^-340, ..., 10^340 */
+static const struct diy_fp cached_powers[] = {
+    {0xfa8fd5a0081c0288ULL, -1220}, {0xbaaee17fa23ebf76ULL, -1193},
+    {0x8b16fb203055ac76ULL, -1166}, {0xcf42894a5dce35eaULL, -1140},
+    {0x9a6bb0aa55653b2dULL, -1113}, {0xe61acf033d1a45dfULL, -1087},
+    {0xab70fe17c79ac6caULL, -1060}, {0xff77b1fcbebcdc4fULL, -1034},
+    {0xbe5691ef416bd60cULL, -1007}, {0x8dd01fad907ffc3cULL, -980},
+    {0xd3515c2831559a83ULL, -954}, {0x9d71ac8fada6c9b5ULL, -927},
+    {0xea9c227723ee8bcbULL, -901}, {0xaecc49914078536dULL, -874},
+    {0x823c12795db6ce57ULL, -847}, {0xc21094364dfb5637ULL, -821},
+    {0x9096ea6f3848984fULL, -794}, {0xd77485cb25823ac7ULL, -768},
+    {0xa086cfcd97bf97f4ULL, -741}, {0xef340a98172aace5ULL, -715},
+    {0xb23867fb2a35b28eULL, -688}, {0x84c8d4dfd2c63f3bULL, -661},
+    {0xc5dd44271ad3cdbaULL, -635}, {0x936b9fcebb25c996ULL, -608},
+    {0xdbac6c247d62a584ULL, -582}, {0xa3ab66580d5fdaf6ULL, -555},
+    {0xf3e2f893dec3f126ULL, -529}, {0xb5b5ada8aaff80b8ULL, -502},
+    {0x87625f056c7c4a8bULL, -475}, {0xc9bcff6034c13053ULL, -449},
+    {0x964e858c91ba2655ULL, -422}, {0xdff9772470297ebdULL, -396},
+    {0xa6dfbd9fb8e5b88fULL, -369}, {0xf8a95fcf88747d94ULL, -343},
+    {0xb94470938fa89bcfULL, -316}, {0x8a08f0f8bf0f156bULL, -289},
+    {0xcdb02555653131b6ULL, -263}, {0x993fe2c6d07b7facULL, -236},
+    {0xe45c10c42a2b3b06ULL, -210}, {0xaa242499697392d3ULL, -183},
+    {0xfd87b5f28300ca0eULL, -157}, {0xbce5086492111aebULL, -130},
+    {0x8cbccc096f5088ccULL, -103}, {0xd1b71758e219652cULL, -77},
+    {0x9c40000000000000ULL, -50}, {0xe8d4a51000000000ULL, -24},
+    {0xad78ebc5ac620000ULL, 3}, {0x813f3978f8940984ULL, 30},
+    {0xc097ce7bc90715b3ULL, 56}, {0x8f7e32ce7bea5c70ULL, 83},
+    {0xd5d238a4abe98068ULL, 109}, {0x9f4f2726179a2245ULL, 136},
+    {0xed63a231d4c4fb27ULL, 162}, {0xb0de65388cc8ada8ULL, 189},
+    {0x83c7088e1aab65dbULL, 216}, {0xc45d1df942711d9aULL, 242},
+    {0x924d692ca61be758ULL, 269}, {0xda01ee641a708deaULL, 295},
+    {0xa26da3999aef774aULL, 322}, {0xf209787bb47d6b85ULL, 348},
+    {0xb454e4a179dd1877ULL, 375}, {0x865b86925b9bc5c2ULL, 402},
+    {0xc83553c5c8965d3dULL, 428}, {0x952ab45cfa97a0b3ULL, 455},
+    {0xde469fbd99a05fe3ULL, 481}, {0xa59bc234db398c25ULL, 508},
+    {0xf6c69a72a3989f5cULL, 534}, {0xb7dcbf5354e9beceULL, 561},
+    {0x88fcf317f22241e2ULL, 588}, {0xcc20ce9bd35c78a5ULL, 614},
+    {0x98165af37b2153dfULL, 641}, {0xe2a0b5dc971f303aULL, 667},
+    {0xa8d9d1535ce3b396ULL, 694}, {0xfb9b7cd9a4a7443cULL, 720},
+    {0xbb764c4ca7a44410ULL, 747}, {0x8bab8eefb6409c1aULL, 774},
+    {0xd01fef10a657842cULL, 800}, {0x9b10a4e5e9913129ULL, 827},
+    {0xe7109bfba19c0c9dULL, 853}, {0xac2820d9623bf429ULL, 880},
+    {0x80444b5e7aa7cf85ULL, 907}, {0xbf21e44003acdd2dULL, 933},
+    {0x8e679c2f5e44ff8fULL, 960}, {0xd433179d9c8cb841ULL, 986},
+    {0x9e19db92b4e31ba9ULL, 1013}, {0xeb96bf6ebadf77d9ULL, 1039},
+    {0xaf87023b9bf0ee6bULL, 1066},
+};
+
+/* Powers of ten that fit 64 bits */
+static const uint64_t pow10_u64[] = {
+    1ULL,
+    10ULL,
+    100ULL,
+    1000ULL,
+    10000ULL,
+    100000ULL,
+    1000000ULL,
+    10000000ULL,
+    100000000ULL,
+    1000000000ULL,
+    10000000000ULL,
+    100000000000ULL,
+    1000000000000ULL,
+    10000000000000ULL,
+    100000000000000ULL,
+    1000000000000000ULL,
+    10000000000000000ULL,
+    100000000000000000ULL,
+    1000000000000000000ULL,
+    10000000000000000000ULL};
+
+/* Return x * y, rounded to 64 bits of significand */
+static struct diy_fp diy_fp_mul(struct diy_fp x, struct diy_fp y) {
+  const uint64_t m32 = 0xffffffffULL;
+  uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32) + (1U << 31);
+  struct diy_fp r;
+  r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+  r.e = x.e + y.e + 64;
+  return r;
+}
+
+static struct diy_fp diy_fp_normalize(struct diy_fp x) {
+  while ((x.f & 0xffc0000000000000ULL) == 0) {
+    x.f <<= 10;
+    x.e -= 10;
+  }
+  while ((x.f & ((uint64_t) 1 << 63)) == 0) {
+    x.f <<= 1;
+    x.e--;
+  }
+  return x;
+}
+
+/*
+ * Compute the boundaries `m` and `p` of `v`, halfway to its neighbours,
+ * normalized with the same exponent. `lower_closer` is set if the lower
+ * neighbour is closer, see dtoa_format(). Then normalize `v`.
+ */
+static void diy_fp_boundaries(struct diy_fp *v, int lower_closer,
+                              struct diy_fp *m, struct diy_fp *p) {
+  p->f = (v->f << 1) + 1;
+  p->e = v->e - 1;
+  *p = diy_fp_normalize(*p);
+
+  if (lower_closer) {
+    m->f = (v->f << 2) - 1;
+    m->e = v->e - 2;
+  } else {
+    m->f = (v->f << 1) - 1;
+    m->e = v->e - 1;
+  }
+  m->f <<= m->e - p->e;
+  m->e = p->e;
+
+  *v = diy_fp_normalize(*v);
+}
+
+/* Return the cached power of ten c such that c * 2^e is in a useful range */
+static struct diy_fp cached_power(int e, int *k) {
+  /* 0.30102999566398114 is log10(2) */
+  double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int i = (int) dk;
+  if (dk - i > 0.0) i++;
+  i = (i >> 3) + 1;
+  *k = -(-348 + i * 8);
+  return cached_powers[i];
+}
+
+/*
+ * Move the last of the `len` digits at `buf` towards `w` while they stay
+ * within the unsafe interval. `rest` is the distance of the digits to the top
+ * of that interval, `too_high_w` the distance of `w` to it, and `unit` the
+ * error of both, all in the unit of `ten_kappa`, the weight of the last
+ * digit. Return 1 if the digits are then known to be the closest to `w`
+ * within the boundaries, or 0 if the errors make it uncertain.
+ */
+static int grisu_round_weed(char *buf, int len, uint64_t too_high_w,
+                            uint64_t unsafe, uint64_t rest, uint64_t ten_kappa,
+                            uint64_t unit) {
+  uint64_t small = too_high_w - unit, big = too_high_w + unit;
+
+  while (rest < small && unsafe - rest >= ten_kappa &&
+         (rest + ten_kappa < small ||
+          small - rest >= rest + ten_kappa - small)) {
+    buf[len - 1]--;
+    rest += ten_kappa;
+  }
+
+  /* Lower digits might still be closer to `w` */
+  if (rest < big && unsafe - rest >= ten_kappa &&
+      (rest + ten_kappa < big || big - rest > rest + ten_kappa - big)) {
+    return 0;
+  }
+
+  /* The digits must be within the boundaries, whatever the errors */
+  return 2 * unit <= rest && rest <= unsafe - 4 * unit;
+}
+
+/*
+ * Generate the shortest digits of `w` between its boundaries `low` and
+ * `high`, all with the same exponent. Return the number of digits, or -1 if
+ * they cannot be proven the shortest and closest.
+ */
+static int grisu_digits(struct diy_fp low, struct diy_fp w, struct diy_fp high,
+                        char *buf, int *k) {
+  int shift = -w.e, kappa = 0, len = 0;
+  uint64_t unit = 1, one = (uint64_t) 1 << shift;
+  /* The boundaries are off by up to one unit, widen them for safety */
+  uint64_t too_high = high.f + unit, unsafe = too_high - (low.f - unit);
+  uint32_t p1 = (uint32_t) (too_high >> shift);
+  uint64_t p2 = too_high & (one - 1);
+
+  while (kappa < 10 && p1 >= pow10_u64[kappa]) kappa++;
+
+  /* Integral part */
+  while (kappa > 0) {
+    uint32_t pow = (uint32_t) pow10_u64[kappa - 1];
+    uint64_t rest;
+    buf[len++] = (char) ('0' + p1 / pow);
+    p1 %= pow;
+    kappa--;
+    rest = ((uint64_t) p1 << shift) + p2;
+    if (rest < unsafe) {
+      *k += kappa;
+      return grisu_round_weed(buf, len, too_high - w.f, unsafe, rest,
+                              (uint64_t) pow << shift, unit)
+                 ? len
+                 : -1;
+    }
+  }
+
+  /* Fractional part */
+  for (;;) {
+    p2 *= 10;
+    unit *= 10;
+    unsafe *= 10;
+    buf[len++] = (char) ('0' + (p2 >> shift));
+    p2 &= one - 1;
+    kappa--;
+    if (p2 < unsafe) {
+      *k += kappa;
+      return grisu_round_weed(buf, len, (too_high - w.f) * unit, unsafe, p2,
+                              one, unit)
+                 ? len
+                 : -1;
+    }
+  }
+}
+
+/* Store `a`, which is not zero, as digits at `buf` times 10^k */
+static int decimal_digits(const struct decimal *a, char *buf, int *k) {
+  int i;
+  for (i = 0; i < a->nd; i++) buf[i] = (char) ('0' + a->d[i]);
+  *k = a->dp - a->nd;
+  return a->nd;
+}
+
+/* Compare `a` and `b`, which are not zero */
+static int decimal_cmp(const struct decimal *a, const struct decimal *b) {
+  int i;
+  if (a->dp != b->dp) return a->dp < b->dp ? -1 : 1;
+  for (i = 0; i < a->nd && i < b->nd; i++) {
+    if (a->d[i] != b->d[i]) return a->d[i] < b->d[i] ? -1 : 1;
+  }
+  return a->nd == b->nd ? 0 : a->nd < b->nd ? -1 : 1;
+}
+
+/* Set `dst` to the first `len` digits of `src`, plus one on the last if `up` */
+static void decimal_cut(struct decimal *dst, const struct decimal *src,
+                        int len, int up) {
+  int i = len - 1;
+  memcpy(dst->d, src->d, len);
+  dst->nd = len;
+  dst->dp = src->dp;
+  dst->trunc = 0;
+  if (up) {
+    for (; i >= 0 && dst->d[i] == 9; i--) dst->d[i] = 0;
+    if (i >= 0) {
+      dst->d[i]++;
+    } else {
+      /* 999 -> 1000 */
+      dst->d[0] = 1;
+      dst->nd = 1;
+      dst->dp++;
+    }
+  }
+  decimal_trim(dst);
+}
+
+/*
+ * Generate the shortest digits of f * 2^e that are between its boundaries,
+ * and the closest to it of those, with exact decimal arithmetic: it is
+ * rounded down and up to more and more digits until one of them is.
+ * Return the number of digits, stored at `buf` times 10^k.
+ */
+static int dtoa_exact(uint64_t f, int e, int lower_closer, char *buf, int *k) {
+  struct decimal v, lo, hi, down, up;
+  /* Boundaries read back as `v` if its significand is even */
+  int closed = (f & 1) == 0, len, in_down, in_up, r;
+
+  decimal_set(&v, f);
+  decimal_shift(&v, e);
+  decimal_set(&hi, 2 * f + 1);
+  decimal_shift(&hi, e - 1);
+  if (lower_closer) {
+    decimal_set(&lo, 4 * f - 1);
+    decimal_shift(&lo, e - 2);
+  } else {
+    decimal_set(&lo, 2 * f - 1);
+    decimal_shift(&lo, e - 1);
+  }
+
+  for (len = 1; len < v.nd; len++) {
+    decimal_cut(&down, &v, len, 0);
+    decimal_cut(&up, &v, len, 1);
+    r = decimal_cmp(&lo, &down);
+    in_down = r < 0 || (closed && r == 0);
+    r = decimal_cmp(&up, &hi);
+    in_up = r < 0 || (closed && r == 0);
+    if (in_down && in_up) {
+      /* The closest, or the even one if `v` is halfway */
+      if (v.d[len] != 5 || v.nd > len + 1) {
+        in_down = v.d[len] < 5;
+      } else {
+        in_down = (v.d[len - 1] & 1) == 0;
+      }
+      in_up = !in_down;
+    }
+    if (in_down) return decimal_digits(&down, buf, k);
+    if (in_up) return decimal_digits(&up, buf, k);
+  }
+  return decimal_digits(&v, buf, k);
+}
+
+/* Write the exponent `e` of the exponential notation, e.g. "e+21" */
+static int write_exponent(int e, char *buf) {
+  int n = 0;
+  buf[n++] = 'e';
+  buf[n++] = e < 0 ? '-' : '+';
+  if (e < 0) e = -e;
+  if (e >= 100) buf[n++] = (char) ('0' + e / 100), e %= 100;
+  if (e >= 10 || n > 2) buf[n++] = (char) ('0' + e / 10), e %= 10;
+  buf[n++] = (char) ('0' + e);
+  return n;
+}
+
+/*
+ * Lay out the `len` digits at `buf`, times 10^k, in decimal notation if the
+ * number is between 1e-6 and 1e21, otherwise in exponential notation.
+ * Return the new length.
+ */
+static int dtoa_layout(char *buf, int len, int k) {
+  int kk = len + k; /* 10^(kk - 1) <= v < 10^kk */
+
+  if (len <= kk && kk <= 21) {
+    /* 1234e7 -> 12340000000 */
+    memset(buf + len, '0', kk - len);
+    return kk;
+  } else if (0 < kk && kk <= 21) {
+    /* 1234e-2 -> 12.34 */
+    memmove(buf + kk + 1, buf + kk, len - kk);
+    buf[kk] = '.';
+    return len + 1;
+  } else if (-6 < kk && kk <= 0) {
+    /* 1234e-6 -> 0.001234 */
+    int offset = 2 - kk;
+    memmove(buf + offset, buf, len);
+    buf[0] = '0';
+    buf[1] = '.';
+    memset(buf + 2, '0', offset - 2);
+    return len + offset;
+  } else if (len == 1) {
+    /* 1e30 */
+    return 1 + write_exponent(kk - 1, buf + 1);
+  } else {
+    /* 1234e30 -> 1.234e33 */
+    memmove(buf + 2, buf + 1, len - 1);
+    buf[1] = '.';
+    return len + 1 + write_exponent(kk - 1, buf + len + 1);
+  }
+}
+
+/*
+ * Format positive f * 2^e into `buf`. `lower_closer` is set if the lower
+ * neighbour is closer than the upper one, which is the case for powers of two
+ * but the smallest normal one. Return the length of the output, which is not
+ * NUL-terminated.
+ */
+static int dtoa_format(uint64_t f, int e, int lower_closer, char *buf) {
+  struct diy_fp v, m, p, c, w, wp, wm;
+  int len, k;
+
+  v.f = f;
+  v.e = e;
+  diy_fp_boundaries(&v, lower_closer, &m, &p);
+  c = cached_power(p.e, &k);
+  w = diy_fp_mul(v, c);
+  wp = diy_fp_mul(p, c);
+  wm = diy_fp_mul(m, c);
+  if ((len = grisu_digits(wm, w, wp, buf, &k)) < 0) {
+    len = dtoa_exact(f, e, lower_closer, buf, &k);
+  }
+  return dtoa_layout(buf, len, k);
+}
+
+int json_dtoa(double d, char *buf) {
+  struct diy_fp v;
+  uint64_t bits;
+  int n = 0, biased_e;
+
+  memcpy(&bits, &d, sizeof(bits));
+  biased_e = (int) ((bits >> DOUBLE_SIGNIFICAND_SIZE) & 0x7ff);
+  if (biased_e == 0x7ff) {
+    /* There is no JSON for infinities and NaNs */
+    memcpy(buf, "null", 5);
+    return 4;
+  }
+  if (bits >> 63) buf[n++] = '-';
+  v.f = bits & DOUBLE_SIGNIFICAND_MASK;
+  if (biased_e == 0 && v.f == 0) {
+    buf[n++] = '0';
+    buf[n] = '\0';
+    return n;
+  }
+
+  if (biased_e != 0) {
+    v.f += DOUBLE_HIDDEN_BIT;
+    v.e = biased_e - DOUBLE_EXPONENT_BIAS;
+  } else {
+    /* Subnormal */
+    v.e = 1 - DOUBLE_EXPONENT_BIAS;
+  }
+  n += dtoa_format(v.f, v.e, v.f == DOUBLE_HIDDEN_BIT && biased_e > 1,
+                   buf + n);
+  buf[n] = '\0';
+  return n;
+}
+
+int json_ftoa(float f, char *buf) {
+  struct diy_fp v;
+  uint32_t bits;
+  int n = 0, biased_e;
+
+  memcpy(&bits, &f, sizeof(bits));
+  biased_e = (int) ((bits >> FLOAT_SIGNIFICAND_SIZE) & 0xff);
+  if (biased_e == 0xff) {
+    memcpy(buf, "null", 5);
+    return 4;
+  }
+  if (bits >> 31) buf[n++] = '-';
+  v.f = bits & FLOAT_SIGNIFICAND_MASK;
+  if (biased_e == 0 && v.f == 0) {
+    buf[n++] = '0';
+    buf[n] = '\0';
+    return n;
+  }
+
+  if (biased_e != 0) {
+    v.f += FLOAT_HIDDEN_BIT;
+    v.e = biased_e - FLOAT_EXPONENT_BIAS;
+  } else {
+    v.e = 1 - FLOAT_EXPONENT_BIAS;
+  }
+  n += dtoa_format(v.f, v.e, v.f == FLOAT_HIDDEN_BIT && biased_e > 1,
+                   buf + n);
+  buf[n] = '\0';
+  return n;
+}
@@ -18,31 +18,38 @@
 #include "elsa.h"
 #include <stddef.h>
 #include <string.h>
+#include "simd.h"
 #include "util.h"
 
 int json_escape(struct json_out *out, const char *p, size_t len) {
-  size_t i, cl, n = 0;
+  const char *end = p + len, *q;
   const char *hex_digits = "0123456789abcdef";
   const char *specials = "btnvfr";
+  size_t n = 0;
 
-  for (i = 0; i < len; i++) {
-    unsigned char ch = ((unsigned char *) p)[i];
+  while (p < end) {
+    char esc[6] = {'\\'};
+    unsigned char ch;
+    int esc_len = 2;
+
+    /* Print the run of characters that need no escaping at once */
+    q = skip_unescaped_chars(p, end);
+    if (q > p) n += out->printer(out, p, q - p);
+    if (q >= end) break;
+
+    ch = *(const unsigned char *) q;
     if (ch == '"' || ch == '\\') {
-      n += out->printer(out, "\\", 1);
-      n += out->printer(out, p + i, 1);
+      esc[1] = ch;
     } else if (ch >= '\b' && ch <= '\r') {
-      n += out->printer(out, "\\", 1);
-      n += out->printer(out, &specials[ch - '\b'], 1);
-    } else if (is_print(ch)) {
-      n += out->printer(out, p + i, 1);
-    } else if ((cl = get_utf8_char_len(ch)) == 1) {
-      n += out->printer(out, "\\u00", 4);
-      n += out->printer(out, &hex_digits[(ch >> 4) % 0xf], 1);
-      n += out->printer(out, &hex_digits[ch % 0xf], 1);
+      esc[1] = specials[ch - '\b'];
     } else {
-      n += out->printer(out, p + i, cl);
-      i += cl - 1;
+      memcpy(esc + 1, "u00", 3);
+      esc[4] = hex_digits[(ch >> 4) & 0xf];
+      esc[5] = hex_digits[ch & 0xf];
+      esc_len = 6;
     }
+    n += out->printer(out, esc, esc_len);
+    p = q + 1;
   }
 
   return n;
@@ -15,29 +15,160 @@
  * GNU General Public License for more details.
  */
 
+/* MAP_POPULATE and MADV_SEQUENTIAL are hidden by strict modes like -std=c99 */
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
 #include "elsa.h"
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-char *json_fread(const char *path) {
-  FILE *fp;
-  char *data = NULL;
-  if ((fp = fopen(path, "rb")) == NULL) {
-  } else if (fseek(fp, 0, SEEK_END) != 0) {
-    fclose(fp);                                            /* LCOV_EXCL_LINE */
-  } else {
-    size_t size = ftell(fp);
-    data = (char *) malloc(size + 1);
-    if (data != NULL) {
-      fseek(fp, 0, SEEK_SET); /* Some platforms might not have rewind(), Oo */
-      if (fread(data, 1, size, fp) != size) {
-        free(data);                                        /* LCOV_EXCL_LINE */
-        return NULL;                                       /* LCOV_EXCL_LINE */
+#if !defined(JSON_DISABLE_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define JSON_MMAP
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* How `struct json_file` holds the content */
+#define JSON_FILE_HEAP 0   /* malloc-ed */
+#define JSON_FILE_MAPPED 1 /* mmap-ed */
+
+#ifdef JSON_MMAP
+typedef int file_handle_t;
+
+/* Read up to `n` bytes into `buf`. Return their number, 0 at EOF, or -1 */
+static long file_read(file_handle_t h, char *buf, size_t n) {
+  ssize_t r;
+  while ((r = read(h, buf, n)) < 0 && errno == EINTR) {
+  }
+  return (long) r;
+}
+#else
+typedef FILE *file_handle_t;
+
+static long file_read(file_handle_t h, char *buf, size_t n) {
+  size_t r = fread(buf, 1, n, h);
+  return r == 0 && ferror(h) ? -1 : (long) r;
+}
+#endif
+
+/*
+ * Read `h` to the end into a malloc-ed, NUL-terminated buffer. `size` is the
+ * size of the file if known: it is only a hint, as pipes and some special
+ * files have none, and the buffer doubles whenever it is full. Return the
+ * buffer and store the length in `len`, or return NULL on error.
+ */
+static char *file_read_all(file_handle_t h, size_t size, size_t *len) {
+  char *data, *p;
+  size_t n = 0;
+  long r;
+
+  /* Room for the NUL, and to see the end of the file without growing */
+  size = (size < JSON_FILE_BUF_SIZE ? JSON_FILE_BUF_SIZE : size) + 2;
+  if ((data = (char *) malloc(size)) == NULL) return NULL;
+  while ((r = file_read(h, data + n, size - n - 1)) > 0) {
+    n += r;
+    if (n + 1 == size) {
+      if ((p = (char *) realloc(data, size * 2)) == NULL) {
+        r = -1;
+        break;
       }
-      data[size] = '\0';
+      data = p;
+      size *= 2;
     }
-    fclose(fp);
   }
+  if (r < 0) {
+    free(data);
+    return NULL;
+  }
+
+  data[n] = '\0';
+  *len = n;
   return data;
 }
+
+char *json_fread(const char *path) {
+  size_t len;
+  char *data = NULL;
+#ifdef JSON_MMAP
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+  data = file_read_all(fd, fstat(fd, &st) == 0 ? (size_t) st.st_size : 0,
+                      &len);
+  close(fd);
+#else
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) return NULL;
+  data = file_read_all(fp, 0, &len);
+  fclose(fp);
+#endif
+  return data;
+}
+
+int json_map_file(struct json_file *f, const char *path, int flags) {
+#ifdef JSON_MMAP
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+
+  f->data = NULL;
+  f->len = 0;
+  f->kind = JSON_FILE_HEAP;
+  if (fd < 0) return -1;
+
+  /* Pipes, and files like those of /proc that claim to be empty, are read */
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    int mflags = MAP_PRIVATE;
+    void *p;
+#ifdef MAP_POPULATE
+    if (flags & JSON_MAP_POPULATE) mflags |= MAP_POPULATE;
+#else
+    (void) flags;
+#endif
+    p = mmap(NULL, (size_t) st.st_size, PROT_READ, mflags, fd, 0);
+    if (p != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+      madvise(p, (size_t) st.st_size, MADV_SEQUENTIAL);
+#endif
+      close(fd);
+      f->data = (const char *) p;
+      f->len = (size_t) st.st_size;
+      f->kind = JSON_FILE_MAPPED;
+      return 0;
+    }
+  }
+
+  f->data = file_read_all(fd, 0, &f->len);
+  close(fd);
+#else
+  FILE *fp = fopen(path, "rb");
+
+  (void) flags;
+  f->data = NULL;
+  f->len = 0;
+  f->kind = JSON_FILE_HEAP;
+  if (fp == NULL) return -1;
+  f->data = file_read_all(fp, 0, &f->len);
+  fclose(fp);
+#endif
+  return f->data == NULL ? -1 : 0;
+}
+
+void json_unmap_file(struct json_file *f) {
+#ifdef JSON_MMAP
+  if (f->kind == JSON_FILE_MAPPED) {
+    munmap((void *) f->data, f->len);
+  } else
+#endif
+  {
+    free((void *) f->data);
+  }
+  f->data = NULL;
+  f->len = 0;
+  f->kind = JSON_FILE_HEAP;
+}
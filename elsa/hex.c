@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2004-2013 Sergey Lyubka <valenok@gmail.com>
+ * Copyright (c) 2013 Cesanta Software Limited
+ * Copyright (c) 2020 Julian Smythe <sausage@tehsausage.com>
+ * All rights reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "elsa.h"
+#include <stdint.h>
+#include <string.h>
+#include "simd.h"
+
+static const char hex_chars[] = "0123456789abcdef";
+
+/* Values of the hex digits, 0xff for other characters */
+static const unsigned char hex_values[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff
+};
+
+#if defined(JSON_SIMD_AVX2) || defined(JSON_SIMD_SSE2)
+/* Hex digits of the 16 nibbles of `v` */
+static __m128i hex_digits16(__m128i v) {
+  /* '0' + v, and 'a' - 10 + v for values above 9 */
+  __m128i above9 = _mm_cmpgt_epi8(v, _mm_set1_epi8(9));
+  return _mm_add_epi8(_mm_add_epi8(v, _mm_set1_epi8('0')),
+                      _mm_and_si128(above9, _mm_set1_epi8('a' - 10 - '0')));
+}
+
+/* Encode the 16 bytes at `src` into 32 hex digits at `dst` */
+static void hex_encode_block(const unsigned char *src, char *dst) {
+  __m128i v = _mm_loadu_si128((const __m128i *) src);
+  __m128i mask = _mm_set1_epi8(0x0f);
+  __m128i hi = hex_digits16(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+  __m128i lo = hex_digits16(_mm_and_si128(v, mask));
+  _mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi8(hi, lo));
+  _mm_storeu_si128((__m128i *) (dst + 16), _mm_unpackhi_epi8(hi, lo));
+}
+
+/*
+ * Return the values of the 16 hex digits at `src`, each pair of digits
+ * packed in the low byte of a 16-bit lane. Set `*valid` to 0 if a character
+ * is not a hex digit.
+ */
+static __m128i hex_values16(const char *src, int *valid) {
+  __m128i c = _mm_loadu_si128((const __m128i *) src);
+  /* Unsigned x <= max, as min(x, max) == x */
+  __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+  __m128i is_d = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+  __m128i l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)),
+                           _mm_set1_epi8('a'));
+  __m128i is_l = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+  __m128i v = _mm_or_si128(
+      _mm_and_si128(is_d, d),
+      _mm_andnot_si128(is_d, _mm_add_epi8(l, _mm_set1_epi8(10))));
+  if (_mm_movemask_epi8(_mm_or_si128(is_d, is_l)) != 0xffff) *valid = 0;
+  /* The first digit of a pair is the low byte of the lane */
+  return _mm_or_si128(
+      _mm_and_si128(_mm_slli_epi16(v, 4), _mm_set1_epi16(0xf0)),
+      _mm_srli_epi16(v, 8));
+}
+#endif
+
+int json_hex_encode(const unsigned char *src, int len, char *dst) {
+  const unsigned char *end = src + len;
+  char *p = dst;
+
+#if defined(JSON_SIMD_AVX2) || defined(JSON_SIMD_SSE2)
+  for (; end - src >= 16; src += 16, p += 32) hex_encode_block(src, p);
+#endif
+  for (; src < end; src++, p += 2) {
+    p[0] = hex_chars[*src >> 4];
+    p[1] = hex_chars[*src & 0xf];
+  }
+
+  return p - dst;
+}
+
+int json_hex_decode(const char *src, int len, unsigned char *dst) {
+  const unsigned char *s = (const unsigned char *) src, *end = s + len;
+  unsigned char *p = dst;
+
+  if (len % 2 != 0) return JSON_STRING_INVALID;
+
+#if defined(JSON_SIMD_AVX2) || defined(JSON_SIMD_SSE2)
+  for (; end - s >= 32; s += 32, p += 16) {
+    int valid = 1;
+    __m128i a = hex_values16((const char *) s, &valid);
+    __m128i b = hex_values16((const char *) s + 16, &valid);
+    if (!valid) return JSON_STRING_INVALID;
+    _mm_storeu_si128((__m128i *) p, _mm_packus_epi16(a, b));
+  }
+#endif
+  for (; s < end; s += 2) {
+    unsigned a = hex_values[s[0]], b = hex_values[s[1]];
+    if ((a | b) & 0x80) return JSON_STRING_INVALID;
+    *p++ = (unsigned char) (a << 4 | b);
+  }
+
+  return p - dst;
+}
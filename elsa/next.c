@@ -19,68 +19,181 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include "simd.h"
+#include "util.h"
 
-struct next_data {
-  void *handle;            /* Passed handle. Changed if a next entry is found */
-  const char *path;        /* Path to the iterated object/array */
-  int path_len;            /* Path length - optimisation */
-  int found;               /* Non-0 if found the next entry */
-  struct json_token *key;  /* Object's key */
-  struct json_token *val;  /* Object's value */
-  int *idx;                /* Array index */
-};
-
-static void next_set_key(struct next_data *d, const char *name, int name_len,
-                         int is_array) {
-  if (is_array) {
-    /* Array. Set index and reset key  */
-    if (d->key != NULL) {
-      d->key->len = 0;
-      d->key->ptr = NULL;
-    }
-    if (d->idx != NULL) *d->idx = atoi(name);
+/*
+ * Scan the value at `p`, filling `tok` the same way json_walk() does for the
+ * value, and for objects and arrays, for their END event. Objects and arrays
+ * are skipped by matching brackets, without descending into them.
+ * Return the number of bytes scanned, or a negative error code.
+ */
+static int iter_value(const char *p, const char *end, struct json_token *tok) {
+  int n;
+  switch (p < end ? *p : '\0') {
+    case '{':
+    case '[':
+      n = skip_container(p, end);
+      tok->type = *p == '{' ? JSON_TYPE_OBJECT_END : JSON_TYPE_ARRAY_END;
+      tok->ptr = p;
+      tok->len = n;
+      return n;
+    default:
+      /* Scalars are short; let the parser validate them */
+      n = json_walk(p, end - p, NULL, NULL);
+      if (n < 0) return n;
+      tok->ptr = p;
+      tok->len = n;
+      switch (*p) {
+        case '"':
+          tok->type = JSON_TYPE_STRING;
+          tok->ptr++;
+          tok->len -= 2;
+          break;
+        case 't':
+          tok->type = JSON_TYPE_TRUE;
+          break;
+        case 'f':
+          tok->type = JSON_TYPE_FALSE;
+          break;
+        case 'n':
+          tok->type = JSON_TYPE_NULL;
+          break;
+        default:
+          tok->type = JSON_TYPE_NUMBER;
+          break;
+      }
+      return n;
+  }
+}
+
+/* key = identifier | string */
+static int iter_key(const char *p, const char *end, struct json_token *tok) {
+  const char *q = p;
+  if (p < end && is_alpha(*p)) {
+    while (q < end && (*q == '_' || is_alpha(*q) || is_digit(*q))) q++;
+    tok->type = JSON_TYPE_STRING;
+    tok->ptr = p;
+    tok->len = q - p;
+    return q - p;
+  } else if (p < end && *p == '"') {
+    return iter_value(p, end, tok);
+  }
+  return p < end ? JSON_STRING_INVALID : JSON_STRING_INCOMPLETE;
+}
+
+/*
+ * Fetch the key of the next entry, and leave `it->cur` at its value.
+ * Return 1 if there is an entry, 0 when done, or a negative error code.
+ */
+static int iter_entry(struct json_iter *it, struct json_token *key) {
+  const char *p = skip_spaces(it->cur, it->end);
+  int n;
+
+  if (p >= it->end) return JSON_STRING_INCOMPLETE;
+  if (*p == (it->is_array ? ']' : '}')) {
+    it->cur = p;
+    return 0;
+  }
+
+  if (it->is_array) {
+    key->type = JSON_TYPE_INVALID;
+    key->ptr = NULL;
+    key->len = 0;
   } else {
-    /* Object. Set key and make index -1 */
-    if (d->key != NULL) {
-      d->key->ptr = name;
-      d->key->len = name_len;
-    }
-    if (d->idx != NULL) *d->idx = -1;
+    if ((n = iter_key(p, it->end, key)) < 0) return n;
+    p = skip_spaces(p + n, it->end);
+    if (p >= it->end) return JSON_STRING_INCOMPLETE;
+    if (*p != ':') return JSON_STRING_INVALID;
+    p = skip_spaces(p + 1, it->end);
   }
+
+  it->cur = p;
+  it->idx++;
+  return 1;
 }
 
-static void next_cb(void *userdata, const char *name, size_t name_len,
-                    const char *path, const struct json_token *t) {
-  struct next_data *d = (struct next_data *) userdata;
-  const char *p = path + d->path_len;
-  if (d->found) return;
-  if (d->path_len >= (int) strlen(path)) return;
-  if (strncmp(d->path, path, d->path_len) != 0) return;
-  if (strchr(p + 1, '.') != NULL) return; /* More nested objects - skip */
-  if (strchr(p + 1, '[') != NULL) return; /* Ditto for arrays */
-  /* {OBJECT,ARRAY}_END types do not pass name, _START does. Save key. */
-  if (t->type == JSON_TYPE_OBJECT_START || t->type == JSON_TYPE_ARRAY_START) {
-    next_set_key(d, name, name_len, p[0] == '[');
-  } else if (d->handle == NULL || d->handle < (void *) t->ptr) {
-    if (t->type != JSON_TYPE_OBJECT_END && t->type != JSON_TYPE_ARRAY_END) {
-      next_set_key(d, name, name_len, p[0] == '[');
+/* Scan the value at `it->cur` and move past it */
+static int iter_skip_value(struct json_iter *it, struct json_token *val) {
+  const char *p;
+  int n = iter_value(it->cur, it->end, val);
+  if (n < 0) return n;
+  p = skip_spaces(it->cur + n, it->end);
+  if (p < it->end && *p == ',') p++;
+  it->cur = p;
+  return 0;
+}
+
+int json_iter_next(struct json_iter *it, struct json_token *key,
+                   struct json_token *val) {
+  struct json_token tmpkey, tmpval;
+  int n;
+  if ((n = iter_entry(it, key == NULL ? &tmpkey : key)) <= 0) return n;
+  if ((n = iter_skip_value(it, val == NULL ? &tmpval : val)) < 0) return n;
+  return 1;
+}
+
+/* Position `it` at the first entry of the object or array at `p` */
+static int iter_enter(struct json_iter *it, const char *p) {
+  p = skip_spaces(p, it->end);
+  if (p >= it->end) return JSON_STRING_INCOMPLETE;
+  if (*p != '{' && *p != '[') return JSON_STRING_INVALID;
+  it->is_array = *p == '[';
+  it->cur = p + 1;
+  it->idx = 0;
+  return 0;
+}
+
+int json_iter_init(struct json_iter *it, const char *s, int len,
+                   const char *path) {
+  struct json_token key, val;
+  int n;
+
+  it->end = s + len;
+  if ((n = iter_enter(it, s)) < 0) return n;
+
+  /* Descend into the object or array at `path`, one segment at a time */
+  while (*path != '\0') {
+    int idx, seg_len = parse_path_segment(path, &idx);
+    /* Keys select entries of objects, and indices entries of arrays */
+    if (seg_len < 0 || (*path == '[') != it->is_array ||
+        (it->is_array && idx < 0)) {
+      return JSON_STRING_INVALID;
     }
-    if (d->val != NULL) *d->val = *t;
-    d->handle = (void *) t->ptr;
-    d->found = 1;
+    while ((n = iter_entry(it, &key)) > 0) {
+      if (it->is_array ? it->idx - 1 == idx
+                       : key.len == seg_len - 1 &&
+                             memcmp(key.ptr, path + 1, seg_len - 1) == 0) {
+        break;
+      }
+      if ((n = iter_skip_value(it, &val)) < 0) return n;
+    }
+    if (n <= 0) return n < 0 ? n : JSON_STRING_INVALID;
+    if ((n = iter_enter(it, it->cur)) < 0) return n;
+    path += seg_len;
   }
+
+  return 0;
 }
 
 static void *json_next(const char *s, int len, void *handle, const char *path,
                        struct json_token *key, struct json_token *val, int *i) {
-  struct json_token tmpval, *v = val == NULL ? &tmpval : val;
+  struct json_iter it;
   struct json_token tmpkey, *k = key == NULL ? &tmpkey : key;
-  int tmpidx, *pidx = i == NULL ? &tmpidx : i;
-  struct next_data data = {handle, path, strlen(path), 0, k, v, pidx};
-  json_walk(s, len, next_cb, &data);
-  return data.found ? data.handle : NULL;
-}
+  struct json_token tmpval, *v = val == NULL ? &tmpval : val;
+
+  /*
+   * The handle is the pointer to the previous value. There is nowhere to
+   * keep the iterator between calls, so skip to the entry that follows it.
+   */
+  if (json_iter_init(&it, s, len, path) != 0) return NULL;
+  do {
+    if (json_iter_next(&it, k, v) <= 0) return NULL;
+  } while (handle != NULL && (void *) v->ptr <= handle);
 
+  if (i != NULL) *i = it.is_array ? it.idx - 1 : -1;
+  return (void *) v->ptr;
+}
 void *json_next_key(const char *s, int len, void *handle, const char *path,
                     struct json_token *key, struct json_token *val) {
   return json_next(s, len, handle, path, key, val, NULL);
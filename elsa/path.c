@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2004-2013 Sergey Lyubka <valenok@gmail.com>
+ * Copyright (c) 2013 Cesanta Software Limited
+ * Copyright (c) 2020 Julian Smythe <sausage@tehsausage.com>
+ * All rights reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "elsa.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+
+/* Make the segment at offset `off` the one that entries must match */
+static void path_set_seg(struct json_path *p, int off) {
+  p->seg = off;
+  p->seg_len = parse_path_segment(p->path + off, &p->index);
+}
+
+int json_path_compile(struct json_path *p, const char *path) {
+  const char *s = path;
+  int n, index;
+
+  while ((n = parse_path_segment(s, &index)) > 0) s += n;
+  if (n < 0) return JSON_STRING_INVALID;
+
+  memset(p, 0, sizeof(*p));
+  p->path = path;
+  path_set_seg(p, 0);
+  return 0;
+}
+
+int json_path_match(struct json_path *p, const char *name, size_t name_len,
+                    const struct json_token *token) {
+  int depth = p->level, on = 0, next, ch;
+
+  if (token->type == JSON_TYPE_OBJECT_END ||
+      token->type == JSON_TYPE_ARRAY_END) {
+    int result;
+    if (p->level == 0) return JSON_PATH_NO_MATCH;
+    p->level--;
+    if (p->matched <= p->level) return JSON_PATH_NO_MATCH;
+
+    /* Leaving an object or array on the path: step back one segment */
+    result = p->path[p->seg] == '\0' ? JSON_PATH_MATCH : JSON_PATH_PREFIX;
+    p->matched = p->level;
+    if (p->level > 0) {
+      int i = p->seg - 1;
+      while (i > 0 && p->path[i] != '.' && p->path[i] != '[') i--;
+      path_set_seg(p, i);
+      /* Array entries that follow the matched one cannot match */
+      p->count = p->index + 1;
+    }
+    return result;
+  }
+
+  /* Only entries of the innermost object or array on the path can match */
+  if (p->matched == depth) {
+    const char *seg = p->path + p->seg;
+    if (depth == 0) {
+      on = 1;
+    } else if (seg[0] == '[') {
+      on = p->count++ == p->index;
+    } else if (seg[0] == '.') {
+      on = name != NULL && (int) name_len == p->seg_len - 1 &&
+           memcmp(name, seg + 1, name_len) == 0;
+    }
+  }
+
+  /* Offset of the segment that follows the one matched by this value */
+  next = depth == 0 ? p->seg : p->seg + p->seg_len;
+
+  if (token->type == JSON_TYPE_OBJECT_START ||
+      token->type == JSON_TYPE_ARRAY_START) {
+    p->level++;
+    if (!on) return JSON_PATH_NO_MATCH;
+    /* Only descend if the next segment can match an entry */
+    ch = p->path[next];
+    if (ch == '.' ? token->type != JSON_TYPE_OBJECT_START
+                  : ch == '[' ? token->type != JSON_TYPE_ARRAY_START : 0) {
+      return JSON_PATH_NO_MATCH;
+    }
+    p->matched = p->level;
+    if (depth > 0) path_set_seg(p, next);
+    p->count = 0;
+  }
+
+  if (!on) return JSON_PATH_NO_MATCH;
+  return p->path[next] == '\0' ? JSON_PATH_MATCH : JSON_PATH_PREFIX;
+}
+
+void json_path_skip(struct json_path *p) {
+  struct json_token end = {NULL, 0, JSON_TYPE_OBJECT_END};
+  json_path_match(p, NULL, 0, &end);
+}
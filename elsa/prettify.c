@@ -31,16 +31,17 @@ static void indent(struct json_out *out, int level) {
   while (level-- > 0) out->printer(out, "  ", 2);
 }
 
-static void print_key(struct prettify_data *pd, const char *path,
-                      const char *name, int name_len) {
+static void print_key(struct prettify_data *pd, const char *name,
+                      int name_len) {
   if (pd->last_token != JSON_TYPE_INVALID &&
       pd->last_token != JSON_TYPE_ARRAY_START &&
       pd->last_token != JSON_TYPE_OBJECT_START) {
     pd->out->printer(pd->out, ",", 1);
   }
-  if (path[0] != '\0') pd->out->printer(pd->out, "\n", 1);
+  if (pd->level > 0) pd->out->printer(pd->out, "\n", 1);
   indent(pd->out, pd->level);
-  if (path[0] != '\0' && path[strlen(path) - 1] != ']') {
+  /* Array elements have no name */
+  if (pd->level > 0 && name != NULL) {
     pd->out->printer(pd->out, "\"", 1);
     pd->out->printer(pd->out, name, (int) name_len);
     pd->out->printer(pd->out, "\"", 1);
@@ -48,13 +49,14 @@ static void print_key(struct prettify_data *pd, const char *path,
   }
 }
 
-static void prettify_cb(void *userdata, const char *name, size_t name_len,
-                        const char *path, const struct json_token *t) {
+static int prettify_cb(void *userdata, const char *name, size_t name_len,
+                       const char *path, const struct json_token *t) {
   struct prettify_data *pd = (struct prettify_data *) userdata;
+  (void) path;
   switch (t->type) {
     case JSON_TYPE_OBJECT_START:
     case JSON_TYPE_ARRAY_START:
-      print_key(pd, path, name, name_len);
+      print_key(pd, name, name_len);
       pd->out->printer(pd->out, t->type == JSON_TYPE_ARRAY_START ? "[" : "{",
                        1);
       pd->level++;
@@ -75,7 +77,7 @@ static void prettify_cb(void *userdata, const char *name, size_t name_len,
     case JSON_TYPE_TRUE:
     case JSON_TYPE_FALSE:
     case JSON_TYPE_STRING:
-      print_key(pd, path, name, name_len);
+      print_key(pd, name, name_len);
       if (t->type == JSON_TYPE_STRING) pd->out->printer(pd->out, "\"", 1);
       pd->out->printer(pd->out, t->ptr, t->len);
       if (t->type == JSON_TYPE_STRING) pd->out->printer(pd->out, "\"", 1);
@@ -84,11 +86,12 @@ static void prettify_cb(void *userdata, const char *name, size_t name_len,
       break;                                               /* LCOV_EXCL_LINE */
   }
   pd->last_token = t->type;
+  return JSON_WALK_CONTINUE;
 }
 
 int json_prettify(const char *s, int len, struct json_out *out) {
   struct prettify_data pd = {out, 0, JSON_TYPE_INVALID};
-  return json_walk(s, len, prettify_cb, &pd);
+  return json_walk_ex(s, len, prettify_cb, &pd, JSON_WALK_NO_PATH);
 }
 
 int json_prettify_file(const char *file_name) {
@@ -97,7 +100,11 @@ int json_prettify_file(const char *file_name) {
   FILE *fp;
   if (s != NULL && (fp = fopen(file_name, "w")) != NULL) {
     struct json_out out = JSON_OUT_FILE(fp);
-    res = json_prettify(s, strlen(s), &out);
+    struct json_out_buffered b;
+    char buf[JSON_FILE_BUF_SIZE];
+    json_out_buffered_init(&b, &out, buf, sizeof(buf));
+    res = json_prettify(s, strlen(s), &b.out);
+    json_out_flush(&b);
     if (res < 0) {
       /* On error, restore the old content */
       fclose(fp);
@@ -18,8 +18,12 @@
 #include "elsa.h"
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+/* Initial size of the buffer of JSON_OUT_DYNBUF */
+#define JSON_DYNBUF_MIN_SIZE 256
+
 int json_printer_buf(struct json_out *out, const char *buf, size_t len) {
   size_t avail = out->u.buf.size - out->u.buf.len;
   size_t n = len < avail ? len : avail;
@@ -36,3 +40,65 @@ int json_printer_buf(struct json_out *out, const char *buf, size_t len) {
 int json_printer_file(struct json_out *out, const char *buf, size_t len) {
   return fwrite(buf, 1, len, out->u.fp);
 }
+
+int json_printer_dynbuf(struct json_out *out, const char *buf, size_t len) {
+  size_t need = out->u.buf.len + len + 1, size = out->u.buf.size;
+  if (need > size) {
+    char *p;
+    if (size == 0) size = JSON_DYNBUF_MIN_SIZE;
+    while (size < need) size *= 2;
+    p = (char *) (out->u.buf.realloc_fn != NULL
+                      ? out->u.buf.realloc_fn(out->u.buf.buf, size)
+                      : realloc(out->u.buf.buf, size));
+    if (p != NULL) {
+      out->u.buf.buf = p;
+      out->u.buf.size = size;
+    }
+  }
+  /* If the buffer could not grow, truncate */
+  return json_printer_buf(out, buf, len);
+}
+
+void json_out_dynbuf_reset(struct json_out *out) {
+  out->u.buf.len = 0;
+  if (out->u.buf.size > 0) out->u.buf.buf[0] = '\0';
+}
+
+void json_out_dynbuf_free(struct json_out *out) {
+  if (out->u.buf.realloc_fn != NULL) {
+    if (out->u.buf.buf != NULL) out->u.buf.realloc_fn(out->u.buf.buf, 0);
+  } else {
+    free(out->u.buf.buf);
+  }
+  out->u.buf.buf = NULL;
+  out->u.buf.size = out->u.buf.len = 0;
+}
+
+int json_printer_buffered(struct json_out *out, const char *buf, size_t len) {
+  struct json_out_buffered *b = (struct json_out_buffered *) out;
+  if (len > b->size - b->len) json_out_flush(b);
+  if (len >= b->size) {
+    b->dest->printer(b->dest, buf, len);
+  } else {
+    memcpy(b->buf + b->len, buf, len);
+    b->len += len;
+  }
+  return len;
+}
+
+void json_out_buffered_init(struct json_out_buffered *b,
+                            struct json_out *dest, char *buf, size_t size) {
+  memset(&b->out, 0, sizeof(b->out));
+  b->out.printer = json_printer_buffered;
+  b->dest = dest;
+  b->buf = buf;
+  b->size = size;
+  b->len = 0;
+}
+
+int json_out_flush(struct json_out_buffered *b) {
+  int n = 0;
+  if (b->len > 0) n = b->dest->printer(b->dest, b->buf, b->len);
+  b->len = 0;
+  return n;
+}
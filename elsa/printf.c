@@ -17,6 +17,7 @@
 
 #include "elsa.h"
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -25,279 +26,390 @@
 #include <wctype.h>
 #include "util.h"
 
-static int b64idx(int c) {
-  if (c < 26) {
-    return c + 'A';
-  } else if (c < 52) {
-    return c - 26 + 'a';
-  } else if (c < 62) {
-    return c - 52 + '0';
-  } else {
-    return c == 62 ? '+' : '/';
+/* Print `n` bytes at `p` base64-encoded, one block of output at a time */
+static int b64enc(struct json_out *out, const unsigned char *p, int n) {
+  char buf[1024];
+  int i, len = 0, chunk = sizeof(buf) / 4 * 3;
+  for (i = 0; i < n; i += chunk) {
+    int m = json_base64_encode(p + i, n - i < chunk ? n - i : chunk, buf);
+    len += out->printer(out, buf, m);
   }
+  return len;
 }
 
-static int b64enc(struct json_out *out, const unsigned char *p, int n) {
-  char buf[4];
-  int i, len = 0;
-  for (i = 0; i < n; i += 3) {
-    int a = p[i], b = i + 1 < n ? p[i + 1] : 0, c = i + 2 < n ? p[i + 2] : 0;
-    buf[0] = b64idx(a >> 2);
-    buf[1] = b64idx((a & 3) << 4 | (b >> 4));
-    buf[2] = b64idx((b & 15) << 2 | (c >> 6));
-    buf[3] = b64idx(c & 63);
-    if (i + 1 >= n) buf[2] = '=';
-    if (i + 2 >= n) buf[3] = '=';
-    len += out->printer(out, buf, sizeof(buf));
+/* Print `n` bytes at `p` hex-encoded, one block of output at a time */
+static int hexenc(struct json_out *out, const unsigned char *p, int n) {
+  char buf[1024];
+  int i, len = 0, chunk = sizeof(buf) / 2;
+  for (i = 0; i < n; i += chunk) {
+    int m = json_hex_encode(p + i, n - i < chunk ? n - i : chunk, buf);
+    len += out->printer(out, buf, m);
   }
   return len;
 }
 
-int json_vprintf(struct json_out *out, const char *fmt, va_list xap) {
-  int len = 0;
+/* Types of the conversions that are not delegated to the system printf */
+#define PRINTF_QUOTED_LEN 1 /* %.*Q */
+
+/* A conversion delegated to the system printf */
+struct printf_spec {
+  int len;      /* Length of the conversion in the format string */
+  int dyn_args; /* Number of `*` width and precision arguments */
+  char len_mod; /* Length modifier, '1' for hh and '8' for ll */
+  char type;    /* Conversion specifier */
+  char native;  /* Integer without flags, width or precision: use json_itoa */
+};
+
+/* Print the value of the Elsa conversion `type`, consuming its arguments */
+static int printf_special(struct json_out *out, int type, va_list *ap) {
   const char *quote = "\"", *null = "null";
-  va_list ap;
-  va_copy(ap, xap);
+  int len = 0;
 
-  while (*fmt != '\0') {
-    if (strchr(":, \r\n\t[]{}\"", *fmt) != NULL) {
-      len += out->printer(out, fmt, 1);
-      fmt++;
-    } else if (fmt[0] == '%') {
-      char buf[101];
-      size_t skip = 2;
-
-      if (fmt[1] == 'M') {
-        json_printf_callback_t f = va_arg(ap, json_printf_callback_t);
-        len += f(out, &ap);
-      } else if (fmt[1] == 'B') {
-        int val = va_arg(ap, int);
-        const char *str = val ? "true" : "false";
-        len += out->printer(out, str, strlen(str));
-      } else if (fmt[1] == 'H') {
-        const char *hex = "0123456789abcdef";
-        int i, n = va_arg(ap, int);
-        const unsigned char *p = va_arg(ap, const unsigned char *);
-        len += out->printer(out, quote, 1);
-        for (i = 0; i < n; i++) {
-          len += out->printer(out, &hex[(p[i] >> 4) & 0xf], 1);
-          len += out->printer(out, &hex[p[i] & 0xf], 1);
-        }
-        len += out->printer(out, quote, 1);
-      } else if (fmt[1] == 'V') {
-        const unsigned char *p = va_arg(ap, const unsigned char *);
-        int n = va_arg(ap, int);
+  switch (type) {
+    case 'M': {
+      json_printf_callback_t f = va_arg(*ap, json_printf_callback_t);
+      len += f(out, ap);
+      break;
+    }
+    case 'B': {
+      int val = va_arg(*ap, int);
+      const char *str = val ? "true" : "false";
+      len += out->printer(out, str, strlen(str));
+      break;
+    }
+    case 'H': {
+      int n = va_arg(*ap, int);
+      const unsigned char *p = va_arg(*ap, const unsigned char *);
+      len += out->printer(out, quote, 1);
+      len += hexenc(out, p, n);
+      len += out->printer(out, quote, 1);
+      break;
+    }
+    case 'D': {
+      char buf[JSON_NUMBER_BUF_SIZE];
+      int n = json_dtoa(va_arg(*ap, double), buf);
+      len += out->printer(out, buf, n);
+      break;
+    }
+    case 'V': {
+      const unsigned char *p = va_arg(*ap, const unsigned char *);
+      int n = va_arg(*ap, int);
+      len += out->printer(out, quote, 1);
+      len += b64enc(out, p, n);
+      len += out->printer(out, quote, 1);
+      break;
+    }
+    default: {
+      size_t l = 0;
+      const char *p;
+
+      if (type == PRINTF_QUOTED_LEN) l = (size_t) va_arg(*ap, int);
+      p = va_arg(*ap, char *);
+
+      if (p == NULL) {
+        len += out->printer(out, null, 4);
+      } else {
+        if (type == 'Q') l = strlen(p);
         len += out->printer(out, quote, 1);
-        len += b64enc(out, p, n);
+        len += json_escape(out, p, l);
         len += out->printer(out, quote, 1);
-      } else if (fmt[1] == 'Q' ||
-                 (fmt[1] == '.' && fmt[2] == '*' && fmt[3] == 'Q')) {
-        size_t l = 0;
-        const char *p;
-
-        if (fmt[1] == '.') {
-          l = (size_t) va_arg(ap, int);
-          skip += 2;
-        }
-        p = va_arg(ap, char *);
+      }
+      break;
+    }
+  }
 
-        if (p == NULL) {
-          len += out->printer(out, null, 4);
-        } else {
-          if (fmt[1] == 'Q') {
-            l = strlen(p);
-          }
-          len += out->printer(out, quote, 1);
-          len += json_escape(out, p, l);
-          len += out->printer(out, quote, 1);
-        }
-      } else {
-        /*
-         * we delegate printing to the system printf.
-         * The goal here is to delegate all modifiers parsing to the system
-         * printf, as you can see below we still have to parse the format
-         * types.
-         */
-
-        size_t n = 1;
-        char *pbuf = buf;
-        size_t need_len;
-        char fmt2[30];
-        va_list sub_ap;
+  return len;
+}
 
-        int dyn_args = 0;
-        char len_mod = '\0';
-        char prn_spec;
+/*
+ * Return the type of the Elsa conversion at `fmt`, or 0 if it is delegated to
+ * the system printf. Store the length of the conversion in `n`.
+ */
+static int printf_special_type(const char *fmt, int *n) {
+  *n = 2;
+  switch (fmt[1]) {
+    case 'M':
+    case 'B':
+    case 'D':
+    case 'H':
+    case 'V':
+    case 'Q':
+      return fmt[1];
+    case '.':
+      if (fmt[2] == '*' && fmt[3] == 'Q') {
+        *n = 4;
+        return PRINTF_QUOTED_LEN;
+      }
+      break;
+  }
+  return 0;
+}
 
-        /* flags (-, +, #, 0, or space) */
-        while (strchr("-+#0 ", fmt[n]) != NULL) {
-          ++n;
-        }
+/*
+ * Parse the printf conversion at `fmt`. The goal here is to delegate all
+ * modifiers parsing to the system printf, but we still have to parse the
+ * format types to know which arguments to consume.
+ */
+static void printf_parse_spec(const char *fmt, struct printf_spec *spec) {
+  int n = 1, plain;
 
-        /* width (* or number) */
-        if (fmt[n] == '*') {
-          ++dyn_args;
-          ++n;
-        } else {
-          while (is_digit(fmt[n]))
-            ++n;
-        }
+  spec->dyn_args = 0;
+  spec->len_mod = '\0';
 
-        /* precision (.* or .number) */
-        if (fmt[n] == '.') {
-          ++n;
-
-          if (fmt[n] == '*') {
-            ++dyn_args;
-            ++n;
-          } else {
-            while (is_digit(fmt[n]))
-              ++n;
-          }
-        }
+  /* flags (-, +, #, 0, or space) */
+  while (strchr("-+#0 ", fmt[n]) != NULL) {
+    ++n;
+  }
 
-        /* length modifier (hh, h, l, ll, j, z, t, L) */
-        /* Windows once used I, I32, and I64 as extensions */
-        switch (fmt[n]) {
-          case 'h':
-          case 'l':
-          case 'j':
-          case 'z':
-          case 't':
-          case 'L':
-          case 'I':
-            len_mod = fmt[n];
-            ++n;
-        }
+  /* width (* or number) */
+  if (fmt[n] == '*') {
+    ++spec->dyn_args;
+    ++n;
+  } else {
+    while (is_digit(fmt[n]))
+      ++n;
+  }
 
-        if (len_mod == 'h' && fmt[n] == 'h') {
-          len_mod = '1'; /* magic value representing 'hh' */
-          ++n;
-        } else if (len_mod == 'l' && fmt[n] == 'l') {
-          len_mod = '8';  /* magic value representing 'll' */
-          ++n;
-        } else if (len_mod == 'I') {
-          len_mod = 'j';                                   /* LCOV_EXCL_LINE */
-          if (fmt[n] == '3' && fmt[n+1] == '2') {          /* LCOV_EXCL_LINE */
-            if (sizeof(int) >= 4) len_mod = '\0';          /* LCOV_EXCL_LINE */
-            else                  len_mod = 'l';           /* LCOV_EXCL_LINE */
-            n += 2;                                        /* LCOV_EXCL_LINE */
-          } else if (fmt[n] == '6' && fmt[n+1] == '4') {   /* LCOV_EXCL_LINE */
-            if (sizeof(int) >= 8)            len_mod = '\0';/* LCOV_EXCL_LINE*/
-            else if (sizeof(long) >= 8)      len_mod = 'l';/* LCOV_EXCL_LINE */
-            else if (sizeof(long long) >= 8) len_mod = '8';/* LCOV_EXCL_LINE */
-            n += 2;                                        /* LCOV_EXCL_LINE */
-          }
-        }
+  /* precision (.* or .number) */
+  if (fmt[n] == '.') {
+    ++n;
 
-        /* specifier (diouxX, aAeEfFgG, c, s, p, n, %) */
-        /* %C and %S are extensions equivalent to %lc and %ls */
-        prn_spec = fmt[n++];
+    if (fmt[n] == '*') {
+      ++spec->dyn_args;
+      ++n;
+    } else {
+      while (is_digit(fmt[n]))
+        ++n;
+    }
+  }
 
-        strncpy(fmt2, fmt, n > sizeof(fmt2) ? sizeof(fmt2) : n);
-        fmt2[n] = '\0';
+  plain = n == 1;
+
+  /* length modifier (hh, h, l, ll, j, z, t, L) */
+  /* Windows once used I, I32, and I64 as extensions */
+  switch (fmt[n]) {
+    case 'h':
+    case 'l':
+    case 'j':
+    case 'z':
+    case 't':
+    case 'L':
+    case 'I':
+      spec->len_mod = fmt[n];
+      ++n;
+  }
 
-        va_copy(sub_ap, ap);
-        need_len = vsnprintf(buf, sizeof(buf), fmt2, sub_ap);
-        /*
-         * TODO(lsm): Fix windows & eCos code path here. Their vsnprintf
-         * implementation returns -1 on overflow rather needed size.
-         */
-        if (need_len >= sizeof(buf)) {
-          /*
-           * resulting string doesn't fit into a stack-allocated buffer `buf`,
-           * so we need to allocate a new buffer from heap and use it
-           */
-          pbuf = (char *) malloc(need_len);
-          va_copy(sub_ap, ap);
-          need_len = vsnprintf(pbuf, need_len + 1, fmt2, sub_ap);
-        }
+  if (spec->len_mod == 'h' && fmt[n] == 'h') {
+    spec->len_mod = '1'; /* magic value representing 'hh' */
+    ++n;
+  } else if (spec->len_mod == 'l' && fmt[n] == 'l') {
+    spec->len_mod = '8';  /* magic value representing 'll' */
+    ++n;
+  } else if (spec->len_mod == 'I') {
+    spec->len_mod = 'j';                                   /* LCOV_EXCL_LINE */
+    if (fmt[n] == '3' && fmt[n+1] == '2') {                /* LCOV_EXCL_LINE */
+      if (sizeof(int) >= 4) spec->len_mod = '\0';          /* LCOV_EXCL_LINE */
+      else                  spec->len_mod = 'l';           /* LCOV_EXCL_LINE */
+      n += 2;                                              /* LCOV_EXCL_LINE */
+    } else if (fmt[n] == '6' && fmt[n+1] == '4') {         /* LCOV_EXCL_LINE */
+      if (sizeof(int) >= 8)            spec->len_mod = '\0';/* LCOV_EXCL_LINE*/
+      else if (sizeof(long) >= 8)      spec->len_mod = 'l';/* LCOV_EXCL_LINE */
+      else if (sizeof(long long) >= 8) spec->len_mod = '8';/* LCOV_EXCL_LINE */
+      n += 2;                                              /* LCOV_EXCL_LINE */
+    }
+  }
 
-        /* absorb dynamically specified width/precision */
-        if (dyn_args == 2) (void) va_arg(ap, int);
-        if (dyn_args >= 1) (void) va_arg(ap, int);
-
-        /* todo: advance va */
-        switch (prn_spec) {
-          /* integer */
-          case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
-            switch (len_mod) {
-              case 'l': (void) va_arg(ap, long); break;
-              case '8': (void) va_arg(ap, long long); break;
-              case 'j': (void) va_arg(ap, intmax_t); break;
-              case 'z': (void) va_arg(ap, size_t); break;
-              case 't': (void) va_arg(ap, ptrdiff_t); break;
-              default: (void) va_arg(ap, int);
-            }
-            break;
-
-          /* floating point */
-          case 'a': case 'A': case 'e': case 'E': case 'f': case 'F':
-          case 'g': case 'G':
-            if (len_mod == 'L')
-              (void) va_arg(ap, long double);
-            else
-              (void) va_arg(ap, double);
-            break;
-
-          /* character */
-          case 'c': case 'C':
-            if (prn_spec == 'C' || len_mod == 'l')
-              (void) va_arg(ap, wint_t);
-            else
-              (void) va_arg(ap, int);
-            break;
-
-          /* string */
-          case 's': case 'S':
-            if (prn_spec == 'S' || len_mod == 'l')
-              (void) va_arg(ap, wchar_t *);
-            else
-              (void) va_arg(ap, char *);
-            break;
-
-          /* pointer */
-          case 'p':
-            (void) va_arg(ap, void *);
-            break;
-
-          /* pointer-out */
-          case 'n':
-            switch (len_mod) {
-              case '1': *(va_arg(ap, signed char *)) = (signed char)len; break;
-              case 'h':       *(va_arg(ap, short *)) = (short)len; break;
-              case 'l':        *(va_arg(ap, long *)) = len; break;
-              case '8':   *(va_arg(ap, long long *)) = len; break;
-              case 'j':    *(va_arg(ap, intmax_t *)) = len; break;
-              case 'z':      *(va_arg(ap, size_t *)) = (size_t)len; break;
-              case 't':   *(va_arg(ap, ptrdiff_t *)) = len; break;
-
-              default:
-                *(va_arg(ap, int *)) = len; break;
-            }
-            break;
-
-          case '%':
-            break;
-
-          default:                                         /* LCOV_EXCL_LINE */
-            /* if the specifier is unknown, treat it as an int and pray */
-            (void) va_arg(ap, int);                        /* LCOV_EXCL_LINE */
-        }
+  /* specifier (diouxX, aAeEfFgG, c, s, p, n, %) */
+  /* %C and %S are extensions equivalent to %lc and %ls */
+  spec->type = fmt[n++];
+  spec->native = plain && (spec->type == 'd' || spec->type == 'i' ||
+                           spec->type == 'u');
+  spec->len = n;
+}
 
-        len += out->printer(out, pbuf, need_len);
-        skip = n;
+/* Print the integer of a native conversion, see `struct printf_spec` */
+static int printf_native(struct json_out *out, const struct printf_spec *spec,
+                         va_list *ap) {
+  char buf[JSON_NUMBER_BUF_SIZE];
+  int n;
 
-        /* If buffer was allocated from heap, free it */
-        if (pbuf != buf) {
-          free(pbuf);
-          pbuf = NULL;
-        }
+  if (spec->type == 'u') {
+    uint64_t v;
+    switch (spec->len_mod) {
+      case '1': v = (unsigned char) va_arg(*ap, unsigned int); break;
+      case 'h': v = (unsigned short) va_arg(*ap, unsigned int); break;
+      case 'l': v = va_arg(*ap, unsigned long); break;
+      case '8': v = va_arg(*ap, unsigned long long); break;
+      case 'j': v = va_arg(*ap, uintmax_t); break;
+      case 'z': v = va_arg(*ap, size_t); break;
+      case 't': v = (size_t) va_arg(*ap, ptrdiff_t); break;
+      default: v = va_arg(*ap, unsigned int);
+    }
+    n = json_utoa(v, buf);
+  } else {
+    int64_t v;
+    switch (spec->len_mod) {
+      case '1': v = (signed char) va_arg(*ap, int); break;
+      case 'h': v = (short) va_arg(*ap, int); break;
+      case 'l': v = va_arg(*ap, long); break;
+      case '8': v = va_arg(*ap, long long); break;
+      case 'j': v = va_arg(*ap, intmax_t); break;
+      case 'z': v = (ptrdiff_t) va_arg(*ap, size_t); break;
+      case 't': v = va_arg(*ap, ptrdiff_t); break;
+      default: v = va_arg(*ap, int);
+    }
+    n = json_itoa(v, buf);
+  }
+
+  return out->printer(out, buf, n);
+}
+
+/*
+ * Print a conversion with the system printf, unless it is native. `fmt` is
+ * the conversion alone, `len` the number of bytes printed so far, for %n.
+ */
+static int printf_delegate(struct json_out *out, const char *fmt,
+                           const struct printf_spec *spec, va_list *ap,
+                           int len) {
+  char buf[101], *pbuf = buf;
+  size_t need_len;
+  va_list sub_ap;
+
+  if (spec->native) return printf_native(out, spec, ap);
+
+  va_copy(sub_ap, *ap);
+  need_len = vsnprintf(buf, sizeof(buf), fmt, sub_ap);
+  va_end(sub_ap);
+  /*
+   * TODO(lsm): Fix windows & eCos code path here. Their vsnprintf
+   * implementation returns -1 on overflow rather needed size.
+   */
+  if (need_len >= sizeof(buf)) {
+    /*
+     * resulting string doesn't fit into a stack-allocated buffer `buf`,
+     * so we need to allocate a new buffer from heap and use it
+     */
+    pbuf = (char *) malloc(need_len + 1);
+    va_copy(sub_ap, *ap);
+    need_len = vsnprintf(pbuf, need_len + 1, fmt, sub_ap);
+    va_end(sub_ap);
+  }
+
+  /* absorb dynamically specified width/precision */
+  if (spec->dyn_args == 2) (void) va_arg(*ap, int);
+  if (spec->dyn_args >= 1) (void) va_arg(*ap, int);
+
+  switch (spec->type) {
+    /* integer */
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+      switch (spec->len_mod) {
+        case 'l': (void) va_arg(*ap, long); break;
+        case '8': (void) va_arg(*ap, long long); break;
+        case 'j': (void) va_arg(*ap, intmax_t); break;
+        case 'z': (void) va_arg(*ap, size_t); break;
+        case 't': (void) va_arg(*ap, ptrdiff_t); break;
+        default: (void) va_arg(*ap, int);
+      }
+      break;
+
+    /* floating point */
+    case 'a': case 'A': case 'e': case 'E': case 'f': case 'F':
+    case 'g': case 'G':
+      if (spec->len_mod == 'L')
+        (void) va_arg(*ap, long double);
+      else
+        (void) va_arg(*ap, double);
+      break;
+
+    /* character */
+    case 'c': case 'C':
+      if (spec->type == 'C' || spec->len_mod == 'l')
+        (void) va_arg(*ap, wint_t);
+      else
+        (void) va_arg(*ap, int);
+      break;
+
+    /* string */
+    case 's': case 'S':
+      if (spec->type == 'S' || spec->len_mod == 'l')
+        (void) va_arg(*ap, wchar_t *);
+      else
+        (void) va_arg(*ap, char *);
+      break;
+
+    /* pointer */
+    case 'p':
+      (void) va_arg(*ap, void *);
+      break;
+
+    /* pointer-out */
+    case 'n':
+      switch (spec->len_mod) {
+        case '1': *(va_arg(*ap, signed char *)) = (signed char)len; break;
+        case 'h':       *(va_arg(*ap, short *)) = (short)len; break;
+        case 'l':        *(va_arg(*ap, long *)) = len; break;
+        case '8':   *(va_arg(*ap, long long *)) = len; break;
+        case 'j':    *(va_arg(*ap, intmax_t *)) = len; break;
+        case 'z':      *(va_arg(*ap, size_t *)) = (size_t)len; break;
+        case 't':   *(va_arg(*ap, ptrdiff_t *)) = len; break;
+
+        default:
+          *(va_arg(*ap, int *)) = len; break;
       }
-      fmt += skip;
-    } else if (*fmt == '_' || is_alpha(*fmt)) {
+      break;
+
+    case '%':
+      break;
+
+    default:                                               /* LCOV_EXCL_LINE */
+      /* if the specifier is unknown, treat it as an int and pray */
+      (void) va_arg(*ap, int);                             /* LCOV_EXCL_LINE */
+  }
+
+  len = out->printer(out, pbuf, need_len);
+
+  /* If buffer was allocated from heap, free it */
+  if (pbuf != buf) free(pbuf);
+
+  return len;
+}
+
+static int is_key_start(int ch) {
+  return ch == '_' || is_alpha(ch);
+}
+
+static int is_key_char(int ch) {
+  return ch == '_' || is_alpha(ch) || is_digit(ch);
+}
+
+int json_vprintf(struct json_out *out, const char *fmt, va_list xap) {
+  int len = 0, type, n;
+  const char *quote = "\"";
+  va_list ap;
+  va_copy(ap, xap);
+
+  while (*fmt != '\0') {
+    if (strchr(":, \r\n\t[]{}\"", *fmt) != NULL) {
+      len += out->printer(out, fmt, 1);
+      fmt++;
+    } else if (fmt[0] == '%') {
+      if ((type = printf_special_type(fmt, &n)) != 0) {
+        len += printf_special(out, type, &ap);
+      } else {
+        struct printf_spec spec;
+        char fmt2[30];
+
+        printf_parse_spec(fmt, &spec);
+        n = spec.len < (int) sizeof(fmt2) ? spec.len : (int) sizeof(fmt2) - 1;
+        memcpy(fmt2, fmt, n);
+        fmt2[n] = '\0';
+        len += printf_delegate(out, fmt2, &spec, &ap, len);
+        n = spec.len;
+      }
+      fmt += n;
+    } else if (is_key_start(*fmt)) {
       len += out->printer(out, quote, 1);
-      while (*fmt == '_' || is_alpha(*fmt) || is_digit(*fmt)) {
+      while (is_key_char(*fmt)) {
         len += out->printer(out, fmt, 1);
         fmt++;
       }
@@ -321,12 +433,315 @@ int json_printf(struct json_out *out, const char *fmt, ...) {
   return n;
 }
 
-int json_printf_array(struct json_out *out, va_list *ap) {
+/* Types of the operations of a compiled format, other than Elsa conversions */
+#define PRINTF_OP_LITERAL 0  /* Print `len` bytes of text at `off` */
+#define PRINTF_OP_DELEGATE 2 /* Conversion at `off` for the system printf */
+
+/* An operation of a compiled format */
+struct json_printf_op {
+  int type;                /* PRINTF_OP_*, or the type of an Elsa conversion */
+  int off;                 /* Offset of the text of the operation */
+  int len;                 /* Length of the literal text */
+  struct printf_spec spec; /* Delegated conversion */
+};
+
+/* Format string compiled by json_printf_compile() */
+struct json_printf_plan {
+  int num_ops;
+  struct json_printf_op *ops;
+  char *text; /* Literal runs and delegated conversions */
+};
+
+struct json_printf_plan *json_printf_compile(const char *fmt) {
+  size_t fmt_len = strlen(fmt);
+  /* A key of one character takes three bytes of text with its quotes */
+  size_t size = sizeof(struct json_printf_plan) +
+                (fmt_len + 1) * sizeof(struct json_printf_op) + 3 * fmt_len + 1;
+  struct json_printf_plan *plan = (struct json_printf_plan *) malloc(size);
+  struct json_printf_op *op = NULL;
+  int text_len = 0, type, n;
+
+  if (plan == NULL) return NULL;
+  plan->ops = (struct json_printf_op *) (plan + 1);
+  plan->text = (char *) (plan->ops + fmt_len + 1);
+  plan->num_ops = 0;
+
+  while (*fmt != '\0') {
+    if (fmt[0] == '%' && fmt[1] != '%') {
+      op = &plan->ops[plan->num_ops++];
+      op->off = text_len;
+      op->len = 0;
+      if ((type = printf_special_type(fmt, &n)) != 0) {
+        op->type = type;
+      } else {
+        op->type = PRINTF_OP_DELEGATE;
+        printf_parse_spec(fmt, &op->spec);
+        n = op->spec.len;
+        memcpy(plan->text + text_len, fmt, n);
+        text_len += n;
+        plan->text[text_len++] = '\0';
+      }
+      fmt += n;
+      op = NULL;
+      continue;
+    }
+
+    /* Everything else is merged into literal runs */
+    if (op == NULL) {
+      op = &plan->ops[plan->num_ops++];
+      op->type = PRINTF_OP_LITERAL;
+      op->off = text_len;
+      op->len = 0;
+    }
+    if (fmt[0] == '%') {
+      /* %% */
+      plan->text[text_len++] = '%';
+      fmt += 2;
+    } else if (is_key_start(*fmt)) {
+      plan->text[text_len++] = '"';
+      while (is_key_char(*fmt)) plan->text[text_len++] = *fmt++;
+      plan->text[text_len++] = '"';
+    } else {
+      plan->text[text_len++] = *fmt++;
+    }
+    op->len = text_len - op->off;
+  }
+
+  return plan;
+}
+
+void json_printf_plan_free(struct json_printf_plan *plan) {
+  free(plan);
+}
+
+int json_vprintf_exec(struct json_out *out,
+                      const struct json_printf_plan *plan, va_list xap) {
+  const struct json_printf_op *op = plan->ops, *end = op + plan->num_ops;
   int len = 0;
+  va_list ap;
+  va_copy(ap, xap);
+
+  for (; op < end; op++) {
+    switch (op->type) {
+      case PRINTF_OP_LITERAL:
+        len += out->printer(out, plan->text + op->off, op->len);
+        break;
+      case PRINTF_OP_DELEGATE:
+        len += printf_delegate(out, plan->text + op->off, &op->spec, &ap, len);
+        break;
+      default:
+        len += printf_special(out, op->type, &ap);
+        break;
+    }
+  }
+  va_end(ap);
+
+  return len;
+}
+
+int json_printf_exec(struct json_out *out, const struct json_printf_plan *plan,
+                     ...) {
+  int n;
+  va_list ap;
+  va_start(ap, plan);
+  n = json_vprintf_exec(out, plan, ap);
+  va_end(ap);
+  return n;
+}
+
+/* Element types of the typed array printers */
+#define PRINTF_ARRAY_INT8 0
+#define PRINTF_ARRAY_INT16 1
+#define PRINTF_ARRAY_INT32 2
+#define PRINTF_ARRAY_INT64 3
+#define PRINTF_ARRAY_UINT8 4
+#define PRINTF_ARRAY_UINT16 5
+#define PRINTF_ARRAY_UINT32 6
+#define PRINTF_ARRAY_UINT64 7
+#define PRINTF_ARRAY_FLOAT 8
+#define PRINTF_ARRAY_DOUBLE 9
+#define PRINTF_ARRAY_BOOL 10
+#define PRINTF_ARRAY_STRING 11
+
+/*
+ * Print the `count` elements of type `type` at `arr` as a JSON array. The
+ * numbers are formatted straight into a staging buffer, which is passed to
+ * `out` whenever it fills up.
+ */
+static int printf_array_values(struct json_out *out, const void *arr,
+                               size_t count, int type) {
+  struct json_out_buffered b;
+  char buf[1024];
+  size_t i;
+  int len = 2;
+
+  json_out_buffered_init(&b, out, buf, sizeof(buf));
+  buf[b.len++] = '[';
+  for (i = 0; arr != NULL && i < count; i++) {
+    char *p;
+    int n = 0;
+    if (b.size - b.len < JSON_NUMBER_BUF_SIZE + 2) json_out_flush(&b);
+    if (i > 0) {
+      buf[b.len++] = ',';
+      buf[b.len++] = ' ';
+      len += 2;
+    }
+    p = buf + b.len;
+    switch (type) {
+      case PRINTF_ARRAY_INT8:
+        n = json_itoa(((const int8_t *) arr)[i], p);
+        break;
+      case PRINTF_ARRAY_INT16:
+        n = json_itoa(((const int16_t *) arr)[i], p);
+        break;
+      case PRINTF_ARRAY_INT32:
+        n = json_itoa(((const int32_t *) arr)[i], p);
+        break;
+      case PRINTF_ARRAY_INT64:
+        n = json_itoa(((const int64_t *) arr)[i], p);
+        break;
+      case PRINTF_ARRAY_UINT8:
+        n = json_utoa(((const uint8_t *) arr)[i], p);
+        break;
+      case PRINTF_ARRAY_UINT16:
+        n = json_utoa(((const uint16_t *) arr)[i], p);
+        break;
+      case PRINTF_ARRAY_UINT32:
+        n = json_utoa(((const uint32_t *) arr)[i], p);
+        break;
+      case PRINTF_ARRAY_UINT64:
+        n = json_utoa(((const uint64_t *) arr)[i], p);
+        break;
+      case PRINTF_ARRAY_FLOAT:
+        n = json_ftoa(((const float *) arr)[i], p);
+        break;
+      case PRINTF_ARRAY_DOUBLE:
+        n = json_dtoa(((const double *) arr)[i], p);
+        break;
+      case PRINTF_ARRAY_BOOL:
+        if (((const bool *) arr)[i]) {
+          memcpy(p, "true", 4);
+          n = 4;
+        } else {
+          memcpy(p, "false", 5);
+          n = 5;
+        }
+        break;
+      default: {
+        const char *str = ((const char *const *) arr)[i];
+        if (str == NULL) {
+          memcpy(p, "null", 4);
+          n = 4;
+        } else {
+          buf[b.len++] = '"';
+          len += json_escape(&b.out, str, strlen(str)) + 2;
+          json_printer_buffered(&b.out, "\"", 1);
+        }
+        break;
+      }
+    }
+    b.len += n;
+    len += n;
+  }
+  json_printer_buffered(&b.out, "]", 1);
+  json_out_flush(&b);
+  return len;
+}
+
+/* Consume the arguments of a typed array printer, and print the array */
+static int printf_array_typed(struct json_out *out, va_list *ap, int type) {
+  const void *arr = va_arg(*ap, const void *);
+  size_t count = va_arg(*ap, size_t);
+  return printf_array_values(out, arr, count, type);
+}
+
+int json_printf_array_int8(struct json_out *out, va_list *ap) {
+  return printf_array_typed(out, ap, PRINTF_ARRAY_INT8);
+}
+
+int json_printf_array_int16(struct json_out *out, va_list *ap) {
+  return printf_array_typed(out, ap, PRINTF_ARRAY_INT16);
+}
+
+int json_printf_array_int32(struct json_out *out, va_list *ap) {
+  return printf_array_typed(out, ap, PRINTF_ARRAY_INT32);
+}
+
+int json_printf_array_int64(struct json_out *out, va_list *ap) {
+  return printf_array_typed(out, ap, PRINTF_ARRAY_INT64);
+}
+
+int json_printf_array_uint8(struct json_out *out, va_list *ap) {
+  return printf_array_typed(out, ap, PRINTF_ARRAY_UINT8);
+}
+
+int json_printf_array_uint16(struct json_out *out, va_list *ap) {
+  return printf_array_typed(out, ap, PRINTF_ARRAY_UINT16);
+}
+
+int json_printf_array_uint32(struct json_out *out, va_list *ap) {
+  return printf_array_typed(out, ap, PRINTF_ARRAY_UINT32);
+}
+
+int json_printf_array_uint64(struct json_out *out, va_list *ap) {
+  return printf_array_typed(out, ap, PRINTF_ARRAY_UINT64);
+}
+
+int json_printf_array_float(struct json_out *out, va_list *ap) {
+  return printf_array_typed(out, ap, PRINTF_ARRAY_FLOAT);
+}
+
+int json_printf_array_double(struct json_out *out, va_list *ap) {
+  return printf_array_typed(out, ap, PRINTF_ARRAY_DOUBLE);
+}
+
+int json_printf_array_bool(struct json_out *out, va_list *ap) {
+  return printf_array_typed(out, ap, PRINTF_ARRAY_BOOL);
+}
+
+int json_printf_array_string(struct json_out *out, va_list *ap) {
+  return printf_array_typed(out, ap, PRINTF_ARRAY_STRING);
+}
+
+/*
+ * Return the typed array printer that prints elements of `elem_size` bytes
+ * like the conversion `fmt` would, or -1 if there is none.
+ */
+static int printf_array_type(const char *fmt, size_t elem_size) {
+  struct printf_spec spec;
+
+  if (strcmp(fmt, "%Q") == 0) {
+    return elem_size == sizeof(char *) ? PRINTF_ARRAY_STRING : -1;
+  } else if (strcmp(fmt, "%D") == 0) {
+    return elem_size == sizeof(double) ? PRINTF_ARRAY_DOUBLE : -1;
+  } else if (fmt[0] != '%') {
+    return -1;
+  }
+
+  printf_parse_spec(fmt, &spec);
+  if (!spec.native || fmt[spec.len] != '\0') return -1;
+  switch (elem_size) {
+    case 1: return spec.type == 'u' ? PRINTF_ARRAY_UINT8 : PRINTF_ARRAY_INT8;
+    case 2: return spec.type == 'u' ? PRINTF_ARRAY_UINT16 : PRINTF_ARRAY_INT16;
+    case 4: return spec.type == 'u' ? PRINTF_ARRAY_UINT32 : PRINTF_ARRAY_INT32;
+    case 8: return spec.type == 'u' ? PRINTF_ARRAY_UINT64 : PRINTF_ARRAY_INT64;
+    default: return -1;
+  }
+}
+
+int json_printf_array(struct json_out *out, va_list *ap) {
+  int len = 0, type, is_double;
   char *arr = va_arg(*ap, char *);
   size_t i, arr_size = va_arg(*ap, size_t);
   size_t elem_size = va_arg(*ap, size_t);
   const char *fmt = va_arg(*ap, char *);
+
+  type = printf_array_type(fmt, elem_size);
+  if (type >= 0) {
+    return printf_array_values(out, arr, arr_size / elem_size, type);
+  }
+
+  is_double = strchr(fmt, 'f') != NULL || strchr(fmt, 'D') != NULL;
   len += json_printf(out, "[", 1);
   for (i = 0; arr != NULL && i < arr_size / elem_size; i++) {
     union {
@@ -336,7 +751,7 @@ int json_printf_array(struct json_out *out, va_list *ap) {
     memcpy(&val, arr + i * elem_size,
            elem_size > sizeof(val) ? sizeof(val) : elem_size);
     if (i > 0) len += json_printf(out, ", ");
-    if (strchr(fmt, 'f') != NULL) {
+    if (is_double) {
       len += json_printf(out, fmt, val.d);
     } else {
       len += json_printf(out, fmt, val.i);
@@ -351,7 +766,11 @@ int json_vfprintf(const char *file_name, const char *fmt, va_list ap) {
   FILE *fp = fopen(file_name, "wb");
   if (fp != NULL) {
     struct json_out out = JSON_OUT_FILE(fp);
-    res = json_vprintf(&out, fmt, ap);
+    struct json_out_buffered b;
+    char buf[JSON_FILE_BUF_SIZE];
+    json_out_buffered_init(&b, &out, buf, sizeof(buf));
+    res = json_vprintf(&b.out, fmt, ap);
+    json_out_flush(&b);
     fputc('\n', fp);
     fclose(fp);
   }
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2004-2013 Sergey Lyubka <valenok@gmail.com>
+ * Copyright (c) 2013 Cesanta Software Limited
+ * Copyright (c) 2020 Julian Smythe <sausage@tehsausage.com>
+ * All rights reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "elsa.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "query.h"
+
+/* A path registered with json_query_add() */
+struct json_query_entry {
+  const char *path;
+  struct json_token *token;
+  json_query_callback_t callback;
+  void *callback_data;
+  int found; /* Non-0 if the value was found by the current run */
+};
+
+struct json_query_set {
+  struct query_trie trie;
+  struct json_query_entry *entries; /* Indexed by the id in the trie */
+  int num_entries;
+  int max_entries;
+  struct query_level *stack; /* Trie depth + 1 levels */
+  int max_levels;
+};
+
+/* Make room for `n` elements of `size` bytes in the heap array `*arr` */
+static int query_set_reserve(void **arr, int n, int *max, size_t size) {
+  void *p;
+  if (n <= *max) return 1;
+  if (n < *max * 2) n = *max * 2;
+  if ((p = realloc(*arr, n * size)) == NULL) return 0;
+  *arr = p;
+  *max = n;
+  return 1;
+}
+
+struct json_query_set *json_query_new(void) {
+  struct json_query_set *q = (struct json_query_set *) calloc(1, sizeof(*q));
+  if (q == NULL) return NULL;
+  if (!query_trie_init(&q->trie, NULL, 0, NULL, 0, NULL)) {
+    free(q);
+    return NULL;
+  }
+  return q;
+}
+
+void json_query_free(struct json_query_set *q) {
+  if (q == NULL) return;
+  query_trie_free(&q->trie);
+  free(q->entries);
+  free(q->stack);
+  free(q);
+}
+
+int json_query_add(struct json_query_set *q, const char *path,
+                   struct json_token *token, json_query_callback_t callback,
+                   void *callback_data) {
+  struct json_query_entry *e;
+  int depth = query_path_depth(path);
+
+  if (depth < 0 ||
+      !query_set_reserve((void **) &q->stack, depth + 1, &q->max_levels,
+                         sizeof(*q->stack)) ||
+      !query_set_reserve((void **) &q->entries, q->num_entries + 1,
+                         &q->max_entries, sizeof(*q->entries)) ||
+      query_trie_add(&q->trie, path, q->num_entries) != 0) {
+    return -1;
+  }
+
+  e = &q->entries[q->num_entries++];
+  e->path = path;
+  e->token = token;
+  e->callback = callback;
+  e->callback_data = callback_data;
+  return 0;
+}
+
+/* Hand a value to the entry `id` of the query set `data` */
+static int query_set_deliver(void *data, int id,
+                             const struct json_token *token) {
+  struct json_query_entry *e = &((struct json_query_set *) data)->entries[id];
+  if (e->found) return 0;
+  e->found = 1;
+  if (e->token != NULL) *e->token = *token;
+  if (e->callback != NULL) e->callback(e->callback_data, e->path, token);
+  return 1;
+}
+
+int json_query_run(struct json_query_set *q, const char *s, int len) {
+  int i, n, found = 0;
+
+  for (i = 0; i < q->num_entries; i++) {
+    struct json_query_entry *e = &q->entries[i];
+    e->found = 0;
+    if (e->token != NULL) memset(e->token, 0, sizeof(*e->token));
+  }
+  if (q->num_entries == 0) return 0;
+
+  n = query_walk(&q->trie, q->stack, query_set_deliver, q, s, len);
+  if (n < 0) return n;
+  for (i = 0; i < q->num_entries; i++) found += q->entries[i].found;
+  return found;
+}
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2004-2013 Sergey Lyubka <valenok@gmail.com>
+ * Copyright (c) 2013 Cesanta Software Limited
+ * Copyright (c) 2020 Julian Smythe <sausage@tehsausage.com>
+ * All rights reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef ELSA_QUERY_H_
+#define ELSA_QUERY_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include "elsa.h"
+#include "util.h"
+
+/*
+ * Trie of paths resolved in a single walk, used by `json_query_run()` and
+ * `json_scanf()`. The trie starts in caller storage, which may be on the
+ * stack, and moves to an arena or to the heap if it outgrows it.
+ */
+
+/* A node of the trie of path segments. Node 0 is the root value. */
+struct query_node {
+  const char *key; /* Key of an object segment, NULL for array segments */
+  int key_len;     /* Length of the key */
+  int index;       /* Index of an array segment */
+  int child;       /* First child node, or -1 */
+  int sibling;     /* Next sibling node, or -1 */
+  int entry;       /* First path registered at this node, or -1 */
+};
+
+/* A registered path */
+struct query_entry {
+  int id;   /* Identifier of the path, passed to the deliver function */
+  int next; /* Next path registered at the same node, or -1 */
+};
+
+/* Arrays of a trie that were moved to the heap */
+#define QUERY_HEAP_NODES 1
+#define QUERY_HEAP_ENTRIES 2
+
+struct query_trie {
+  struct query_node *nodes;
+  int num_nodes;
+  int max_nodes;
+  struct query_entry *entries;
+  int num_entries;
+  int max_entries;
+  int max_depth;            /* Number of segments of the longest path */
+  int heap;                 /* QUERY_HEAP_* flags */
+  struct json_arena *arena; /* Grow into it instead of the heap, or NULL */
+};
+
+/* An object or array being walked, that is on some registered path */
+struct query_level {
+  int node;  /* Trie node of the object or array */
+  int count; /* Number of array entries seen so far */
+};
+
+/*
+ * Called with the value of the path registered as `id`. Return 1 if the path
+ * is resolved, or 0 if it was resolved before.
+ */
+typedef int (*query_deliver_t)(void *data, int id,
+                               const struct json_token *token);
+
+/* State of a walk over a trie */
+struct query_run {
+  const struct query_trie *trie;
+  query_deliver_t deliver;
+  void *data;
+  struct query_level *stack; /* trie->max_depth + 1 levels */
+  int depth;                 /* Number of levels in use */
+  int remaining;             /* Number of paths not resolved yet */
+};
+
+/*
+ * Make room for one more element of `size` bytes in an array of `t`. Caller
+ * storage is copied to the arena of `t`, or to the heap with `heap_flag` set,
+ * when it is full.
+ */
+static int query_grow(struct query_trie *t, void **arr, int num, int *max,
+                      size_t size, int heap_flag) {
+  void *p;
+  int n;
+  if (num < *max) return 1;
+  n = *max == 0 ? 8 : *max * 2;
+  if (t->heap & heap_flag) {
+    p = realloc(*arr, n * size);
+  } else if (t->arena != NULL) {
+    /* The old array stays in the arena until it is reset */
+    if ((p = json_arena_alloc(t->arena, n * size)) != NULL && num > 0) {
+      memcpy(p, *arr, num * size);
+    }
+  } else if ((p = malloc(n * size)) != NULL) {
+    if (num > 0) memcpy(p, *arr, num * size);
+    t->heap |= heap_flag;
+  }
+  if (p == NULL) return 0;
+  *arr = p;
+  *max = n;
+  return 1;
+}
+
+/*
+ * Initialise an empty trie in `max_nodes` nodes at `nodes` and `max_entries`
+ * entries at `entries`. Either may be NULL. The trie grows into `arena`, or
+ * into the heap if `arena` is NULL.
+ * Return 0 if out of memory. Release with query_trie_free().
+ */
+static int query_trie_init(struct query_trie *t, struct query_node *nodes,
+                           int max_nodes, struct query_entry *entries,
+                           int max_entries, struct json_arena *arena) {
+  t->arena = arena;
+  t->nodes = nodes;
+  t->max_nodes = nodes == NULL ? 0 : max_nodes;
+  t->entries = entries;
+  t->max_entries = entries == NULL ? 0 : max_entries;
+  t->num_nodes = t->num_entries = t->max_depth = t->heap = 0;
+  if (!query_grow(t, (void **) &t->nodes, 0, &t->max_nodes,
+                  sizeof(*t->nodes), QUERY_HEAP_NODES)) {
+    return 0;
+  }
+  /* The root value */
+  t->nodes[0].key = NULL;
+  t->nodes[0].key_len = 0;
+  t->nodes[0].index = -1;
+  t->nodes[0].child = t->nodes[0].sibling = t->nodes[0].entry = -1;
+  t->num_nodes = 1;
+  return 1;
+}
+
+static void query_trie_free(struct query_trie *t) {
+  if (t->heap & QUERY_HEAP_NODES) free(t->nodes);
+  if (t->heap & QUERY_HEAP_ENTRIES) free(t->entries);
+  t->heap = 0;
+}
+
+/* Return the number of segments of `path`, or -1 if it is malformed */
+static int query_path_depth(const char *path) {
+  int n, index, depth = 0;
+  while ((n = parse_path_segment(path, &index)) > 0) {
+    if (*path == '[' && index < 0) return -1;
+    path += n;
+    depth++;
+  }
+  return n < 0 ? -1 : depth;
+}
+
+/* Return the child of `node` for the given segment, adding it if needed */
+static int query_child(struct query_trie *t, int node, const char *key,
+                       int key_len, int index) {
+  struct query_node *n;
+  int i;
+
+  for (i = t->nodes[node].child; i >= 0; i = t->nodes[i].sibling) {
+    n = &t->nodes[i];
+    if (key == NULL ? n->key == NULL && n->index == index
+                    : n->key != NULL && n->key_len == key_len &&
+                          memcmp(n->key, key, key_len) == 0) {
+      return i;
+    }
+  }
+
+  if (!query_grow(t, (void **) &t->nodes, t->num_nodes, &t->max_nodes,
+                  sizeof(*t->nodes), QUERY_HEAP_NODES)) {
+    return -1;
+  }
+  i = t->num_nodes++;
+  n = &t->nodes[i];
+  n->key = key;
+  n->key_len = key_len;
+  n->index = index;
+  n->child = -1;
+  n->entry = -1;
+  n->sibling = t->nodes[node].child;
+  t->nodes[node].child = i;
+  return i;
+}
+
+/*
+ * Register `path` in `t` as `id`. `path` must outlive `t`.
+ * Return 0 on success, or -1 if `path` is malformed or out of memory.
+ */
+static int query_trie_add(struct query_trie *t, const char *path, int id) {
+  struct query_entry *e;
+  int node = 0, depth = 0, n, index;
+
+  while ((n = parse_path_segment(path, &index)) > 0) {
+    if (*path == '[' && index < 0) return -1;
+    node = index < 0 ? query_child(t, node, path + 1, n - 1, -1)
+                     : query_child(t, node, NULL, 0, index);
+    if (node < 0) return -1;
+    path += n;
+    depth++;
+  }
+  if (n < 0) return -1;
+
+  if (!query_grow(t, (void **) &t->entries, t->num_entries, &t->max_entries,
+                  sizeof(*t->entries), QUERY_HEAP_ENTRIES)) {
+    return -1;
+  }
+  e = &t->entries[t->num_entries++];
+  e->id = id;
+  e->next = t->nodes[node].entry;
+  t->nodes[node].entry = (int) (e - t->entries);
+  if (depth > t->max_depth) t->max_depth = depth;
+  return 0;
+}
+
+/* Hand the value of `node` to the paths registered there */
+static void query_deliver(struct query_run *r, int node,
+                          const struct json_token *token) {
+  const struct query_trie *t = r->trie;
+  int i;
+  for (i = t->nodes[node].entry; i >= 0; i = t->entries[i].next) {
+    r->remaining -= r->deliver(r->data, t->entries[i].id, token);
+  }
+}
+
+/* Return the trie node of an entry of the object or array `level`, or -1 */
+static int query_find(const struct query_trie *t, struct query_level *level,
+                      const char *name, size_t name_len) {
+  int i = t->nodes[level->node].child;
+
+  if (name == NULL) {
+    /* Array entry */
+    int idx = level->count++;
+    for (; i >= 0; i = t->nodes[i].sibling) {
+      if (t->nodes[i].key == NULL && t->nodes[i].index == idx) return i;
+    }
+  } else {
+    for (; i >= 0; i = t->nodes[i].sibling) {
+      const struct query_node *n = &t->nodes[i];
+      if (n->key != NULL && n->key_len == (int) name_len &&
+          memcmp(n->key, name, name_len) == 0) {
+        return i;
+      }
+    }
+  }
+  return -1;
+}
+
+static int query_walk_cb(void *userdata, const char *name, size_t name_len,
+                         const char *path, const struct json_token *token) {
+  struct query_run *r = (struct query_run *) userdata;
+  int node;
+  (void) path;
+
+  switch (token->type) {
+    case JSON_TYPE_OBJECT_END:
+    case JSON_TYPE_ARRAY_END:
+      node = r->stack[--r->depth].node;
+      query_deliver(r, node, token);
+      break;
+    default:
+      node = r->depth == 0 ? 0
+                           : query_find(r->trie, &r->stack[r->depth - 1],
+                                        name, name_len);
+      if (node < 0) {
+        /* No registered path goes through this value */
+        return token->ptr == NULL ? JSON_WALK_SKIP_SUBTREE : JSON_WALK_CONTINUE;
+      }
+      if (token->ptr == NULL) {
+        r->stack[r->depth].node = node;
+        r->stack[r->depth].count = 0;
+        r->depth++;
+      } else {
+        query_deliver(r, node, token);
+      }
+      break;
+  }
+
+  return r->remaining == 0 ? JSON_WALK_STOP : JSON_WALK_CONTINUE;
+}
+
+/*
+ * Walk `s`, handing the values of the paths of `t` to `deliver`. `stack`
+ * must hold `t->max_depth + 1` levels. The walk stops once every path is
+ * resolved. Return the result of json_walk_ex().
+ */
+static int query_walk(const struct query_trie *t, struct query_level *stack,
+                      query_deliver_t deliver, void *data, const char *s,
+                      int len) {
+  struct query_run r;
+  r.trie = t;
+  r.deliver = deliver;
+  r.data = data;
+  r.stack = stack;
+  r.depth = 0;
+  r.remaining = t->num_entries;
+  if (r.remaining == 0) return 0;
+  return json_walk_ex(s, len, query_walk_cb, &r, JSON_WALK_NO_PATH);
+}
+
+#endif /* ELSA_QUERY_H_ */
@@ -22,67 +22,38 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "query.h"
 #include "util.h"
 
-static int b64rev(int c) {
-  if (c >= 'A' && c <= 'Z') {
-    return c - 'A';
-  } else if (c >= 'a' && c <= 'z') {
-    return c + 26 - 'a';
-  } else if (c >= '0' && c <= '9') {
-    return c + 52 - '0';
-  } else if (c == '+') {
-    return 62;
-  } else if (c == '/') {
-    return 63;
-  } else {
-    return 64;
-  }
-}
-
-static int b64dec(const char *src, int n, char *dst) {
-  const char *end = src + n;
-  int len = 0;
-  while (src + 3 < end) {
-    int a = b64rev(src[0]), b = b64rev(src[1]), c = b64rev(src[2]),
-        d = b64rev(src[3]);
-    dst[len++] = (a << 2) | (b >> 4);
-    if (src[2] != '=') {
-      dst[len++] = (b << 4) | (c >> 2);
-      if (src[3] != '=') {
-        dst[len++] = (c << 6) | d;
-      }
-    }
-    src += 4;
-  }
-  return len;
-}
-
-static unsigned char hexdec(const char *s) {
-#define HEXTOI(x) (x >= '0' && x <= '9' ? x - '0' : x - 'W')
-  int a = to_lower(*(const unsigned char *) s);
-  int b = to_lower(*(const unsigned char *) (s + 1));
-  return (HEXTOI(a) << 4) | HEXTOI(b);
-}
-
 struct scan_array_info {
   int found;
   char path[JSON_MAX_PATH_LEN];
+  struct json_path matcher;
   struct json_token *token;
 };
 
-static void json_scanf_array_elem_cb(void *callback_data, const char *name,
-                                     size_t name_len, const char *path,
-                                     const struct json_token *token) {
+static int json_scanf_array_elem_cb(void *callback_data, const char *name,
+                                    size_t name_len, const char *path,
+                                    const struct json_token *token) {
   struct scan_array_info *info = (struct scan_array_info *) callback_data;
+  int res = json_path_match(&info->matcher, name, name_len, token);
 
-  (void) name;
-  (void) name_len;
+  (void) path;
 
-  if (strcmp(path, info->path) == 0) {
+  if (token->ptr == NULL) {
+    /* Skip objects and arrays that do not contain the element */
+    if (res != JSON_PATH_NO_MATCH) return JSON_WALK_CONTINUE;
+    json_path_skip(&info->matcher);
+    return JSON_WALK_SKIP_SUBTREE;
+  }
+
+  if (res == JSON_PATH_MATCH) {
     *info->token = *token;
     info->found = 1;
+    return JSON_WALK_STOP;
   }
+
+  return JSON_WALK_CONTINUE;
 }
 
 int json_scanf_array_elem(const char *s, int len, const char *path, int idx,
@@ -92,63 +63,217 @@ int json_scanf_array_elem(const char *s, int len, const char *path, int idx,
   info.found = 0;
   memset(token, 0, sizeof(*token));
   snprintf(info.path, sizeof(info.path), "%s[%d]", path, idx);
-  json_walk(s, len, json_scanf_array_elem_cb, &info);
+  if (json_path_compile(&info.matcher, info.path) != 0) return -1;
+  json_walk_ex(s, len, json_scanf_array_elem_cb, &info, JSON_WALK_NO_PATH);
   return info.found ? token->len : -1;
 }
 
-struct json_scanf_info {
-  int num_conversions;
-  char *path;
-  const char *fmt;
+int json_scanf_array(const char *s, int len, const char *path,
+                     struct json_token *tokens, int max_tokens) {
+  struct json_iter it;
+  struct json_token val;
+  int n, count = 0;
+
+  if ((n = json_iter_init(&it, s, len, path)) < 0) return n;
+  if (!it.is_array) return JSON_STRING_INVALID;
+  while ((n = json_iter_next(&it, NULL, &val)) > 0) {
+    if (count < max_tokens) tokens[count] = val;
+    count++;
+  }
+  return n < 0 ? n : count;
+}
+
+/* Fill `out` with the numbers of the array at `path`, as int64 or double */
+static int json_scanf_array_numbers(const char *s, int len, const char *path,
+                                    void *out, int max, int is_int) {
+  struct json_iter it;
+  struct json_token val;
+  struct json_number num;
+  int n, count = 0;
+
+  if ((n = json_iter_init(&it, s, len, path)) < 0) return n;
+  if (!it.is_array) return JSON_STRING_INVALID;
+  while ((n = json_iter_next(&it, NULL, &val)) > 0) {
+    if (val.type != JSON_TYPE_NUMBER ||
+        json_parse_number(val.ptr, val.len, &num) != 0 ||
+        (is_int && !(num.flags & JSON_NUMBER_INT64))) {
+      return JSON_STRING_INVALID;
+    }
+    if (count < max) {
+      if (is_int) {
+        ((int64_t *) out)[count] = num.i;
+      } else {
+        ((double *) out)[count] = num.d;
+      }
+    }
+    count++;
+  }
+  return n < 0 ? n : count;
+}
+
+int json_scanf_array_int64(const char *s, int len, const char *path,
+                           int64_t *values, int max_values) {
+  return json_scanf_array_numbers(s, len, path, values, max_values, 1);
+}
+
+int json_scanf_array_double(const char *s, int len, const char *path,
+                            double *values, int max_values) {
+  return json_scanf_array_numbers(s, len, path, values, max_values, 0);
+}
+
+/* A single conversion collected from the format string */
+struct json_scanf_conv {
+  const char *path; /* Path of the value, points into the path pool */
+  char fmt[20]; /* Conversion spec, for conversions done by sscanf() */
+  int num_type; /* How to store a decoded number, see json_scanf_number() */
+  int buf_size; /* Size of the caller buffer of %.*Q */
+  int skip;     /* Cannot match, only consumes arguments */
+  int found;    /* Value found by the current scan */
   void *target;
   void *user_data;
   int type;
 };
 
-static void json_scanf_cb(void *callback_data, const char *name,
-                          size_t name_len, const char *path,
-                          const struct json_token *token) {
-  struct json_scanf_info *info = (struct json_scanf_info *) callback_data;
-  char buf[32]; /* Must be enough to hold numbers */
+/*
+ * Number of conversions, path pool bytes, trie nodes and trie levels that
+ * json_vscanf() keeps on the stack. Larger formats use the heap.
+ */
+#define JSON_SCANF_STACK_CONVS 16
+#define JSON_SCANF_STACK_POOL 512
+#define JSON_SCANF_STACK_NODES 32
+#define JSON_SCANF_STACK_LEVELS 8
+
+struct json_scanf_info {
+  struct json_arena *arena; /* Allocate strings from it instead of malloc() */
+  int num_conversions;
+  int num_convs;
+  struct json_scanf_conv *convs;
+  struct query_trie trie; /* Paths of the conversions, ids index `convs` */
+  struct json_scanf_conv stack_convs[JSON_SCANF_STACK_CONVS];
+  char stack_pool[JSON_SCANF_STACK_POOL];
+  struct query_node stack_nodes[JSON_SCANF_STACK_NODES];
+  struct query_entry stack_entries[JSON_SCANF_STACK_CONVS];
+  struct query_level stack_levels[JSON_SCANF_STACK_LEVELS];
+};
 
-  (void) name;
-  (void) name_len;
+/* Conversions of numbers that do not need sscanf() */
+enum json_scanf_num_type {
+  SCANF_NUM_NONE = 0,
+  SCANF_NUM_INT,
+  SCANF_NUM_LONG,
+  SCANF_NUM_LLONG,
+  SCANF_NUM_UINT,
+  SCANF_NUM_ULONG,
+  SCANF_NUM_ULLONG,
+  SCANF_NUM_FLOAT,
+  SCANF_NUM_DOUBLE
+};
 
-  if (strcmp(path, info->path) != 0) {
-    /* It's not the path we're looking for, so, just ignore this callback */
-    return;
+static int json_scanf_num_type(const char *fmt) {
+  static const struct {
+    const char *fmt;
+    int type;
+  } types[] = {{"%d", SCANF_NUM_INT},      {"%ld", SCANF_NUM_LONG},
+               {"%lld", SCANF_NUM_LLONG},  {"%u", SCANF_NUM_UINT},
+               {"%lu", SCANF_NUM_ULONG},   {"%llu", SCANF_NUM_ULLONG},
+               {"%f", SCANF_NUM_FLOAT},    {"%g", SCANF_NUM_FLOAT},
+               {"%e", SCANF_NUM_FLOAT},    {"%lf", SCANF_NUM_DOUBLE},
+               {"%lg", SCANF_NUM_DOUBLE},  {"%le", SCANF_NUM_DOUBLE}};
+  size_t i;
+  for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+    if (strcmp(fmt, types[i].fmt) == 0) return types[i].type;
   }
+  return SCANF_NUM_NONE;
+}
 
-  if (token->ptr == NULL) {
-    /*
-     * We're not interested here in the events for which we have no value;
-     * namely, JSON_TYPE_OBJECT_START and JSON_TYPE_ARRAY_START
-     */
-    return;
+/*
+ * Store the number `token` with json_parse_number(), which also handles
+ * numbers too long for the sscanf() buffer. Return 0 if sscanf() has to do
+ * the conversion: not a number, or not an integer that fits.
+ */
+static int json_scanf_number(const struct json_scanf_conv *conv,
+                             const struct json_token *token) {
+  struct json_number num;
+  int is_signed = conv->num_type <= SCANF_NUM_LLONG;
+
+  if (conv->num_type == SCANF_NUM_NONE || token->type != JSON_TYPE_NUMBER ||
+      json_parse_number(token->ptr, token->len, &num) != 0) {
+    return 0;
   }
+  if (conv->num_type < SCANF_NUM_FLOAT &&
+      !(num.flags & (is_signed ? JSON_NUMBER_INT64 : JSON_NUMBER_UINT64))) {
+    return 0;
+  }
+
+  switch (conv->num_type) {
+    case SCANF_NUM_INT:
+      *(int *) conv->target = (int) num.i;
+      break;
+    case SCANF_NUM_LONG:
+      *(long *) conv->target = (long) num.i;
+      break;
+    case SCANF_NUM_LLONG:
+      *(long long *) conv->target = (long long) num.i;
+      break;
+    case SCANF_NUM_UINT:
+      *(unsigned *) conv->target = (unsigned) num.u;
+      break;
+    case SCANF_NUM_ULONG:
+      *(unsigned long *) conv->target = (unsigned long) num.u;
+      break;
+    case SCANF_NUM_ULLONG:
+      *(unsigned long long *) conv->target = (unsigned long long) num.u;
+      break;
+    case SCANF_NUM_FLOAT:
+      *(float *) conv->target = (float) num.d;
+      break;
+    default:
+      *(double *) conv->target = num.d;
+      break;
+  }
+  return 1;
+}
+
+/* Conversion type of %.*Q, which is not a format character */
+#define SCANF_QUOTED_BUF 1
 
-  switch (info->type) {
+static char *json_scanf_alloc(struct json_scanf_info *info, size_t n) {
+  if (info->arena != NULL) return (char *) json_arena_alloc(info->arena, n);
+  return (char *) malloc(n);
+}
+
+/* Release memory from json_scanf_alloc(), unless it is in the arena */
+static void json_scanf_free(struct json_scanf_info *info, char *p) {
+  if (info->arena == NULL) free(p);
+}
+
+static void json_scanf_convert(struct json_scanf_info *info,
+                               const struct json_scanf_conv *conv,
+                               const struct json_token *token) {
+  char buf[32]; /* Must be enough to hold numbers */
+
+  switch (conv->type) {
     case 'B':
       info->num_conversions++;
-      *(bool *) info->target = (token->type == JSON_TYPE_TRUE ? true : false);
+      *(bool *) conv->target = (token->type == JSON_TYPE_TRUE ? true : false);
       break;
     case 'M': {
       union {
         void *p;
         json_scanner_t f;
-      } u = {info->target};
+      } u = {conv->target};
       info->num_conversions++;
-      u.f(token->ptr, token->len, info->user_data);
+      u.f(token->ptr, token->len, conv->user_data);
       break;
     }
     case 'Q': {
-      char **dst = (char **) info->target;
+      char **dst = (char **) conv->target;
       if (token->type == JSON_TYPE_NULL) {
         *dst = NULL;
       } else {
         int unescaped_len = json_unescape(token->ptr, token->len, NULL, 0);
         if (unescaped_len >= 0 &&
-            (*dst = (char *) malloc(unescaped_len + 1)) != NULL) {
+            (*dst = json_scanf_alloc(info, unescaped_len + 1)) != NULL) {
           info->num_conversions++;
           json_unescape(token->ptr, token->len, *dst, unescaped_len);
           (*dst)[unescaped_len] = '\0';
@@ -156,50 +281,165 @@ static void json_scanf_cb(void *callback_data, const char *name,
       }
       break;
     }
+    case SCANF_QUOTED_BUF: {
+      char *dst = (char *) conv->target;
+      int n;
+      if (conv->buf_size <= 0) break;
+      dst[0] = '\0';
+      if (token->type == JSON_TYPE_NULL) break;
+      n = json_unescape(token->ptr, token->len, dst, conv->buf_size - 1);
+      if (n >= 0 && n < conv->buf_size) {
+        dst[n] = '\0';
+        info->num_conversions++;
+      } else {
+        dst[n < 0 ? 0 : conv->buf_size - 1] = '\0';
+      }
+      break;
+    }
     case 'H': {
-      char **dst = (char **) info->user_data;
-      int i, len = token->len / 2;
-      *(int *) info->target = len;
-      if ((*dst = (char *) malloc(len + 1)) != NULL) {
-        for (i = 0; i < len; i++) {
-          (*dst)[i] = hexdec(token->ptr + 2 * i);
+      char **dst = (char **) conv->user_data;
+      int len = token->len / 2;
+      *(int *) conv->target = 0;
+      if ((*dst = json_scanf_alloc(info, len + 1)) != NULL) {
+        int n = json_hex_decode(token->ptr, token->len,
+                                (unsigned char *) *dst);
+        if (n < 0) {
+          json_scanf_free(info, *dst);
+          *dst = NULL;
+          break;
         }
-        (*dst)[len] = '\0';
+        (*dst)[n] = '\0';
+        *(int *) conv->target = n;
         info->num_conversions++;
       }
       break;
     }
     case 'V': {
-      char **dst = (char **) info->target;
-      int len = token->len * 4 / 3 + 2;
-      if ((*dst = (char *) malloc(len + 1)) != NULL) {
-        int n = b64dec(token->ptr, token->len, *dst);
+      char **dst = (char **) conv->target;
+      int len = JSON_BASE64_DEC_LEN(token->len);
+      *(int *) conv->user_data = 0;
+      if ((*dst = json_scanf_alloc(info, len + 1)) != NULL) {
+        int n = json_base64_decode(token->ptr, token->len,
+                                   (unsigned char *) *dst);
+        if (n < 0) {
+          json_scanf_free(info, *dst);
+          *dst = NULL;
+          break;
+        }
         (*dst)[n] = '\0';
-        *(int *) info->user_data = n;
+        *(int *) conv->user_data = n;
         info->num_conversions++;
       }
       break;
     }
     case 'T':
       info->num_conversions++;
-      *(struct json_token *) info->target = *token;
+      *(struct json_token *) conv->target = *token;
       break;
     default:
-      /* Before scanf, copy into tmp buffer in order to 0-terminate it */
-      if (token->len < (int) sizeof(buf)) {
+      if (json_scanf_number(conv, token)) {
+        info->num_conversions++;
+      } else if (token->len < (int) sizeof(buf)) {
+        /* Before scanf, copy into tmp buffer in order to 0-terminate it */
         memcpy(buf, token->ptr, token->len);
         buf[token->len] = '\0';
-        info->num_conversions += sscanf(buf, info->fmt, info->target);
+        info->num_conversions += sscanf(buf, conv->fmt, conv->target);
       }
       break;
   }
 }
 
-int json_vscanf(const char *s, int len, const char *fmt, va_list ap) {
-  char path[JSON_MAX_PATH_LEN] = "", fmtbuf[20];
-  int i = 0;
+/* Convert the value of the conversion `id`, unless it is already done */
+static int json_scanf_deliver(void *data, int id,
+                              const struct json_token *token) {
+  struct json_scanf_info *info = (struct json_scanf_info *) data;
+  struct json_scanf_conv *conv = &info->convs[id];
+  if (conv->found) return 0;
+  conv->found = 1;
+  json_scanf_convert(info, conv, token);
+  return 1;
+}
+
+/*
+ * Resolve the conversions of `info` registered in `trie` in a single pass
+ * over `s`. Paths are looked up one segment at a time, subtrees on none of
+ * them are skipped, and the walk stops once every path is found.
+ * Return 0 if out of memory.
+ */
+static int json_scanf_walk(struct json_scanf_info *info,
+                           const struct query_trie *trie, const char *s,
+                           int len) {
+  struct query_level *stack = info->stack_levels;
+
+  if (trie->num_entries == 0) return 1;
+  if (trie->max_depth >= JSON_SCANF_STACK_LEVELS) {
+    stack = (struct query_level *) json_scanf_alloc(
+        info, (trie->max_depth + 1) * sizeof(*stack));
+    if (stack == NULL) return 0;
+  }
+  query_walk(trie, stack, json_scanf_deliver, info, s, len);
+  if (stack != info->stack_levels) json_scanf_free(info, (char *) stack);
+  return 1;
+}
+
+/*
+ * Register the paths of the `num_convs` conversions `convs` in the empty
+ * `trie`, under their index. Return 0 if out of memory.
+ */
+static int json_scanf_add_paths(const struct json_scanf_conv *convs,
+                                int num_convs, struct query_trie *trie) {
+  int i;
+  for (i = 0; i < num_convs; i++) {
+    if (convs[i].skip) continue;
+    if (query_trie_add(trie, convs[i].path, i) != 0) return 0;
+  }
+  return 1;
+}
+
+/* Resolve the conversions of `info`, with a trie in `info` */
+static void json_scanf_run(struct json_scanf_info *info, const char *s,
+                           int len) {
+  struct query_trie *trie = &info->trie;
+  if (!query_trie_init(trie, info->stack_nodes, JSON_SCANF_STACK_NODES,
+                       info->stack_entries, JSON_SCANF_STACK_CONVS,
+                       info->arena)) {
+    return;
+  }
+  if (json_scanf_add_paths(info->convs, info->num_convs, trie)) {
+    json_scanf_walk(info, trie, s, len);
+  }
+  query_trie_free(trie);
+}
+
+/* Return the upper bound of the number of conversions in `fmt` */
+static int json_scanf_count(const char *fmt) {
+  int n = 0;
+  for (; *fmt != '\0'; fmt++) {
+    if (*fmt == '%') n++;
+  }
+  return n;
+}
+
+/* Return the size of the path pool needed for `max_convs` conversions */
+static size_t json_scanf_pool_size(const char *fmt, int max_convs) {
+  /* Every path is shorter than the format string, and than the path limit */
+  size_t fmt_len = strlen(fmt);
+  size_t path_len =
+      fmt_len < JSON_MAX_PATH_LEN ? fmt_len + 1 : JSON_MAX_PATH_LEN;
+  return max_convs * path_len;
+}
+
+/*
+ * Parse `fmt` into `convs`, with the paths stored in `pool`, without binding
+ * the conversions to arguments. Return the number of conversions.
+ */
+static int json_scanf_parse(const char *fmt, struct json_scanf_conv *convs,
+                            char *pool) {
+  char path[JSON_MAX_PATH_LEN] = "";
+  struct json_scanf_conv *conv;
   char *p = NULL;
-  struct json_scanf_info info = {0, path, fmtbuf, NULL, NULL, 0};
+  size_t path_len, pool_len = 0;
+  int i = 0, num_convs = 0;
 
   while (fmt[i] != '\0') {
     if (fmt[i] == '{') {
@@ -209,14 +449,24 @@ int json_vscanf(const char *s, int len, const char *fmt, va_list ap) {
       if ((p = strrchr(path, '.')) != NULL) *p = '\0';
       i++;
     } else if (fmt[i] == '%') {
-      info.target = va_arg(ap, void *);
-      info.type = fmt[i + 1];
-      switch (fmt[i + 1]) {
+      conv = &convs[num_convs++];
+      path_len = strlen(path) + 1;
+      conv->path = memcpy(pool + pool_len, path, path_len);
+      pool_len += path_len;
+      conv->target = conv->user_data = NULL;
+      conv->num_type = SCANF_NUM_NONE;
+      conv->buf_size = 0;
+      conv->type = fmt[i + 1];
+      if (strncmp(fmt + i, "%.*Q", 4) == 0) {
+        conv->type = SCANF_QUOTED_BUF;
+        i += 4;
+      }
+      switch (conv->type) {
+        case SCANF_QUOTED_BUF:
+          break;
         case 'M':
         case 'V':
         case 'H':
-          info.user_data = va_arg(ap, void *);
-        /* FALLTHROUGH */
         case 'B':
         case 'Q':
         case 'T':
@@ -225,26 +475,184 @@ int json_vscanf(const char *s, int len, const char *fmt, va_list ap) {
         default: {
           const char *delims = ", \t\r\n]}";
           int conv_len = strcspn(fmt + i + 1, delims) + 1;
-          snprintf(fmtbuf, sizeof(fmtbuf), "%.*s", conv_len, fmt + i);
+          snprintf(conv->fmt, sizeof(conv->fmt), "%.*s", conv_len, fmt + i);
+          conv->num_type = json_scanf_num_type(conv->fmt);
           i += conv_len;
-          i += strspn(fmt + i, delims);
+          /* A closing brace ends the object: leave it to pop the path */
+          i += strspn(fmt + i, ", \t\r\n]");
           break;
         }
       }
-      json_walk(s, len, json_scanf_cb, &info);
+      /* Keys with path delimiters cannot be matched */
+      conv->skip = query_path_depth(conv->path) < 0;
     } else if (is_alpha(fmt[i]) || get_utf8_char_len(fmt[i]) > 1) {
       const char *delims = ": \r\n\t";
       int key_len = strcspn(&fmt[i], delims);
+      size_t n;
       if ((p = strrchr(path, '.')) != NULL) p[1] = '\0';
-      sprintf(path + strlen(path), "%.*s", key_len, &fmt[i]);
+      n = strlen(path);
+      snprintf(path + n, sizeof(path) - n, "%.*s", key_len, &fmt[i]);
       i += key_len + strspn(fmt + i + key_len, delims);
     } else {
       i++;
     }
   }
+
+  return num_convs;
+}
+
+/* Bind the `num_convs` conversions of `info` to the arguments `ap` */
+static void json_scanf_bind(struct json_scanf_info *info, int num_convs,
+                            va_list ap) {
+  int i;
+
+  info->num_convs = num_convs;
+  for (i = 0; i < num_convs; i++) {
+    struct json_scanf_conv *conv = &info->convs[i];
+    if (conv->type == SCANF_QUOTED_BUF) {
+      /* The size comes first, as for printf's %.*s */
+      conv->buf_size = va_arg(ap, int);
+    }
+    conv->target = va_arg(ap, void *);
+    if (conv->type == 'M' || conv->type == 'V' || conv->type == 'H') {
+      conv->user_data = va_arg(ap, void *);
+    }
+    conv->found = 0;
+  }
+}
+
+/*
+ * Make room in `info` for `max_convs` conversions followed by `extra` bytes,
+ * in `arena` if it is not NULL. Return 0 if out of memory.
+ */
+static int json_scanf_info_init(struct json_scanf_info *info, int max_convs,
+                                size_t extra, struct json_arena *arena) {
+  info->arena = arena;
+  info->num_conversions = info->num_convs = 0;
+  info->convs = info->stack_convs;
+  if (max_convs > JSON_SCANF_STACK_CONVS ||
+      extra > sizeof(info->stack_pool)) {
+    info->convs = (struct json_scanf_conv *) json_scanf_alloc(
+        info, max_convs * sizeof(*info->convs) + extra);
+    if (info->convs == NULL) return 0;
+  }
+  return 1;
+}
+
+/*
+ * Collect (path, type, target) triplets for all conversions of `fmt` into
+ * `info`, which allocates from `arena` if it is not NULL. Return 0 if out of
+ * memory. Release with json_scanf_info_free().
+ */
+static int json_scanf_collect(struct json_scanf_info *info, const char *fmt,
+                              struct json_arena *arena, va_list ap) {
+  int max_convs = json_scanf_count(fmt);
+  size_t pool_size = json_scanf_pool_size(fmt, max_convs);
+  char *pool;
+
+  if (!json_scanf_info_init(info, max_convs, pool_size, arena)) return 0;
+  pool = info->convs == info->stack_convs
+             ? info->stack_pool
+             : (char *) (info->convs + max_convs);
+  json_scanf_bind(info, json_scanf_parse(fmt, info->convs, pool), ap);
+  return 1;
+}
+
+static void json_scanf_info_free(struct json_scanf_info *info) {
+  if (info->convs != info->stack_convs) {
+    json_scanf_free(info, (char *) info->convs);
+  }
+}
+
+/* Format string parsed by json_scanf_compile() */
+struct json_scanf_plan {
+  int num_convs;
+  struct json_scanf_conv *convs; /* Followed by the path pool */
+  struct query_trie trie;        /* Paths of the conversions */
+};
+
+struct json_scanf_plan *json_scanf_compile(const char *fmt) {
+  int max_convs = json_scanf_count(fmt);
+  size_t size = sizeof(struct json_scanf_plan) +
+                max_convs * sizeof(struct json_scanf_conv) +
+                json_scanf_pool_size(fmt, max_convs);
+  struct json_scanf_plan *plan = (struct json_scanf_plan *) malloc(size);
+
+  if (plan == NULL) return NULL;
+  plan->convs = (struct json_scanf_conv *) (plan + 1);
+  plan->num_convs = json_scanf_parse(fmt, plan->convs,
+                                     (char *) (plan->convs + max_convs));
+  if (!query_trie_init(&plan->trie, NULL, 0, NULL, 0, NULL)) {
+    free(plan);
+    return NULL;
+  }
+  if (!json_scanf_add_paths(plan->convs, plan->num_convs, &plan->trie)) {
+    json_scanf_plan_free(plan);
+    return NULL;
+  }
+  return plan;
+}
+
+void json_scanf_plan_free(struct json_scanf_plan *plan) {
+  if (plan == NULL) return;
+  query_trie_free(&plan->trie);
+  free(plan);
+}
+
+int json_vscanf_exec(const struct json_scanf_plan *plan, const char *s,
+                     int len, struct json_arena *arena, va_list ap) {
+  struct json_scanf_info info;
+
+  /*
+   * The plan is shared: bind the arguments to a copy of its conversions, and
+   * walk its trie as it is
+   */
+  if (!json_scanf_info_init(&info, plan->num_convs, 0, arena)) return 0;
+  memcpy(info.convs, plan->convs, plan->num_convs * sizeof(*info.convs));
+  json_scanf_bind(&info, plan->num_convs, ap);
+
+  json_scanf_walk(&info, &plan->trie, s, len);
+
+  json_scanf_info_free(&info);
+  return info.num_conversions;
+}
+
+int json_scanf_exec(const struct json_scanf_plan *plan, const char *s, int len,
+                    struct json_arena *arena, ...) {
+  int result;
+  va_list ap;
+  va_start(ap, arena);
+  result = json_vscanf_exec(plan, s, len, arena, ap);
+  va_end(ap);
+  return result;
+}
+
+int json_vscanf_arena(const char *s, int len, struct json_arena *arena,
+                      const char *fmt, va_list ap) {
+  struct json_scanf_info info;
+
+  if (!json_scanf_collect(&info, fmt, arena, ap)) return 0;
+
+  json_scanf_run(&info, s, len);
+
+  json_scanf_info_free(&info);
   return info.num_conversions;
 }
 
+int json_vscanf(const char *s, int len, const char *fmt, va_list ap) {
+  return json_vscanf_arena(s, len, NULL, fmt, ap);
+}
+
+int json_scanf_arena(const char *str, int len, struct json_arena *arena,
+                     const char *fmt, ...) {
+  int result;
+  va_list ap;
+  va_start(ap, fmt);
+  result = json_vscanf_arena(str, len, arena, fmt, ap);
+  va_end(ap);
+  return result;
+}
+
 int json_scanf(const char *str, int len, const char *fmt, ...) {
   int result;
   va_list ap;
@@ -253,3 +661,35 @@ int json_scanf(const char *str, int len, const char *fmt, ...) {
   va_end(ap);
   return result;
 }
+
+int json_tape_vscanf(const char *s, const struct json_tape_token *tape, int n,
+                     const char *fmt, va_list ap) {
+  struct json_scanf_info info;
+  int i, j;
+
+  if (!json_scanf_collect(&info, fmt, NULL, ap)) return 0;
+
+  for (i = 0; i < info.num_convs; i++) {
+    if (info.convs[i].skip) continue;
+    if ((j = json_tape_find(s, tape, n, info.convs[i].path)) >= 0) {
+      struct json_token token;
+      token.ptr = s + tape[j].offset;
+      token.len = tape[j].len;
+      token.type = (enum json_token_type) tape[j].type;
+      json_scanf_convert(&info, &info.convs[i], &token);
+    }
+  }
+
+  json_scanf_info_free(&info);
+  return info.num_conversions;
+}
+
+int json_tape_scanf(const char *s, const struct json_tape_token *tape, int n,
+                    const char *fmt, ...) {
+  int result;
+  va_list ap;
+  va_start(ap, fmt);
+  result = json_tape_vscanf(s, tape, n, fmt, ap);
+  va_end(ap);
+  return result;
+}
@@ -22,42 +22,47 @@
 #include "util.h"
 
 struct json_setf_data {
-  const char *json_path;
+  struct json_path matcher;
   const char *base; /* Pointer to the source JSON string */
   int matched;      /* Matched part of json_path */
   int pos;          /* Offset of the mutated value begin */
   int end;          /* Offset of the mutated value end */
   int prev;         /* Offset of the previous token end */
+  int found;        /* Non-0 if json_path is matched exactly */
 };
 
-static int get_matched_prefix_len(const char *s1, const char *s2) {
-  int i = 0;
-  while (s1[i] && s2[i] && s1[i] == s2[i]) i++;
-  return i;
-}
-
-static void json_vsetf_cb(void *userdata, const char *name, size_t name_len,
-                          const char *path, const struct json_token *t) {
+static int json_vsetf_cb(void *userdata, const char *name, size_t name_len,
+                         const char *path, const struct json_token *t) {
   struct json_setf_data *data = (struct json_setf_data *) userdata;
-  int off, len = get_matched_prefix_len(path, data->json_path);
-  if (t->ptr == NULL) return;
+  int off, res = json_path_match(&data->matcher, name, name_len, t);
+  (void) path;
+
+  if (t->ptr == NULL) {
+    /* Missing keys are added after the segments matched so far */
+    if (res == JSON_PATH_PREFIX && data->matcher.seg + 1 > data->matched) {
+      data->matched = data->matcher.seg + 1;
+    }
+    return JSON_WALK_CONTINUE;
+  }
   off = t->ptr - data->base;
-  if (len > data->matched) data->matched = len;
 
   /*
-   * If there is no exact path match, set the mutation position to tbe end
-   * of the object or array
+   * If there is no exact path match, set the mutation position to the end
+   * of the innermost object or array on the path, or right after its opening
+   * bracket if it is empty
    */
-  if (len < data->matched && data->pos == 0 &&
+  if (res == JSON_PATH_PREFIX && data->pos == 0 &&
       (t->type == JSON_TYPE_OBJECT_END || t->type == JSON_TYPE_ARRAY_END)) {
+    if (data->prev <= off) data->prev = off + 1;
     data->pos = data->end = data->prev;
   }
 
   /* Exact path match. Set mutation position to the value of this token */
-  if (strcmp(path, data->json_path) == 0 && t->type != JSON_TYPE_OBJECT_START &&
-      t->type != JSON_TYPE_ARRAY_START) {
+  if (res == JSON_PATH_MATCH) {
+    data->matched = strlen(data->matcher.path);
     data->pos = off;
     data->end = off + t->len;
+    data->found = 1;
   }
 
   /*
@@ -74,18 +79,27 @@ static void json_vsetf_cb(void *userdata, const char *name, size_t name_len,
              off + 1 > data->prev) {
     data->prev = off + 1;
   }
-  (void) name;
-  (void) name_len;
+
+  /*
+   * Nothing after the end of the object/array that holds the matched value
+   * can change the mutation position, so stop there.
+   */
+  if (data->found && off < data->pos &&
+      (t->type == JSON_TYPE_OBJECT_END || t->type == JSON_TYPE_ARRAY_END)) {
+    return JSON_WALK_STOP;
+  }
+  return JSON_WALK_CONTINUE;
 }
 
 int json_vsetf(const char *s, int len, struct json_out *out,
                const char *json_path, const char *json_fmt, va_list ap) {
   struct json_setf_data data;
   memset(&data, 0, sizeof(data));
-  data.json_path = json_path;
   data.base = s;
   data.end = len;
-  json_walk(s, len, json_vsetf_cb, &data);
+  if (json_path_compile(&data.matcher, json_path) == 0) {
+    json_walk_ex(s, len, json_vsetf_cb, &data, JSON_WALK_NO_PATH);
+  }
   if (json_fmt == NULL) {
     /* Deletion codepath */
     json_printf(out, "%.*s", data.prev, s);
@@ -109,7 +123,7 @@ int json_vsetf(const char *s, int len, struct json_out *out,
         json_printf(out, ",");
       }
       if (off > 0 && json_path[off - 1] != '.') break;
-      json_printf(out, "%.*Q:", 1, json_path + off);
+      json_printf(out, "%.*Q:", n, json_path + off);
       off += n;
       if (json_path[off] != '\0') {
         json_printf(out, "%c", json_path[off] == '.' ? '{' : '[');
@@ -142,3 +156,55 @@ int json_setf(const char *s, int len, struct json_out *out,
   va_end(ap);
   return result;
 }
+
+int json_tape_vsetf(const char *s, int len, const struct json_tape_token *tape,
+                    int n, struct json_out *out, const char *json_path,
+                    const char *json_fmt, va_list ap) {
+  int i = json_tape_find(s, tape, n, json_path), parent, prev = -1, j;
+  int pos, end;
+
+  /* Adding missing keys needs the whole json_setf() machinery */
+  if (i <= 0) return json_vsetf(s, len, out, json_path, json_fmt, ap);
+
+  pos = tape[i].offset;
+  end = pos + tape[i].len;
+  if (tape[i].type == JSON_TYPE_STRING) pos--, end++; /* Quotes */
+
+  if (json_fmt != NULL) {
+    json_printf(out, "%.*s", pos, s);
+    json_vprintf(out, json_fmt, ap);
+    json_printf(out, "%.*s", len - end, s + end);
+    return 1;
+  }
+
+  /* Delete everything from the end of the previous entry to the value end */
+  parent = tape[i].parent;
+  for (j = json_tape_next(tape, n, parent, -1); j >= 0 && j != i;
+       j = json_tape_next(tape, n, parent, j)) {
+    prev = j;
+  }
+  if (prev >= 0) {
+    pos = tape[prev].offset + tape[prev].len;
+    if (tape[prev].type == JSON_TYPE_STRING) pos++;
+  } else {
+    /* Trim comma after the value that begins at object/array start */
+    pos = tape[parent].offset + 1;
+    j = end;
+    while (j < len && is_space(s[j])) j++;
+    if (j < len && s[j] == ',') end = j + 1; /* Point after comma */
+  }
+  json_printf(out, "%.*s", pos, s);
+  json_printf(out, "%.*s", len - end, s + end);
+  return 1;
+}
+
+int json_tape_setf(const char *s, int len, const struct json_tape_token *tape,
+                   int n, struct json_out *out, const char *json_path,
+                   const char *json_fmt, ...) {
+  int result;
+  va_list ap;
+  va_start(ap, json_fmt);
+  result = json_tape_vsetf(s, len, tape, n, out, json_path, json_fmt, ap);
+  va_end(ap);
+  return result;
+}
@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2004-2013 Sergey Lyubka <valenok@gmail.com>
+ * Copyright (c) 2013 Cesanta Software Limited
+ * Copyright (c) 2020 Julian Smythe <sausage@tehsausage.com>
+ * All rights reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef ELSA_SIMD_H_
+#define ELSA_SIMD_H_
+
+#include <stdint.h>
+#include <string.h>
+#include "util.h"
+
+/*
+ * Vectorised scanning primitives. AVX2 or SSE2 is used when the compiler
+ * targets it, otherwise a portable scalar implementation. Define
+ * JSON_DISABLE_SIMD to force the scalar implementation.
+ */
+#if !defined(JSON_DISABLE_SIMD) && defined(__AVX2__)
+#define JSON_SIMD_AVX2
+#include <immintrin.h>
+#elif !defined(JSON_DISABLE_SIMD) &&                  \
+    (defined(__SSE2__) || defined(_M_X64) ||          \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define JSON_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+/* Size of the blocks classified by classify_block() */
+#define JSON_BLOCK_SIZE 64
+
+/* Bitmasks of the characters of a block, bit N describes byte N */
+struct block_masks {
+  uint64_t quote;     /* '"' */
+  uint64_t backslash; /* '\\' */
+  uint64_t open;      /* '{' and '[' */
+  uint64_t close;     /* '}' and ']' */
+  uint64_t space;     /* ' ', '\t', '\n' and '\r' */
+};
+
+static int ctz64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(x);
+#else
+  int n = 0;
+  while ((x & 1) == 0) x >>= 1, n++;
+  return n;
+#endif
+}
+
+static int popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcountll(x);
+#else
+  int n = 0;
+  for (; x != 0; x &= x - 1) n++;
+  return n;
+#endif
+}
+
+#if defined(JSON_SIMD_AVX2)
+static uint64_t eq_mask32(__m256i v, char ch) {
+  return (uint32_t) _mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(v, _mm256_set1_epi8(ch)));
+}
+#elif defined(JSON_SIMD_SSE2)
+static uint64_t eq_mask16(__m128i v, char ch) {
+  return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(ch)));
+}
+#endif
+
+/* Return the mask of whitespace among the 16 bytes at `p` */
+static unsigned space_mask16(const char *p) {
+#if defined(JSON_SIMD_AVX2) || defined(JSON_SIMD_SSE2)
+  __m128i v = _mm_loadu_si128((const __m128i *) p);
+  __m128i sp = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                            _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+  __m128i tr = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')),
+                            _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+  return (unsigned) _mm_movemask_epi8(_mm_or_si128(sp, tr));
+#else
+  unsigned mask = 0;
+  int i;
+  for (i = 0; i < 16; i++) {
+    if (is_space(p[i])) mask |= 1U << i;
+  }
+  return mask;
+#endif
+}
+
+/* Classify JSON_BLOCK_SIZE bytes at `p` */
+static void classify_block(const char *p, struct block_masks *m) {
+  int i;
+  memset(m, 0, sizeof(*m));
+#if defined(JSON_SIMD_AVX2)
+  for (i = 0; i < JSON_BLOCK_SIZE; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+    /* '[' | 0x20 == '{', ']' | 0x20 == '}' */
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    m->quote |= eq_mask32(v, '"') << i;
+    m->backslash |= eq_mask32(v, '\\') << i;
+    m->open |= eq_mask32(lower, '{') << i;
+    m->close |= eq_mask32(lower, '}') << i;
+    m->space |= (eq_mask32(v, ' ') | eq_mask32(v, '\n') | eq_mask32(v, '\t') |
+                 eq_mask32(v, '\r'))
+                << i;
+  }
+#elif defined(JSON_SIMD_SSE2)
+  for (i = 0; i < JSON_BLOCK_SIZE; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+    /* '[' | 0x20 == '{', ']' | 0x20 == '}' */
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    m->quote |= eq_mask16(v, '"') << i;
+    m->backslash |= eq_mask16(v, '\\') << i;
+    m->open |= eq_mask16(lower, '{') << i;
+    m->close |= eq_mask16(lower, '}') << i;
+    m->space |= (uint64_t) space_mask16(p + i) << i;
+  }
+#else
+  for (i = 0; i < JSON_BLOCK_SIZE; i++) {
+    uint64_t bit = (uint64_t) 1 << i;
+    switch (p[i]) {
+      case '"':
+        m->quote |= bit;
+        break;
+      case '\\':
+        m->backslash |= bit;
+        break;
+      case '{':
+      case '[':
+        m->open |= bit;
+        break;
+      case '}':
+      case ']':
+        m->close |= bit;
+        break;
+      case ' ':
+      case '\t':
+      case '\n':
+      case '\r':
+        m->space |= bit;
+        break;
+    }
+  }
+#endif
+}
+
+/*
+ * Return the mask of characters escaped by a backslash. `carry` is non-0 if
+ * the first character of the block is escaped by the previous block; it is
+ * updated for the next block.
+ */
+static uint64_t find_escaped(uint64_t backslash, uint64_t *carry) {
+  const uint64_t last = (uint64_t) 1 << (JSON_BLOCK_SIZE - 1);
+  uint64_t escaped = *carry, bit;
+  backslash &= ~escaped;
+  *carry = 0;
+  while (backslash != 0) {
+    bit = backslash & (0 - backslash);
+    if (bit == last) *carry = 1;
+    escaped |= bit << 1;
+    backslash &= ~(bit | bit << 1);
+  }
+  return escaped;
+}
+
+/* Return the mask with bit N set if an odd number of bits 0..N are set */
+static uint64_t prefix_xor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+/*
+ * Stage-1 structural index of a JSON string, built one block at a time:
+ * bitmasks of the unescaped quotes, and of the brackets and whitespace that
+ * are outside of string literals. A block may start anywhere outside of a
+ * string literal, see index_next_token().
+ */
+struct json_index {
+  const char *cur;          /* Start of the current block */
+  const char *end;          /* End of the JSON string */
+  uint64_t in_string;       /* Bytes inside of string literals */
+  uint64_t escaped_carry;   /* First byte of the next block is escaped */
+  uint64_t in_string_carry; /* Next block starts inside of a string literal */
+  struct block_masks m;
+};
+
+static void index_init(struct json_index *ix, const char *s,
+                       const char *end) {
+  memset(ix, 0, sizeof(*ix));
+  ix->cur = s;
+  ix->end = end;
+}
+
+/*
+ * Classify the block at `ix->cur`, and compute which of its bytes are inside
+ * of strings. Masks of bytes inside of strings are cleared.
+ * Return 0 if there is no data left.
+ */
+static int index_block(struct json_index *ix) {
+  uint64_t escaped, quote;
+  size_t left = ix->end - ix->cur;
+
+  if (ix->cur >= ix->end) return 0;
+  if (left >= JSON_BLOCK_SIZE) {
+    classify_block(ix->cur, &ix->m);
+  } else {
+    /* Pad the tail with spaces */
+    char buf[JSON_BLOCK_SIZE];
+    memset(buf, ' ', sizeof(buf));
+    memcpy(buf, ix->cur, left);
+    classify_block(buf, &ix->m);
+  }
+
+  escaped = find_escaped(ix->m.backslash, &ix->escaped_carry);
+  quote = ix->m.quote & ~escaped;
+  ix->in_string = prefix_xor(quote) ^ ix->in_string_carry;
+  ix->in_string_carry = 0 - (ix->in_string >> (JSON_BLOCK_SIZE - 1));
+  ix->m.quote = quote;
+  ix->m.open &= ~ix->in_string;
+  ix->m.close &= ~ix->in_string;
+  ix->m.space &= ~ix->in_string;
+  return 1;
+}
+
+/* Return the mask of the bytes of a block at offset `off` or after it */
+static uint64_t block_mask_from(size_t off) {
+  return off >= JSON_BLOCK_SIZE ? 0 : ~(uint64_t) 0 << off;
+}
+
+/*
+ * Make the block of `ix` hold `p`, which must be outside of string literals:
+ * if it does not, the index is started again at `p`, up to `end`. An index
+ * initialised with a NULL string has no block yet.
+ */
+static void index_seek(struct json_index *ix, const char *p,
+                       const char *end) {
+  if (ix->cur == NULL || (size_t) (p - ix->cur) >= JSON_BLOCK_SIZE) {
+    index_init(ix, p, end);
+    index_block(ix);
+  }
+}
+
+/*
+ * Return the first byte at or after `p` that is not whitespace, or `end`.
+ * `p` must be outside of string literals. Whitespace in the block of `ix` is
+ * skipped with its mask; a block is only classified for a run that goes on
+ * past it, as that costs more than looking at a few bytes.
+ */
+static const char *index_next_token(struct json_index *ix, const char *p,
+                                    const char *end) {
+  uint64_t tokens;
+  int i;
+
+  /* Most tokens follow each other */
+  if (p >= end || !is_space(*p)) return p;
+
+  if (ix->cur == NULL || (size_t) (p - ix->cur) >= JSON_BLOCK_SIZE) {
+    /* Most whitespace runs are short */
+    for (i = 0; i < 8; i++, p++) {
+      if (p >= end || !is_space(*p)) return p;
+    }
+  }
+
+  while (p < end) {
+    index_seek(ix, p, end);
+    tokens = ~ix->m.space & block_mask_from(p - ix->cur);
+    if (tokens != 0) return ix->cur + ctz64(tokens);
+    p = ix->cur + JSON_BLOCK_SIZE;
+  }
+  return end;
+}
+
+/*
+ * Skip the object or array that starts at `s`, in the block of `ix`, by
+ * matching brackets, without validating its content. `ix` is left on the
+ * block of its end. Return the length of the object or array, or
+ * JSON_STRING_INCOMPLETE if it is not closed before the end of the string.
+ */
+static int index_skip_container(struct json_index *ix, const char *s) {
+  uint64_t from = block_mask_from(s - ix->cur);
+  int depth = 0;
+
+  do {
+    uint64_t open = ix->m.open & from, close = ix->m.close & from;
+    from = ~(uint64_t) 0;
+    /* The container can only end in this block if enough brackets close */
+    if (popcount64(close) < depth) {
+      depth += popcount64(open) - popcount64(close);
+      continue;
+    }
+    while ((open | close) != 0) {
+      int i = ctz64(open | close);
+      uint64_t bit = (uint64_t) 1 << i;
+      if (open & bit) {
+        depth++;
+        open &= ~bit;
+      } else {
+        close &= ~bit;
+        if (--depth == 0) return ix->cur - s + i + 1;
+      }
+    }
+  } while ((ix->cur += JSON_BLOCK_SIZE, index_block(ix)));
+
+  return JSON_STRING_INCOMPLETE;
+}
+
+/*
+ * Skip the object or array that starts at `s` by matching brackets, without
+ * validating its content. Return the length of the object or array, or
+ * JSON_STRING_INCOMPLETE if it is not closed before `end`.
+ */
+static int skip_container(const char *s, const char *end) {
+  struct json_index ix;
+  index_init(&ix, s, end);
+  if (!index_block(&ix)) return JSON_STRING_INCOMPLETE;
+  return index_skip_container(&ix, s);
+}
+
+/* Return the first non-whitespace character at or after `p` */
+static const char *skip_spaces(const char *p, const char *end) {
+  unsigned non_space;
+  int i;
+
+  /* Most whitespace runs are short, only vectorise the long ones */
+  for (i = 0; i < 8; i++, p++) {
+    if (p >= end || !is_space(*p)) return p;
+  }
+
+  for (; p + 16 <= end; p += 16) {
+    if ((non_space = ~space_mask16(p) & 0xffff) != 0) {
+      return p + ctz64(non_space);
+    }
+  }
+  while (p < end && is_space(*p)) p++;
+  return p;
+}
+
+/*
+ * Return the first character at or after `p` that needs a closer look inside
+ * of a string literal: a quote, a backslash, a control character or a
+ * non-ASCII byte.
+ */
+static const char *skip_plain_chars(const char *p, const char *end) {
+#if defined(JSON_SIMD_AVX2)
+  for (; p + 32 <= end; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    /* Signed compare, so bytes >= 0x80 are not plain either */
+    __m256i plain = _mm256_andnot_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))),
+        _mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x1f)));
+    uint32_t special = ~(uint32_t) _mm256_movemask_epi8(plain);
+    if (special != 0) return p + ctz64(special);
+  }
+#endif
+#if defined(JSON_SIMD_AVX2) || defined(JSON_SIMD_SSE2)
+  for (; p + 16 <= end; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    __m128i plain = _mm_andnot_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+        _mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)));
+    unsigned special = ~(unsigned) _mm_movemask_epi8(plain) & 0xffff;
+    if (special != 0) return p + ctz64(special);
+  }
+#endif
+  for (; p < end; p++) {
+    unsigned char ch = *(const unsigned char *) p;
+    if (ch < 0x20 || ch >= 0x80 || ch == '"' || ch == '\\') break;
+  }
+  return p;
+}
+
+/*
+ * Return the first character at or after `p` that `json_escape()` does not
+ * print as is: a quote, a backslash, a control character or DEL. Bytes of
+ * multi-byte UTF-8 sequences are printed as is.
+ */
+static const char *skip_unescaped_chars(const char *p, const char *end) {
+#if defined(JSON_SIMD_AVX2)
+  for (; p + 32 <= end; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    /* Unsigned v <= 0x1f, as min(v, 0x1f) == v */
+    __m256i ctl =
+        _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(0x1f)), v);
+    __m256i special = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))),
+        _mm256_or_si256(ctl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f))));
+    uint32_t mask = (uint32_t) _mm256_movemask_epi8(special);
+    if (mask != 0) return p + ctz64(mask);
+  }
+#endif
+#if defined(JSON_SIMD_AVX2) || defined(JSON_SIMD_SSE2)
+  for (; p + 16 <= end; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1f)), v);
+    __m128i special = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+        _mm_or_si128(ctl, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f))));
+    unsigned mask = (unsigned) _mm_movemask_epi8(special);
+    if (mask != 0) return p + ctz64(mask);
+  }
+#endif
+  for (; p < end; p++) {
+    unsigned char ch = *(const unsigned char *) p;
+    if (ch < 0x20 || ch == 0x7f || ch == '"' || ch == '\\') break;
+  }
+  return p;
+}
+
+#endif /* ELSA_SIMD_H_ */
@@ -0,0 +1,438 @@
+/*
+ * Copyright (c) 2004-2013 Sergey Lyubka <valenok@gmail.com>
+ * Copyright (c) 2013 Cesanta Software Limited
+ * Copyright (c) 2020 Julian Smythe <sausage@tehsausage.com>
+ * All rights reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "elsa.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "simd.h"
+#include "util.h"
+
+/*
+ * Parser states. The grammar is the one of json_walk(): commas between
+ * entries are optional, and a trailing comma is allowed.
+ */
+enum stream_state {
+  STREAM_VALUE = 0, /* Root: before the value */
+  STREAM_DONE,      /* Root: after the value */
+  STREAM_OBJ_KEY,   /* After '{' or ',': a key or '}' */
+  STREAM_OBJ_NEXT,  /* After a value: ',', a key or '}' */
+  STREAM_OBJ_COLON, /* After a key */
+  STREAM_OBJ_VALUE, /* After ':' */
+  STREAM_ARR_VALUE, /* After '[' or ',': a value or ']' */
+  STREAM_ARR_NEXT   /* After a value: ',', a value or ']' */
+};
+
+/* Tokens that may span several chunks */
+enum stream_token {
+  STREAM_TOK_NONE = 0,
+  STREAM_TOK_KEY,   /* Quoted key */
+  STREAM_TOK_IDENT, /* Unquoted key */
+  STREAM_TOK_STRING,
+  STREAM_TOK_NUMBER,
+  STREAM_TOK_TRUE,
+  STREAM_TOK_FALSE,
+  STREAM_TOK_NULL
+};
+
+/* Lexer states inside of a number */
+enum stream_number_state {
+  STREAM_NUM_START = 0,
+  STREAM_NUM_MINUS,    /* After '-' */
+  STREAM_NUM_INT,      /* In the integer part */
+  STREAM_NUM_DOT,      /* After '.' */
+  STREAM_NUM_FRAC,     /* In the fraction */
+  STREAM_NUM_EXP_MARK, /* After 'e' or 'E' */
+  STREAM_NUM_EXP_SIGN, /* After the sign of the exponent */
+  STREAM_NUM_EXP       /* In the exponent */
+};
+
+/* Lexer states inside of a string, greater values count hex digits left */
+#define STREAM_STR_PLAIN 0
+#define STREAM_STR_ESCAPE 1
+
+static int *stream_state(struct json_stream *st) {
+  return st->depth == 0 ? &st->state : &st->stack[st->depth - 1].state;
+}
+
+static size_t stream_append_path(struct json_stream *st, const char *str,
+                                 int size) {
+  size_t n = st->path_len;
+  int left = sizeof(st->path) - n - 1;
+  if (size > left) size = left;
+  memcpy(st->path + n, str, size);
+  st->path[n + size] = '\0';
+  st->path_len += size;
+  return n;
+}
+
+static void stream_truncate_path(struct json_stream *st, size_t len) {
+  st->path_len = len;
+  st->path[len] = '\0';
+}
+
+/* Report a value, unless it is hidden behind a key, like json_walk() does */
+static void stream_call_back(struct json_stream *st,
+                             enum json_token_type type, const char *ptr,
+                             int len) {
+  if (st->callback != NULL &&
+      !(st->path_len > 0 && st->path[st->path_len - 1] == '.')) {
+    struct json_token t = {ptr, len, type};
+    const char *name =
+        st->name_len < 0 ? NULL
+                         : st->name_off < 0 ? st->name : st->path + st->name_off;
+    st->callback(st->callback_data, name, st->name_len < 0 ? 0 : st->name_len,
+                 st->path, &t);
+  }
+  st->name_len = -1;
+}
+
+/* A value ending at offset `end` is parsed */
+static void stream_value_done(struct json_stream *st, int end) {
+  struct json_stream_level *lv;
+  if (st->depth == 0) {
+    st->state = STREAM_DONE;
+    st->result = end;
+    return;
+  }
+  lv = &st->stack[st->depth - 1];
+  stream_truncate_path(st, lv->base_len);
+  lv->state = lv->state == STREAM_OBJ_VALUE ? STREAM_OBJ_NEXT : STREAM_ARR_NEXT;
+}
+
+/* Start a value with character `ch` at offset `off` */
+static int stream_value(struct json_stream *st, int ch, int off) {
+  struct json_stream_level *lv;
+  int state = *stream_state(st);
+
+  if (state == STREAM_ARR_VALUE || state == STREAM_ARR_NEXT) {
+    char buf[20];
+    int n;
+    lv = &st->stack[st->depth - 1];
+    n = snprintf(buf, sizeof(buf), "[%d]", lv->count++);
+    stream_append_path(st, buf, n);
+    st->name_off = st->path_len - n + 1 /*opening brace*/;
+    st->name_len = n - 2 /*braces*/;
+  }
+
+  switch (ch) {
+    case '{':
+    case '[':
+      stream_call_back(st, ch == '{' ? JSON_TYPE_OBJECT_START
+                                     : JSON_TYPE_ARRAY_START,
+                       NULL, 0);
+      if (st->depth >= st->max_depth) return JSON_DEPTH_EXCEEDED;
+      lv = &st->stack[st->depth++];
+      lv->start = off;
+      lv->path_len = st->path_len;
+      lv->count = 0;
+      lv->state = ch == '{' ? STREAM_OBJ_KEY : STREAM_ARR_VALUE;
+      if (ch == '{') stream_append_path(st, ".", 1);
+      lv->base_len = st->path_len;
+      return 1;
+    case '"':
+      st->tok = STREAM_TOK_STRING;
+      return 1;
+    case 't':
+      st->tok = STREAM_TOK_TRUE;
+      return 0;
+    case 'f':
+      st->tok = STREAM_TOK_FALSE;
+      return 0;
+    case 'n':
+      st->tok = STREAM_TOK_NULL;
+      return 0;
+    default:
+      if (ch != '-' && !is_digit(ch)) return JSON_STRING_INVALID;
+      st->tok = STREAM_TOK_NUMBER;
+      return 0;
+  }
+}
+
+/* Close the innermost object or array with the bracket at offset `off` */
+static void stream_close(struct json_stream *st, int off) {
+  struct json_stream_level *lv = &st->stack[--st->depth];
+  stream_truncate_path(st, lv->path_len);
+  stream_call_back(st,
+                   lv->state == STREAM_ARR_VALUE || lv->state == STREAM_ARR_NEXT
+                       ? JSON_TYPE_ARRAY_END
+                       : JSON_TYPE_OBJECT_END,
+                   NULL, off + 1 - lv->start);
+  stream_value_done(st, off + 1);
+}
+
+/*
+ * Handle the non-whitespace character `ch` at offset `off`, outside of a
+ * token. Return the number of bytes consumed: 1, or 0 if `ch` starts a token
+ * that the lexer has to look at. Return a negative error code on failure.
+ */
+static int stream_char(struct json_stream *st, int ch, int off) {
+  int *state = stream_state(st);
+
+  switch (*state) {
+    case STREAM_OBJ_KEY:
+    case STREAM_OBJ_NEXT:
+      if (ch == '}') {
+        stream_close(st, off);
+      } else if (ch == ',' && *state == STREAM_OBJ_NEXT) {
+        *state = STREAM_OBJ_KEY;
+      } else if (ch == '"') {
+        st->tok = STREAM_TOK_KEY;
+      } else if (is_alpha(ch)) {
+        st->tok = STREAM_TOK_IDENT;
+        return 0;
+      } else {
+        return JSON_STRING_INVALID;
+      }
+      return 1;
+    case STREAM_OBJ_COLON:
+      if (ch != ':') return JSON_STRING_INVALID;
+      *state = STREAM_OBJ_VALUE;
+      return 1;
+    case STREAM_ARR_VALUE:
+    case STREAM_ARR_NEXT:
+      if (ch == ']') {
+        stream_close(st, off);
+        return 1;
+      } else if (ch == ',' && *state == STREAM_ARR_NEXT) {
+        *state = STREAM_ARR_VALUE;
+        return 1;
+      }
+      return stream_value(st, ch, off);
+    default:
+      return stream_value(st, ch, off);
+  }
+}
+
+/*
+ * Continue lexing the current token from `*p`. Return 1 if it ends before
+ * `end`, with `*p` set to its end (the closing quote of strings), 0 if more
+ * input is needed, or a negative error code.
+ */
+static int stream_lex(struct json_stream *st, const char **p,
+                      const char *end) {
+  static const char *const words[] = {"true", "false", "null"};
+  const char *s = *p;
+  int ch;
+
+  switch (st->tok) {
+    case STREAM_TOK_KEY:
+    case STREAM_TOK_STRING:
+      while (s < end) {
+        if (st->tok_skip > 0) {
+          /* Rest of a multi-byte UTF-8 character */
+          int n = end - s < st->tok_skip ? end - s : st->tok_skip;
+          s += n;
+          st->tok_skip -= n;
+          continue;
+        }
+        ch = *(const unsigned char *) s;
+        if (st->tok_state == STREAM_STR_ESCAPE) {
+          if (ch == 'u') {
+            st->tok_state = STREAM_STR_ESCAPE + 4;
+          } else if (ch != '\0' && strchr("\"\\/bfnrt", ch) != NULL) {
+            st->tok_state = STREAM_STR_PLAIN;
+          } else {
+            return JSON_STRING_INVALID;
+          }
+          s++;
+          continue;
+        } else if (st->tok_state > STREAM_STR_ESCAPE) {
+          if (!is_hex_digit(ch)) return JSON_STRING_INVALID;
+          if (--st->tok_state == STREAM_STR_ESCAPE) {
+            st->tok_state = STREAM_STR_PLAIN;
+          }
+          s++;
+          continue;
+        }
+        /* Printable ASCII other than quotes and backslashes needs no checks */
+        if ((s = skip_plain_chars(s, end)) >= end) break;
+        ch = *(const unsigned char *) s;
+        if (ch == '"') {
+          *p = s;
+          return 1;
+        } else if (ch == '\\') {
+          st->tok_state = STREAM_STR_ESCAPE;
+        } else if (ch < 32) {
+          return JSON_STRING_INVALID; /* No control chars */
+        } else {
+          st->tok_skip = get_utf8_char_len((unsigned char) ch) - 1;
+        }
+        s++;
+      }
+      break;
+    case STREAM_TOK_IDENT:
+      while (s < end && (*s == '_' || is_alpha(*s) || is_digit(*s))) s++;
+      *p = s;
+      return s < end;
+    case STREAM_TOK_NUMBER:
+      for (; s < end; s++) {
+        ch = *s;
+        switch (st->tok_state) {
+          case STREAM_NUM_START:
+            st->tok_state = ch == '-' ? STREAM_NUM_MINUS : STREAM_NUM_INT;
+            continue;
+          case STREAM_NUM_MINUS:
+          case STREAM_NUM_DOT:
+          case STREAM_NUM_EXP_SIGN:
+            if (!is_digit(ch)) return JSON_STRING_INVALID;
+            st->tok_state++;
+            continue;
+          case STREAM_NUM_EXP_MARK:
+            if (ch == '+' || ch == '-') {
+              st->tok_state = STREAM_NUM_EXP_SIGN;
+            } else if (is_digit(ch)) {
+              st->tok_state = STREAM_NUM_EXP;
+            } else {
+              return JSON_STRING_INVALID;
+            }
+            continue;
+          default:
+            if (is_digit(ch)) continue;
+            if (ch == '.' && st->tok_state == STREAM_NUM_INT) {
+              st->tok_state = STREAM_NUM_DOT;
+              continue;
+            }
+            if ((ch == 'e' || ch == 'E') && st->tok_state != STREAM_NUM_EXP) {
+              st->tok_state = STREAM_NUM_EXP_MARK;
+              continue;
+            }
+            *p = s;
+            return 1;
+        }
+      }
+      break;
+    default: {
+      const char *word = words[st->tok - STREAM_TOK_TRUE];
+      for (; s < end && word[st->tok_state] != '\0'; s++, st->tok_state++) {
+        if (*s != word[st->tok_state]) return JSON_STRING_INVALID;
+      }
+      *p = s;
+      return word[st->tok_state] == '\0';
+    }
+  }
+
+  *p = end;
+  return 0;
+}
+
+/* Append the part of a token held by the current chunk to the buffer */
+static int stream_buffer(struct json_stream *st, const char *p,
+                         const char *end) {
+  int n = end - p;
+  if (n > (int) sizeof(st->buf) - st->buf_len) return JSON_TOKEN_TOO_LONG;
+  memcpy(st->buf + st->buf_len, p, n);
+  st->buf_len += n;
+  return 0;
+}
+
+/* The current token is complete, and ends at offset `end` */
+static int stream_token(struct json_stream *st, const char *ptr, int len,
+                        int end) {
+  static const enum json_token_type types[] = {
+      JSON_TYPE_STRING, JSON_TYPE_NUMBER, JSON_TYPE_TRUE, JSON_TYPE_FALSE,
+      JSON_TYPE_NULL};
+  int tok = st->tok;
+
+  st->tok = STREAM_TOK_NONE;
+  st->tok_state = 0;
+  st->buf_len = 0;
+
+  if (tok == STREAM_TOK_KEY || tok == STREAM_TOK_IDENT) {
+    /* Keep the key as the name of the value, which may come in a later chunk */
+    if (len > (int) sizeof(st->name)) return JSON_TOKEN_TOO_LONG;
+    memcpy(st->name, ptr, len);
+    st->name_len = len;
+    st->name_off = -1;
+    stream_append_path(st, ptr, len);
+    *stream_state(st) = STREAM_OBJ_COLON;
+  } else {
+    stream_call_back(st, types[tok - STREAM_TOK_STRING], ptr, len);
+    stream_value_done(st, end);
+  }
+  return 0;
+}
+
+void json_stream_init(struct json_stream *st, json_walk_callback_t callback,
+                      void *callback_data) {
+  memset(st, 0, sizeof(*st));
+  st->callback = callback;
+  st->callback_data = callback_data;
+  st->name_len = -1;
+  st->max_depth = JSON_MAX_DEPTH;
+}
+
+void json_stream_set_max_depth(struct json_stream *st, int max_depth) {
+  st->max_depth = depth_limit(max_depth);
+}
+
+int json_stream_feed(struct json_stream *st, const char *s, int len) {
+  const char *p = s, *end = s + len;
+  const char *tok_start = NULL; /* Start of a token begun in this chunk */
+  int n = 0;
+
+  if (st->result < 0) return st->result;
+
+  while (p < end && st->state != STREAM_DONE) {
+    if (st->tok != STREAM_TOK_NONE) {
+      const char *q = p;
+      /* Strings end with the closing quote, which is not part of the token */
+      int str = st->tok == STREAM_TOK_KEY || st->tok == STREAM_TOK_STRING;
+      if ((n = stream_lex(st, &q, end)) < 0) break;
+      if (n == 0) {
+        /* Hold on to the part seen so far until the next chunk */
+        if ((n = stream_buffer(st, tok_start ? tok_start : p, end)) < 0) break;
+        p = end;
+      } else if (tok_start != NULL) {
+        /* The whole token is in this chunk */
+        n = stream_token(st, tok_start, q - tok_start,
+                         st->offset + (q - s) + str);
+        if (n < 0) break;
+        p = q + str;
+      } else {
+        if ((n = stream_buffer(st, p, q)) < 0) break;
+        n = stream_token(st, st->buf, st->buf_len, st->offset + (q - s) + str);
+        if (n < 0) break;
+        p = q + str;
+      }
+      tok_start = NULL;
+    } else if (is_space(*p)) {
+      p = skip_spaces(p, end);
+    } else {
+      if ((n = stream_char(st, *(const unsigned char *) p,
+                           st->offset + (p - s))) < 0) {
+        break;
+      }
+      p += n;
+      if (st->tok != STREAM_TOK_NONE) tok_start = p;
+    }
+  }
+
+  if (n < 0) return st->result = n;
+  st->offset += p - s;
+  return p - s;
+}
+
+int json_stream_finish(struct json_stream *st) {
+  /* Only numbers wait for the character that follows them */
+  if (st->result == 0 && st->depth == 0 && st->tok == STREAM_TOK_NUMBER &&
+      (st->tok_state == STREAM_NUM_INT || st->tok_state == STREAM_NUM_FRAC ||
+       st->tok_state == STREAM_NUM_EXP)) {
+    stream_token(st, st->buf, st->buf_len, st->offset);
+  }
+  return st->result != 0 ? st->result : JSON_STRING_INCOMPLETE;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2004-2013 Sergey Lyubka <valenok@gmail.com>
+ * Copyright (c) 2013 Cesanta Software Limited
+ * Copyright (c) 2020 Julian Smythe <sausage@tehsausage.com>
+ * All rights reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "elsa.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+
+struct tape_data {
+  const char *base;                /* Pointer to the source JSON string */
+  struct json_tape_token *tokens;  /* Tape being filled */
+  int max_tokens;                  /* Capacity of the tape */
+  int num_tokens;                  /* Number of tokens seen so far */
+  int cur;                         /* Innermost open object or array */
+  int overflow_depth;              /* Open objects and arrays not stored */
+};
+
+static int json_tokenize_cb(void *userdata, const char *name, size_t name_len,
+                            const char *path, const struct json_token *t) {
+  struct tape_data *data = (struct tape_data *) userdata;
+  struct json_tape_token *tok;
+  (void) path;
+
+  switch (t->type) {
+    case JSON_TYPE_OBJECT_END:
+    case JSON_TYPE_ARRAY_END:
+      if (data->overflow_depth > 0) {
+        data->overflow_depth--;
+        break;
+      }
+      /* Now that it is closed, the extent of the object or array is known */
+      tok = &data->tokens[data->cur];
+      tok->offset = t->ptr - data->base;
+      tok->len = t->len;
+      tok->next = data->num_tokens;
+      data->cur = tok->parent;
+      break;
+    default:
+      if (data->num_tokens < data->max_tokens) {
+        tok = &data->tokens[data->num_tokens];
+        tok->type = t->type;
+        tok->offset = t->ptr == NULL ? -1 : t->ptr - data->base;
+        tok->len = t->len;
+        tok->key_offset = name == NULL ? -1 : name - data->base;
+        tok->key_len = name == NULL ? 0 : (int) name_len;
+        tok->parent = data->cur;
+        tok->next = data->num_tokens + 1;
+        if (t->type == JSON_TYPE_OBJECT_START) {
+          tok->type = JSON_TYPE_OBJECT_END;
+          data->cur = data->num_tokens;
+        } else if (t->type == JSON_TYPE_ARRAY_START) {
+          tok->type = JSON_TYPE_ARRAY_END;
+          data->cur = data->num_tokens;
+        }
+      } else if (t->type == JSON_TYPE_OBJECT_START ||
+                 t->type == JSON_TYPE_ARRAY_START) {
+        data->overflow_depth++;
+      }
+      data->num_tokens++;
+      break;
+  }
+
+  return JSON_WALK_CONTINUE;
+}
+
+int json_tokenize(const char *s, int len, struct json_tape_token *tokens,
+                  int max_tokens) {
+  struct tape_data data;
+  int n;
+
+  memset(&data, 0, sizeof(data));
+  data.base = s;
+  data.tokens = tokens;
+  data.max_tokens = tokens == NULL ? 0 : max_tokens;
+  data.cur = -1;
+  n = json_walk_ex(s, len, json_tokenize_cb, &data, JSON_WALK_NO_PATH);
+
+  return n < 0 ? n : data.num_tokens;
+}
+
+int json_tape_next(const struct json_tape_token *tape, int n, int parent,
+                   int i) {
+  int j = i < 0 ? parent + 1 : tape[i].next;
+  return parent >= 0 && parent < n && j < tape[parent].next && j < n ? j : -1;
+}
+
+int json_tape_find(const char *s, const struct json_tape_token *tape, int n,
+                   const char *path) {
+  int i = 0, j;
+
+  if (n <= 0) return -1;
+
+  /* Descend one segment at a time, hopping over siblings */
+  while (*path != '\0') {
+    int idx, seg_len = parse_path_segment(path, &idx);
+    if (seg_len < 0 || (*path == '[' && idx < 0) ||
+        tape[i].type != (*path == '[' ? JSON_TYPE_ARRAY_END
+                                      : JSON_TYPE_OBJECT_END)) {
+      return -1;
+    }
+    for (j = json_tape_next(tape, n, i, -1); j >= 0;
+         j = json_tape_next(tape, n, i, j)) {
+      if (*path == '[' ? idx-- == 0
+                   : tape[j].key_len == seg_len - 1 &&
+                         memcmp(s + tape[j].key_offset, path + 1,
+                                seg_len - 1) == 0) {
+        break;
+      }
+    }
+    if (j < 0) return -1;
+    i = j;
+    path += seg_len;
+  }
+
+  return i;
+}
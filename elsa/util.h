@@ -19,6 +19,8 @@
 #define ELSA_UTIL_H_
 
 #include "elsa.h"
+#include <stdlib.h>
+#include <string.h>
 
 static int is_space(int ch) {
   return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
@@ -47,7 +49,12 @@ static int to_lower(int ch) {
     return ch;
 }
 
+/*
+ * Return the length of the escape sequence after a backslash at `s - 1`, with
+ * `len` bytes left from the backslash.
+ */
 static int get_escape_len(const char *s, int len) {
+  if (len < 2) return JSON_STRING_INCOMPLETE;
   switch (*s) {
     case 'u':
       return len < 6 ? JSON_STRING_INCOMPLETE
@@ -63,7 +70,7 @@ static int get_escape_len(const char *s, int len) {
     case 'n':
     case 'r':
     case 't':
-      return len < 2 ? JSON_STRING_INCOMPLETE : 1;
+      return 1;
     default:
       return JSON_STRING_INVALID;
   }
@@ -81,4 +88,33 @@ static int get_utf8_char_len(unsigned char ch) {
   }
 }
 
+/*
+ * Parse the segment of a path at `s`: an object key like ".a", or an array
+ * index like "[3]" or "[]". Store the index, or -1 for a key or "[]", in
+ * `index`. Return the length of the segment, 0 at the end of the path, or
+ * JSON_STRING_INVALID.
+ */
+static int parse_path_segment(const char *s, int *index) {
+  int n = 1;
+  *index = -1;
+  switch (*s) {
+    case '\0':
+      return 0;
+    case '.':
+      return 1 + (int) strcspn(s + 1, ".[");
+    case '[':
+      while (is_digit(s[n])) n++;
+      if (s[n] != ']') return JSON_STRING_INVALID;
+      if (n > 1) *index = atoi(s + 1);
+      return n + 1;
+    default:
+      return JSON_STRING_INVALID;
+  }
+}
+
+/* Return the nesting limit `n`, or JSON_MAX_DEPTH if `n` is out of range */
+static int depth_limit(int n) {
+  return n > 0 && n < JSON_MAX_DEPTH ? n : JSON_MAX_DEPTH;
+}
+
 #endif /* ELSA_UTIL_H_ */
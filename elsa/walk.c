@@ -19,8 +19,17 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include "simd.h"
 #include "util.h"
 
+/* An object or array being parsed */
+struct walk_level {
+  const char *ptr; /* Opening bracket */
+  int path_len;    /* Path length of the object or array */
+  int base_len;    /* Path length of its entries, without their own segment */
+  int count;       /* Number of entries seen so far */
+};
+
 struct walk_ctx {
   const char *end;
   const char *cur;
@@ -33,6 +42,18 @@ struct walk_ctx {
   size_t path_len;
   void *callback_data;
   json_walk_callback_t callback;
+  json_walk_ex_callback_t callback_ex;
+  int action; /* Action returned by the last callback_ex invocation */
+  int flags;  /* JSON_WALK_* flags */
+  int in_key; /* Parsing an object key */
+
+  /* Open objects and arrays, innermost last */
+  int depth;
+  int max_depth; /* Nesting limit, at most JSON_MAX_DEPTH */
+  struct walk_level stack[JSON_MAX_DEPTH];
+
+  /* Structural index of the block where the last token was looked for */
+  struct json_index ix;
 };
 
 struct fstate {
@@ -44,25 +65,50 @@ struct fstate {
   struct fstate fstate = {(ptr), (ctx)->path_len}; \
   append_to_path((ctx), (str), (len));
 
-#define CALL_BACK(ctx, tok, value, len)                                       \
+/* Returned by the parsing functions when a callback asks to stop */
+#define WALK_STOPPED (-100)
+
+#define NO_PATH(ctx) ((ctx)->flags & JSON_WALK_NO_PATH)
+
+/* Keys are not reported. With a path, they are recognised by a trailing '.' */
+#define IS_KEY(ctx)                                           \
+  (NO_PATH(ctx) ? (ctx)->in_key                               \
+                : (ctx)->path_len > 0 &&                      \
+                      (ctx)->path[(ctx)->path_len - 1] == '.')
+
+#define CALL_BACK_TOKEN(ctx, t)                                               \
   do {                                                                        \
-    if ((ctx)->callback &&                                                    \
-        ((ctx)->path_len == 0 || (ctx)->path[(ctx)->path_len - 1] != '.')) {  \
-      struct json_token t = {(value), (len), (tok)};                          \
+    if (((ctx)->callback || (ctx)->callback_ex) && !IS_KEY(ctx)) {            \
+      const char *_path = NO_PATH(ctx) ? NULL : (ctx)->path;                  \
                                                                               \
       /* Call the callback with the given value and current name */           \
-      (ctx)->callback((ctx)->callback_data, (ctx)->cur_name,                  \
-                      (ctx)->cur_name_len, (ctx)->path, &t);                  \
+      if ((ctx)->callback_ex != NULL) {                                       \
+        (ctx)->action = (ctx)->callback_ex((ctx)->callback_data,              \
+                                           (ctx)->cur_name,                   \
+                                           (ctx)->cur_name_len, _path, (t));  \
+      } else {                                                                \
+        (ctx)->callback((ctx)->callback_data, (ctx)->cur_name,                \
+                        (ctx)->cur_name_len, _path, (t));                     \
+      }                                                                       \
                                                                               \
       /* Reset the name */                                                    \
       (ctx)->cur_name = NULL;                                                 \
       (ctx)->cur_name_len = 0;                                                \
+                                                                              \
+      if ((ctx)->action == JSON_WALK_STOP) return WALK_STOPPED;               \
     }                                                                         \
   } while (0)
 
+#define CALL_BACK(ctx, tok, value, len)            \
+  do {                                             \
+    struct json_token t = {(value), (len), (tok)}; \
+    CALL_BACK_TOKEN(ctx, &t);                      \
+  } while (0)
+
 static int append_to_path(struct walk_ctx *ctx, const char *str, int size) {
   int n = ctx->path_len;
   int left = sizeof(ctx->path) - n - 1;
+  if (NO_PATH(ctx)) return n;
   if (size > left) size = left;
   memcpy(ctx->path + n, str, size);
   ctx->path[n + size] = '\0';
@@ -71,13 +117,11 @@ static int append_to_path(struct walk_ctx *ctx, const char *str, int size) {
 }
 
 static void truncate_path(struct walk_ctx *ctx, size_t len) {
+  if (NO_PATH(ctx)) return;
   ctx->path_len = len;
   ctx->path[len] = '\0';
 }
 
-static int parse_object(struct walk_ctx *ctx);
-static int parse_value(struct walk_ctx *ctx);
-
 #define EXPECT(cond, err_code)      \
   do {                              \
     if (!(cond)) return (err_code); \
@@ -95,8 +139,9 @@ static int left(const struct walk_ctx *ctx) {
   return ctx->end - ctx->cur;
 }
 
+/* Move to the start of the next token, as found by the structural index */
 static void skip_whitespaces(struct walk_ctx *ctx) {
-  while (ctx->cur < ctx->end && is_space(*ctx->cur)) ctx->cur++;
+  ctx->cur = index_next_token(&ctx->ix, ctx->cur, ctx->end);
 }
 
 static int cur(struct walk_ctx *ctx) {
@@ -113,6 +158,22 @@ static int test_and_skip(struct walk_ctx *ctx, int expected) {
   return ch == END_OF_STRING ? JSON_STRING_INCOMPLETE : JSON_STRING_INVALID;
 }
 
+/*
+ * If the callback asked to skip the object or array that is about to be
+ * parsed, skip it without parsing its content. Return 1 if skipped, 0 if not,
+ * or a negative error code.
+ */
+static int skip_subtree(struct walk_ctx *ctx) {
+  int n;
+  if (ctx->action != JSON_WALK_SKIP_SUBTREE) return 0;
+  ctx->action = JSON_WALK_CONTINUE;
+  skip_whitespaces(ctx);
+  index_seek(&ctx->ix, ctx->cur, ctx->end);
+  if ((n = index_skip_container(&ctx->ix, ctx->cur)) < 0) return n;
+  ctx->cur += n;
+  return 1;
+}
+
 /* identifier = letter { letter | digit | '_' } */
 static int parse_identifier(struct walk_ctx *ctx) {
   EXPECT(is_alpha(cur(ctx)), JSON_STRING_INVALID);
@@ -135,6 +196,9 @@ static int parse_string(struct walk_ctx *ctx) {
   {
     SET_STATE(ctx, ctx->cur, "", 0);
     for (; ctx->cur < ctx->end; ctx->cur += len) {
+      /* Printable ASCII other than quotes and backslashes needs no checks */
+      ctx->cur = skip_plain_chars(ctx->cur, ctx->end);
+      if (ctx->cur >= ctx->end) break;
       ch = *(unsigned char *) ctx->cur;
       len = get_utf8_char_len((unsigned char) ch);
       EXPECT(ch >= 32 && len > 0, JSON_STRING_INVALID); /* No control chars */
@@ -144,8 +208,9 @@ static int parse_string(struct walk_ctx *ctx) {
         len += n;
       } else if (ch == '"') {
         truncate_path(ctx, fstate.path_len);
-        CALL_BACK(ctx, JSON_TYPE_STRING, fstate.ptr, ctx->cur - fstate.ptr);
         ctx->cur++;
+        CALL_BACK(ctx, JSON_TYPE_STRING, fstate.ptr,
+                  ctx->cur - fstate.ptr - 1);
         break;
       };
     }
@@ -176,34 +241,15 @@ static int parse_number(struct walk_ctx *ctx) {
     while (ctx->cur < ctx->end && is_digit(ctx->cur[0])) ctx->cur++;
   }
   truncate_path(ctx, fstate.path_len);
-  CALL_BACK(ctx, JSON_TYPE_NUMBER, fstate.ptr, ctx->cur - fstate.ptr);
-  return 0;
-}
-
-/* array = '[' [ value { ',' value } ] ']' */
-static int parse_array(struct walk_ctx *ctx) {
-  int i = 0, current_path_len;
-  char buf[20];
-  CALL_BACK(ctx, JSON_TYPE_ARRAY_START, NULL, 0);
-  TRY(test_and_skip(ctx, '['));
-  {
-    {
-      SET_STATE(ctx, ctx->cur - 1, "", 0);
-      while (cur(ctx) != ']') {
-        snprintf(buf, sizeof(buf), "[%d]", i);
-        i++;
-        current_path_len = append_to_path(ctx, buf, strlen(buf));
-        ctx->cur_name =
-            ctx->path + strlen(ctx->path) - strlen(buf) + 1 /*opening brace*/;
-        ctx->cur_name_len = strlen(buf) - 2 /*braces*/;
-        TRY(parse_value(ctx));
-        truncate_path(ctx, current_path_len);
-        if (cur(ctx) == ',') ctx->cur++;
-      }
-      TRY(test_and_skip(ctx, ']'));
-      truncate_path(ctx, fstate.path_len);
-      CALL_BACK(ctx, JSON_TYPE_ARRAY_END, fstate.ptr, ctx->cur - fstate.ptr);
-    }
+  if (ctx->flags & JSON_WALK_NUMBERS) {
+    struct json_number_token t;
+    t.token.ptr = fstate.ptr;
+    t.token.len = ctx->cur - fstate.ptr;
+    t.token.type = JSON_TYPE_NUMBER;
+    json_parse_number(t.token.ptr, t.token.len, &t.num);
+    CALL_BACK_TOKEN(ctx, &t.token);
+  } else {
+    CALL_BACK(ctx, JSON_TYPE_NUMBER, fstate.ptr, ctx->cur - fstate.ptr);
   }
   return 0;
 }
@@ -224,29 +270,52 @@ static int expect(struct walk_ctx *ctx, const char *s, int len,
   return 0;
 }
 
-/* value = 'null' | 'true' | 'false' | number | string | array | object */
+/* Format the path segment of array entry `i`, e.g. "[12]". Return its length */
+static int format_index(char *buf, int i) {
+  char digits[12];
+  int n = 0, len = 0;
+  do {
+    digits[n++] = '0' + i % 10;
+    i /= 10;
+  } while (i > 0);
+  buf[len++] = '[';
+  while (n > 0) buf[len++] = digits[--n];
+  buf[len++] = ']';
+  return len;
+}
+
+/*
+ * value = 'null' | 'true' | 'false' | number | string | array | object
+ *
+ * Objects and arrays are not parsed here: their opening bracket is consumed,
+ * and they are pushed to the stack for walk() to parse their entries.
+ */
 static int parse_value(struct walk_ctx *ctx) {
-  int ch = cur(ctx);
+  struct walk_level *lv;
+  int ch = cur(ctx), n;
 
   switch (ch) {
     case '"':
-      TRY(parse_string(ctx));
-      break;
+      return parse_string(ctx);
     case '{':
-      TRY(parse_object(ctx));
-      break;
     case '[':
-      TRY(parse_array(ctx));
-      break;
+      CALL_BACK(ctx, ch == '{' ? JSON_TYPE_OBJECT_START : JSON_TYPE_ARRAY_START,
+                NULL, 0);
+      if ((n = skip_subtree(ctx)) != 0) return n < 0 ? n : 0;
+      EXPECT(ctx->depth < ctx->max_depth, JSON_DEPTH_EXCEEDED);
+      lv = &ctx->stack[ctx->depth++];
+      lv->ptr = ctx->cur++;
+      lv->path_len = ctx->path_len;
+      lv->count = 0;
+      if (ch == '{') append_to_path(ctx, ".", 1);
+      lv->base_len = ctx->path_len;
+      return 0;
     case 'n':
-      TRY(expect(ctx, "null", 4, JSON_TYPE_NULL));
-      break;
+      return expect(ctx, "null", 4, JSON_TYPE_NULL);
     case 't':
-      TRY(expect(ctx, "true", 4, JSON_TYPE_TRUE));
-      break;
+      return expect(ctx, "true", 4, JSON_TYPE_TRUE);
     case 'f':
-      TRY(expect(ctx, "false", 5, JSON_TYPE_FALSE));
-      break;
+      return expect(ctx, "false", 5, JSON_TYPE_FALSE);
     case '-':
     case '0':
     case '1':
@@ -258,13 +327,10 @@ static int parse_value(struct walk_ctx *ctx) {
     case '7':
     case '8':
     case '9':
-      TRY(parse_number(ctx));
-      break;
+      return parse_number(ctx);
     default:
       return ch == END_OF_STRING ? JSON_STRING_INCOMPLETE : JSON_STRING_INVALID;
   }
-
-  return 0;
 }
 
 /* key = identifier | string */
@@ -280,58 +346,134 @@ static int parse_key(struct walk_ctx *ctx) {
   return 0;
 }
 
-/* pair = key ':' value */
-static int parse_pair(struct walk_ctx *ctx) {
-  int current_path_len;
+/* pair = key ':' value. Parse the key and the colon, and name the value */
+static int parse_pair_key(struct walk_ctx *ctx) {
   const char *tok;
   skip_whitespaces(ctx);
   tok = ctx->cur;
+  ctx->in_key = 1;
   TRY(parse_key(ctx));
-  {
-    ctx->cur_name = *tok == '"' ? tok + 1 : tok;
-    ctx->cur_name_len = *tok == '"' ? ctx->cur - tok - 2 : ctx->cur - tok;
-    current_path_len = append_to_path(ctx, ctx->cur_name, ctx->cur_name_len);
-  }
-  TRY(test_and_skip(ctx, ':'));
-  TRY(parse_value(ctx));
-  truncate_path(ctx, current_path_len);
-  return 0;
+  ctx->in_key = 0;
+  ctx->cur_name = *tok == '"' ? tok + 1 : tok;
+  ctx->cur_name_len = *tok == '"' ? ctx->cur - tok - 2 : ctx->cur - tok;
+  append_to_path(ctx, ctx->cur_name, ctx->cur_name_len);
+  return test_and_skip(ctx, ':');
 }
 
-/* object = '{' pair { ',' pair } '}' */
-static int parse_object(struct walk_ctx *ctx) {
-  CALL_BACK(ctx, JSON_TYPE_OBJECT_START, NULL, 0);
-  TRY(test_and_skip(ctx, '{'));
-  {
-    SET_STATE(ctx, ctx->cur - 1, ".", 1);
-    while (cur(ctx) != '}') {
-      TRY(parse_pair(ctx));
+/*
+ * Parse a value, and the content of the objects and arrays it holds. Instead
+ * of recursing, the open objects and arrays are kept on ctx->stack.
+ *
+ * The parser moves from token to token with the structural index of simd.h:
+ * the next token, a value, a key, ':', ',' or a closing bracket, is the
+ * first byte the index does not mark as whitespace, and skipped subtrees end
+ * at the bracket the index matches. A block is only indexed where a
+ * whitespace run is longer than a few bytes or a subtree is skipped, so
+ * compact JSON does not pay for it. Tokens themselves are validated byte by
+ * byte, with string contents scanned by skip_plain_chars(), so errors are
+ * reported at the same byte as without the index.
+ *
+ * object = '{' pair { ',' pair } '}'
+ * array = '[' [ value { ',' value } ] ']'
+ */
+static int walk(struct walk_ctx *ctx) {
+  struct walk_level *lv;
+  int depth, n, ch;
+
+  TRY(parse_value(ctx));
+
+  while (ctx->depth > 0) {
+    lv = &ctx->stack[ctx->depth - 1];
+    ch = cur(ctx);
+
+    if (ch == (*lv->ptr == '{' ? '}' : ']')) {
+      ctx->cur++;
+      truncate_path(ctx, lv->path_len);
+      ctx->depth--;
+      CALL_BACK(ctx,
+                ch == '}' ? JSON_TYPE_OBJECT_END : JSON_TYPE_ARRAY_END,
+                lv->ptr, ctx->cur - lv->ptr);
+    } else {
+      if (*lv->ptr == '{') {
+        TRY(parse_pair_key(ctx));
+      } else if (NO_PATH(ctx)) {
+        ctx->cur_name = NULL;
+        ctx->cur_name_len = 0;
+      } else {
+        char buf[20];
+        n = format_index(buf, lv->count);
+        append_to_path(ctx, buf, n);
+        ctx->cur_name = ctx->path + ctx->path_len - n + 1 /*opening brace*/;
+        ctx->cur_name_len = n - 2 /*braces*/;
+      }
+      lv->count++;
+      depth = ctx->depth;
+      TRY(parse_value(ctx));
+      /* Entries of a nested object or array come first */
+      if (ctx->depth > depth) continue;
+    }
+
+    /* An entry of the object or array on top of the stack is parsed */
+    if (ctx->depth > 0) {
+      truncate_path(ctx, ctx->stack[ctx->depth - 1].base_len);
       if (cur(ctx) == ',') ctx->cur++;
     }
-    TRY(test_and_skip(ctx, '}'));
-    truncate_path(ctx, fstate.path_len);
-    CALL_BACK(ctx, JSON_TYPE_OBJECT_END, fstate.ptr, ctx->cur - fstate.ptr);
   }
+
   return 0;
 }
 
 static int doit(struct walk_ctx *ctx) {
   if (ctx->cur == 0 || ctx->end < ctx->cur) return JSON_STRING_INVALID;
   if (ctx->end == ctx->cur) return JSON_STRING_INCOMPLETE;
-  return parse_value(ctx);
+  return walk(ctx);
+}
+
+/* Initialise the context, without clearing the path and the stack */
+static void walk_init(struct walk_ctx *ctx, const char *s, int len,
+                      void *callback_data, int flags) {
+  ctx->end = s + len;
+  ctx->cur = s;
+  ctx->cur_name = NULL;
+  ctx->cur_name_len = 0;
+  ctx->path[0] = '\0';
+  ctx->path_len = 0;
+  ctx->callback_data = callback_data;
+  ctx->callback = NULL;
+  ctx->callback_ex = NULL;
+  ctx->action = JSON_WALK_CONTINUE;
+  ctx->flags = flags;
+  ctx->in_key = 0;
+  ctx->depth = 0;
+  ctx->max_depth = depth_limit(flags >> JSON_WALK_DEPTH_SHIFT);
+  index_init(&ctx->ix, NULL, ctx->end);
 }
 
 int json_walk(const char *json_string, int json_string_length,
               json_walk_callback_t callback, void *callback_data) {
   struct walk_ctx ctx;
 
-  memset(&ctx, 0, sizeof(ctx));
-  ctx.end = json_string + json_string_length;
-  ctx.cur = json_string;
-  ctx.callback_data = callback_data;
+  /* Nobody is going to look at the path */
+  walk_init(&ctx, json_string, json_string_length, callback_data,
+            callback == NULL ? JSON_WALK_NO_PATH : 0);
   ctx.callback = callback;
 
   TRY(doit(&ctx));
 
   return ctx.cur - json_string;
 }
+
+int json_walk_ex(const char *json_string, int json_string_length,
+                 json_walk_ex_callback_t callback, void *callback_data,
+                 int flags) {
+  struct walk_ctx ctx;
+  int n;
+
+  walk_init(&ctx, json_string, json_string_length, callback_data, flags);
+  ctx.callback_ex = callback;
+
+  n = doit(&ctx);
+  if (n < 0 && n != WALK_STOPPED) return n;
+
+  return ctx.cur - json_string;
+}
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2004-2013 Sergey Lyubka <valenok@gmail.com>
+ * Copyright (c) 2013 Cesanta Software Limited
+ * Copyright (c) 2020 Julian Smythe <sausage@tehsausage.com>
+ * All rights reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "elsa.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "util.h"
+
+/* Room for a comma, the deepest indentation, and a number */
+#define WRITER_BUF_SIZE (2 * JSON_MAX_DEPTH + JSON_NUMBER_BUF_SIZE + 8)
+
+/* Non-0 if the innermost open object or array is an object */
+static int writer_in_object(const struct json_writer *w) {
+  int d = w->depth - 1;
+  return w->depth > 0 && (w->objects[d / 8] >> (d % 8)) & 1;
+}
+
+/* Record error `err`, and return it */
+static int writer_fail(struct json_writer *w, int err) {
+  if (w->error == 0) w->error = err;
+  return w->error;
+}
+
+/*
+ * Check that a value, or a key if `is_key`, may be written next, and write
+ * what precedes it into `buf`: the comma, and in pretty mode the line break
+ * and the indentation. Return the number of bytes written into `buf`, or a
+ * negative error code.
+ */
+static int writer_prefix(struct json_writer *w, int is_key, char *buf) {
+  int n = 0;
+
+  if (w->error != 0) return w->error;
+  if (is_key ? !writer_in_object(w) || w->after_key
+             : writer_in_object(w) != w->after_key) {
+    return writer_fail(w, JSON_STRING_INVALID);
+  }
+  if (w->after_key) {
+    /* The value of a key follows it on the same line */
+    w->after_key = 0;
+    return 0;
+  }
+  if (w->depth == 0 && w->count > 0) {
+    /* There is a single root value */
+    return writer_fail(w, JSON_STRING_INVALID);
+  }
+
+  if (w->count > 0) buf[n++] = ',';
+  if ((w->flags & JSON_WRITER_PRETTY) && w->depth > 0) {
+    buf[n++] = '\n';
+    memset(buf + n, ' ', 2 * w->depth);
+    n += 2 * w->depth;
+  }
+  w->count++;
+  return n;
+}
+
+/* Print the `n` bytes at `buf`, which hold a whole value, and its prefix */
+static int writer_print(struct json_writer *w, const char *buf, int n) {
+  w->len += n;
+  w->out->printer(w->out, buf, n);
+  return n;
+}
+
+void json_writer_init(struct json_writer *w, struct json_out *out,
+                      int flags) {
+  memset(w, 0, sizeof(*w));
+  w->out = out;
+  w->flags = flags;
+  w->max_depth = depth_limit(flags >> JSON_WALK_DEPTH_SHIFT);
+}
+
+/* Open an object if `is_object`, otherwise an array */
+static int writer_begin(struct json_writer *w, int is_object) {
+  char buf[WRITER_BUF_SIZE];
+  int n = writer_prefix(w, 0, buf), d = w->depth;
+
+  if (n < 0) return n;
+  if (d >= w->max_depth) return writer_fail(w, JSON_DEPTH_EXCEEDED);
+  if (is_object) {
+    w->objects[d / 8] |= (unsigned char) (1 << (d % 8));
+  } else {
+    w->objects[d / 8] &= (unsigned char) ~(1 << (d % 8));
+  }
+  w->depth++;
+  w->count = 0;
+  buf[n++] = is_object ? '{' : '[';
+  return writer_print(w, buf, n);
+}
+
+/* Close the innermost object if `is_object`, otherwise array */
+static int writer_end(struct json_writer *w, int is_object) {
+  char buf[WRITER_BUF_SIZE];
+  int n = 0;
+
+  if (w->error != 0) return w->error;
+  if (w->depth == 0 || writer_in_object(w) != is_object || w->after_key) {
+    return writer_fail(w, JSON_STRING_INVALID);
+  }
+  w->depth--;
+  if ((w->flags & JSON_WRITER_PRETTY) && w->count > 0) {
+    buf[n++] = '\n';
+    memset(buf + n, ' ', 2 * w->depth);
+    n += 2 * w->depth;
+  }
+  /* The closed object or array is an entry of its parent */
+  w->count = 1;
+  buf[n++] = is_object ? '}' : ']';
+  return writer_print(w, buf, n);
+}
+
+int json_writer_begin_object(struct json_writer *w) {
+  return writer_begin(w, 1);
+}
+
+int json_writer_end_object(struct json_writer *w) {
+  return writer_end(w, 1);
+}
+
+int json_writer_begin_array(struct json_writer *w) {
+  return writer_begin(w, 0);
+}
+
+int json_writer_end_array(struct json_writer *w) {
+  return writer_end(w, 0);
+}
+
+/*
+ * Print string `str` of `len` bytes quoted and escaped, after the `n` bytes
+ * at `buf`, and followed by `suffix`. Unless it is long, it is all staged in
+ * `buf`, and printed with a single call.
+ */
+static int writer_quoted(struct json_writer *w, char *buf, int n,
+                         const char *str, size_t len, const char *suffix) {
+  struct json_out_buffered b;
+  int total;
+
+  json_out_buffered_init(&b, w->out, buf, WRITER_BUF_SIZE);
+  buf[n++] = '"';
+  b.len = n;
+  total = n + json_escape(&b.out, str, len);
+  n = strlen(suffix);
+  json_printer_buffered(&b.out, suffix, n);
+  json_out_flush(&b);
+  total += n;
+  w->len += total;
+  return total;
+}
+
+int json_writer_key(struct json_writer *w, const char *key) {
+  char buf[WRITER_BUF_SIZE];
+  int n = writer_prefix(w, 1, buf);
+  if (n < 0) return n;
+  w->after_key = 1;
+  return writer_quoted(w, buf, n, key, strlen(key),
+                       (w->flags & JSON_WRITER_PRETTY) ? "\": " : "\":");
+}
+
+int json_writer_string_len(struct json_writer *w, const char *str,
+                           size_t len) {
+  char buf[WRITER_BUF_SIZE];
+  int n = writer_prefix(w, 0, buf);
+  if (n < 0) return n;
+  return writer_quoted(w, buf, n, str, len, "\"");
+}
+
+int json_writer_string(struct json_writer *w, const char *str) {
+  if (str == NULL) return json_writer_null(w);
+  return json_writer_string_len(w, str, strlen(str));
+}
+
+int json_writer_int(struct json_writer *w, int64_t v) {
+  char buf[WRITER_BUF_SIZE];
+  int n = writer_prefix(w, 0, buf);
+  if (n < 0) return n;
+  return writer_print(w, buf, n + json_itoa(v, buf + n));
+}
+
+int json_writer_double(struct json_writer *w, double d) {
+  char buf[WRITER_BUF_SIZE];
+  int n = writer_prefix(w, 0, buf);
+  if (n < 0) return n;
+  return writer_print(w, buf, n + json_dtoa(d, buf + n));
+}
+
+int json_writer_bool(struct json_writer *w, int v) {
+  char buf[WRITER_BUF_SIZE];
+  int n = writer_prefix(w, 0, buf);
+  if (n < 0) return n;
+  memcpy(buf + n, v ? "true" : "false", 5);
+  return writer_print(w, buf, n + (v ? 4 : 5));
+}
+
+int json_writer_null(struct json_writer *w) {
+  char buf[WRITER_BUF_SIZE];
+  int n = writer_prefix(w, 0, buf);
+  if (n < 0) return n;
+  memcpy(buf + n, "null", 4);
+  return writer_print(w, buf, n + 4);
+}
+
+int json_writer_raw(struct json_writer *w, const char *json, size_t len) {
+  char buf[WRITER_BUF_SIZE];
+  int n = writer_prefix(w, 0, buf);
+  if (n < 0) return n;
+  if (n > 0) w->out->printer(w->out, buf, n);
+  w->out->printer(w->out, json, len);
+  w->len += n + (int) len;
+  return n + (int) len;
+}
+
+int json_writer_finish(struct json_writer *w) {
+  if (w->error != 0) return w->error;
+  if (w->depth > 0 || w->count == 0) return JSON_STRING_INCOMPLETE;
+  return w->len;
+}
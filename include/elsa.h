@@ -24,15 +24,44 @@ extern "C" {
 
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #ifndef JSON_MAX_PATH_LEN
 #define JSON_MAX_PATH_LEN 256
 #endif
 
+/*
+ * Maximum nesting depth of objects and arrays. It sizes `struct json_stream`
+ * and `struct json_writer`, so the library and the code using it must be
+ * built with the same value. Lower limits can be set at run time, see
+ * JSON_WALK_MAX_DEPTH(), `json_stream_set_max_depth()` and
+ * JSON_WRITER_MAX_DEPTH().
+ */
+#ifndef JSON_MAX_DEPTH
+#define JSON_MAX_DEPTH 256
+#endif
+
+/* Size of the buffers of `struct json_stream` */
+#ifndef JSON_STREAM_BUF_SIZE
+#define JSON_STREAM_BUF_SIZE 512
+#endif
+
+/* Minimum size of the heap chunks of `struct json_arena` */
+#ifndef JSON_ARENA_CHUNK_SIZE
+#define JSON_ARENA_CHUNK_SIZE 4096
+#endif
+
+/* Size of the staging buffer used when printing to files */
+#ifndef JSON_FILE_BUF_SIZE
+#define JSON_FILE_BUF_SIZE 4096
+#endif
+
 /* Error codes */
 #define JSON_STRING_INVALID -1
 #define JSON_STRING_INCOMPLETE -2
+#define JSON_DEPTH_EXCEEDED -3
+#define JSON_TOKEN_TOO_LONG -4
 
 /* JSON token type */
 enum json_token_type {
@@ -95,16 +124,320 @@ typedef void (*json_walk_callback_t)(void *callback_data, const char *name,
 
 /*
  * Parse `json_string`, invoking `callback` in a way similar to SAX parsers;
- * see `json_walk_callback_t`.
+ * see `json_walk_callback_t`. Objects and arrays may nest up to
+ * JSON_MAX_DEPTH levels, deeper ones fail with JSON_DEPTH_EXCEEDED.
  * Return number of processed bytes, or a negative error code.
  */
 int json_walk(const char *json_string, int json_string_length,
               json_walk_callback_t callback, void *callback_data);
 
+/* Values returned by `json_walk_ex_callback_t` */
+enum json_walk_action {
+  JSON_WALK_CONTINUE = 0, /* Continue parsing */
+  JSON_WALK_SKIP_SUBTREE, /* On OBJECT_START or ARRAY_START, skip its content */
+  JSON_WALK_STOP          /* Stop parsing */
+};
+
+/* Flags for `json_walk_ex()` */
+enum json_walk_flags {
+  /*
+   * Do not build the path: callbacks get a NULL `path`, and a NULL `name` for
+   * array elements. Saves time when the callback does not need them.
+   */
+  JSON_WALK_NO_PATH = 1,
+  /*
+   * Decode numbers: the token passed for JSON_TYPE_NUMBER is the `token`
+   * member of a `struct json_number_token`.
+   */
+  JSON_WALK_NUMBERS = 2
+};
+
+/*
+ * Flag of `json_walk_ex()` that limits nesting to `n` levels, from 1 to
+ * JSON_MAX_DEPTH; deeper input fails with JSON_DEPTH_EXCEEDED. Without it,
+ * or with 0, the limit is JSON_MAX_DEPTH.
+ */
+#define JSON_WALK_DEPTH_SHIFT 8
+#define JSON_WALK_MAX_DEPTH(n) ((n) << JSON_WALK_DEPTH_SHIFT)
+
+/* Flags of `struct json_number` */
+enum json_number_flags {
+  JSON_NUMBER_INT64 = 1,   /* An integer that fits `i` */
+  JSON_NUMBER_UINT64 = 2,  /* A non-negative integer that fits `u` */
+  JSON_NUMBER_OVERFLOW = 4 /* Out of the range of a double, `d` is infinite */
+};
+
+/* Value of a number, decoded by `json_parse_number()` */
+struct json_number {
+  int flags; /* Combination of `enum json_number_flags` */
+  int64_t i;
+  uint64_t u;
+  double d; /* Always set, correctly rounded */
+};
+
+/* Number token passed to callbacks by walks with JSON_WALK_NUMBERS */
+struct json_number_token {
+  struct json_token token; /* Must be first */
+  struct json_number num;
+};
+
+/*
+ * Decode the JSON number `s`, `len`, e.g. "-12.5e3", into `num`. Integers
+ * without a fraction or an exponent also get their exact value in `i` or
+ * `u`, if they fit. The conversion does not depend on the locale.
+ * Return 0 on success, or JSON_STRING_INVALID if `s` is not a number.
+ */
+int json_parse_number(const char *s, int len, struct json_number *num);
+
+/* Length of the base64 encoding of `n` bytes */
+#define JSON_BASE64_ENC_LEN(n) (((n) + 2) / 3 * 4)
+
+/* Upper bound of the number of bytes decoded from `n` base64 characters */
+#define JSON_BASE64_DEC_LEN(n) (((n) + 3) / 4 * 3)
+
+/*
+ * Base64-encode `len` bytes at `src` into JSON_BASE64_ENC_LEN(len)
+ * characters at `dst`, with padding. The output is not NUL-terminated.
+ * Return its length.
+ */
+int json_base64_encode(const unsigned char *src, int len, char *dst);
+
+/*
+ * Decode `len` base64 characters at `src` into `dst`, which must hold
+ * JSON_BASE64_DEC_LEN(len) bytes. The final padding is optional.
+ * Return the number of decoded bytes, or JSON_STRING_INVALID if `src` is not
+ * base64.
+ */
+int json_base64_decode(const char *src, int len, unsigned char *dst);
+
+/*
+ * Hex-encode `len` bytes at `src` into 2 * `len` lowercase hex digits at
+ * `dst`. The output is not NUL-terminated. Return its length.
+ */
+int json_hex_encode(const unsigned char *src, int len, char *dst);
+
+/*
+ * Decode `len` hex digits, lower or upper case, at `src` into `len` / 2 bytes
+ * at `dst`. Return the number of decoded bytes, or JSON_STRING_INVALID if
+ * `src` is not an even number of hex digits.
+ */
+int json_hex_decode(const char *src, int len, unsigned char *dst);
+
+/* Size of a buffer large enough for any output of the functions below */
+#define JSON_NUMBER_BUF_SIZE 32
+
+/*
+ * Format `v` in decimal into `buf`, which must hold JSON_NUMBER_BUF_SIZE
+ * bytes. The output is NUL-terminated, and does not depend on the locale.
+ * Return its length.
+ */
+int json_itoa(int64_t v, char *buf);
+int json_utoa(uint64_t v, char *buf);
+
+/*
+ * Same as `json_itoa()`, but for a double: print the shortest digits that
+ * read back as `d`, the closest to `d` of those, in decimal notation like
+ * "0.1" or "1500" between 1e-6 and 1e21, otherwise in exponential notation
+ * like "1.5e+300". Infinities and NaNs, which JSON cannot represent, are
+ * printed as "null".
+ */
+int json_dtoa(double d, char *buf);
+
+/* Same as `json_dtoa()`, for the shortest digits that read back as float `f` */
+int json_ftoa(float f, char *buf);
+
+/*
+ * Same as `json_walk_callback_t`, but returns one of `enum json_walk_action`
+ * to control the parsing.
+ */
+typedef int (*json_walk_ex_callback_t)(void *callback_data, const char *name,
+                                       size_t name_len, const char *path,
+                                       const struct json_token *token);
+
+/*
+ * Same as `json_walk()`, but the callback controls the parsing:
+ *  - `JSON_WALK_SKIP_SUBTREE` returned for `JSON_TYPE_OBJECT_START` or
+ *    `JSON_TYPE_ARRAY_START` skips the object or array by matching brackets,
+ *    without parsing or validating its content. No callbacks are invoked for
+ *    its content, nor for its `_END` event. For other events it is the same
+ *    as `JSON_WALK_CONTINUE`.
+ *  - `JSON_WALK_STOP` stops parsing right after the current event.
+ * `flags` is a combination of `enum json_walk_flags` and
+ * JSON_WALK_MAX_DEPTH(), or 0.
+ * Return number of processed bytes, or a negative error code.
+ */
+int json_walk_ex(const char *json_string, int json_string_length,
+                 json_walk_ex_callback_t callback, void *callback_data,
+                 int flags);
+
+/* Values returned by `json_path_match()` */
+enum json_path_result {
+  JSON_PATH_NO_MATCH = 0, /* Neither the value nor its content can match */
+  JSON_PATH_PREFIX,       /* The value is on the path, its content may match */
+  JSON_PATH_MATCH         /* The value is at the path */
+};
+
+/*
+ * Path matcher, compiled by `json_path_compile()` and fed with the events of
+ * a `json_walk()` or `json_walk_ex()` callback. It tracks the depth of the
+ * walk and the number of segments matched so far, so that every event is
+ * checked against a single path segment. Treat as opaque.
+ */
+struct json_path {
+  const char *path; /* Compiled path */
+  int seg;          /* Offset of the segment that entries must match */
+  int seg_len;      /* Length of that segment, including delimiters */
+  int index;        /* Index of an array segment, or -1 */
+  int count;        /* Number of entries of the matched array seen so far */
+  int level;        /* Number of open objects and arrays */
+  int matched;      /* Number of open objects and arrays on the path */
+};
+
+/*
+ * Compile `path`, e.g. ".a.b[3].c", into `p`. Use "" for the root value.
+ * `path` must outlive `p`. Array segments may be empty, as in ".a[]", in
+ * which case they match no entry.
+ * Return 0 on success, or JSON_STRING_INVALID if `path` is malformed.
+ */
+int json_path_compile(struct json_path *p, const char *path);
+
+/*
+ * Match a walk event, given the `name` and `token` passed to the callback,
+ * and return one of `enum json_path_result`. Every event of the walk must be
+ * passed, in order. For `_END` events, the result is the same as for the
+ * matching `_START` event.
+ */
+int json_path_match(struct json_path *p, const char *name, size_t name_len,
+                    const struct json_token *token);
+
+/*
+ * Tell the matcher that the object or array of the last `_START` event was
+ * skipped with `JSON_WALK_SKIP_SUBTREE`, so there will be no `_END` event.
+ */
+void json_path_skip(struct json_path *p);
+
+/*
+ * Callback invoked by `json_query_run()` for the value found at `path`,
+ * filled the same way as `json_scanf()` fills `%T`.
+ */
+typedef void (*json_query_callback_t)(void *callback_data, const char *path,
+                                      const struct json_token *token);
+
+/*
+ * Set of paths resolved together in a single walk, see `json_query_new()`.
+ */
+struct json_query_set;
+
+/*
+ * Create an empty query set. Return NULL if out of memory.
+ * Free with `json_query_free()`.
+ */
+struct json_query_set *json_query_new(void);
+
+void json_query_free(struct json_query_set *q);
+
+/*
+ * Register JSON `path` (same syntax as `json_iter_init()`) in query set `q`.
+ * When the value at `path` is found, it is copied to `token` and `callback`
+ * is invoked; either may be NULL. `path` must outlive `q`.
+ * Return 0 on success, or -1 if `path` is malformed or out of memory.
+ */
+int json_query_add(struct json_query_set *q, const char *path,
+                   struct json_token *token, json_query_callback_t callback,
+                   void *callback_data);
+
+/*
+ * Resolve all the paths of `q` in one walk over `s`. The registered paths
+ * form a trie over path segments, and objects and arrays that none of them
+ * goes through are skipped without parsing their content. If a key is
+ * repeated, the first value is used. The walk stops as soon as every path
+ * is resolved. Tokens of paths that are not found are reset.
+ * Return the number of paths found, or a negative error code.
+ */
+int json_query_run(struct json_query_set *q, const char *s, int len);
+
+/* An object or array being parsed by a `struct json_stream` */
+struct json_stream_level {
+  int start;    /* Offset of the opening bracket */
+  int path_len; /* Path length of the object or array */
+  int base_len; /* Path length of its entries, without their own segment */
+  int count;    /* Number of array entries seen so far */
+  int state;    /* Parser state */
+};
+
+/*
+ * Push parser, for JSON that arrives in chunks, e.g. from a socket. Unlike
+ * `json_walk()`, it keeps the parsing state between calls, so the JSON
+ * string does not have to be held in memory as a whole. Treat as opaque.
+ */
+struct json_stream {
+  json_walk_callback_t callback;
+  void *callback_data;
+  int offset;      /* Number of bytes consumed so far */
+  int result;      /* Length of the parsed value, error code, or 0 */
+  int state;       /* Parser state at the root */
+  int depth;       /* Number of open objects and arrays */
+  int max_depth;   /* Nesting limit */
+  int tok;         /* Token being lexed */
+  int tok_state;   /* Lexer state inside of the token */
+  int tok_skip;    /* Bytes of a UTF-8 character left to skip */
+  int buf_len;     /* Bytes of the token held in `buf` */
+  int name_len;    /* Length of the name of the next value, or -1 */
+  int name_off;    /* Offset of the name in `path`, or -1 if in `name` */
+  size_t path_len; /* Length of `path` */
+  char path[JSON_MAX_PATH_LEN];
+  char name[JSON_STREAM_BUF_SIZE];
+  char buf[JSON_STREAM_BUF_SIZE];
+  struct json_stream_level stack[JSON_MAX_DEPTH];
+};
+
+/*
+ * Initialise push parser `st`, which invokes `callback` for the same events,
+ * with the same names and paths, as `json_walk()` does.
+ */
+void json_stream_init(struct json_stream *st, json_walk_callback_t callback,
+                      void *callback_data);
+
+/*
+ * Feed the next `len` bytes of the JSON string to `st`. Callbacks are invoked
+ * as soon as their value is complete; a number is only complete once the
+ * character that follows it is seen. Tokens passed to callbacks point into
+ * `chunk`, or into a buffer of `st` if they were split across chunks: they
+ * are only valid during the callback. Tokens split across chunks, and keys,
+ * must fit in JSON_STREAM_BUF_SIZE bytes. Objects and arrays may nest up to
+ * JSON_MAX_DEPTH levels, or as set by `json_stream_set_max_depth()`. For
+ * `_END` events, `ptr` is NULL, and `len` is the length of the object or
+ * array.
+ *
+ * Return the number of bytes consumed, which is less than `len` if the value
+ * ends within `chunk`, or a negative error code. Once an error is returned,
+ * further calls return it too.
+ */
+int json_stream_feed(struct json_stream *st, const char *chunk, int len);
+
+/*
+ * Limit the nesting of the input of `st` to `max_depth` levels, from 1 to
+ * JSON_MAX_DEPTH, instead of JSON_MAX_DEPTH. Call before feeding it.
+ */
+void json_stream_set_max_depth(struct json_stream *st, int max_depth);
+
+/*
+ * Signal the end of input to `st`. Return the same as `json_walk()` would
+ * for the whole JSON string: the length of the parsed value, or a negative
+ * error code. JSON_STRING_INCOMPLETE means the value is truncated.
+ */
+int json_stream_finish(struct json_stream *st);
+
 /*
  * JSON generation API.
  * struct json_out abstracts output, allowing alternative printing plugins.
  */
+/*
+ * Allocator of `JSON_OUT_DYNBUF`, with the semantics of `realloc()`, except
+ * that a `size` of 0 frees `ptr`.
+ */
+typedef void *(*json_realloc_t)(void *ptr, size_t size);
+
 struct json_out {
   int (*printer)(struct json_out *, const char *str, size_t len);
   union {
@@ -112,6 +445,7 @@ struct json_out {
       char *buf;
       size_t size;
       size_t len;
+      json_realloc_t realloc_fn; /* Allocator of JSON_OUT_DYNBUF, or NULL */
     } buf;
     void *data;
     FILE *fp;
@@ -120,26 +454,73 @@ struct json_out {
 
 extern int json_printer_buf(struct json_out *, const char *, size_t);
 extern int json_printer_file(struct json_out *, const char *, size_t);
+extern int json_printer_dynbuf(struct json_out *, const char *, size_t);
 
 #define JSON_OUT_BUF(buf, len) \
   {                            \
     json_printer_buf, {        \
-      { buf, len, 0 }          \
+      { buf, len, 0, NULL }    \
     }                          \
   }
-#define JSON_OUT_FILE(fp)   \
-  {                         \
-    json_printer_file, {    \
-      { (char *) fp, 0, 0 } \
-    }                       \
+#define JSON_OUT_FILE(fp)         \
+  {                               \
+    json_printer_file, {          \
+      { (char *) fp, 0, 0, NULL } \
+    }                             \
+  }
+
+/*
+ * Print to a heap buffer that grows as needed, by doubling its size. The
+ * output is in `u.buf.buf`, `u.buf.len`, and is NUL-terminated once anything
+ * is printed. `realloc_fn` is the allocator, or NULL for realloc() and free().
+ * If the allocator fails, the output is truncated as with `JSON_OUT_BUF`.
+ */
+#define JSON_OUT_DYNBUF(realloc_fn)  \
+  {                                  \
+    json_printer_dynbuf, {           \
+      { NULL, 0, 0, realloc_fn }     \
+    }                                \
   }
 
+/* Empty a `JSON_OUT_DYNBUF` output, keeping its memory for the next output */
+void json_out_dynbuf_reset(struct json_out *out);
+
+/* Release the memory of a `JSON_OUT_DYNBUF` output, and empty it */
+void json_out_dynbuf_free(struct json_out *out);
+
+/*
+ * Output that stages the bytes printed to `out` in the caller buffer `buf`,
+ * and passes them to `dest` in blocks of up to `size` bytes, so that the many
+ * small writes of the printing functions turn into few calls to
+ * `dest->printer`. Writes larger than the buffer go straight to `dest`.
+ */
+struct json_out_buffered {
+  struct json_out out; /* Print to this */
+  struct json_out *dest;
+  char *buf;
+  size_t size;
+  size_t len;
+};
+
+extern int json_printer_buffered(struct json_out *, const char *, size_t);
+
+void json_out_buffered_init(struct json_out_buffered *b,
+                            struct json_out *dest, char *buf, size_t size);
+
+/*
+ * Pass the staged bytes to `b->dest`. Must be called once printing is done.
+ * Return the value returned by `b->dest->printer`.
+ */
+int json_out_flush(struct json_out_buffered *b);
+
 typedef int (*json_printf_callback_t)(struct json_out *, va_list *ap);
 
 /*
  * Generate formatted output into a given sting buffer.
  * This is a superset of printf() function, with extra format specifiers:
  *  - `%B` print json boolean, `true` or `false`. Accepts an `int`.
+ *  - `%D` print the shortest digits that read back as the same double, see
+ *    `json_dtoa()`. Accepts a `double`.
  *  - `%Q` print quoted escaped string or `null`. Accepts a `const char *`.
  *  - `%.*Q` same as `%Q`, but with length. Accepts `int`, `const char *`
  *  - `%V` print quoted base64-encoded string. Accepts a `const char *`, `int`.
@@ -147,6 +528,9 @@ typedef int (*json_printf_callback_t)(struct json_out *, va_list *ap);
  *  - `%M` invokes a json_printf_callback_t function. That callback function
  *  can consume more parameters.
  *
+ * Integer conversions `%d`, `%i` and `%u` without flags, width or precision
+ * are formatted natively, other conversions by the system printf.
+ *
  * Return number of bytes printed. If the return value is bigger then the
  * supplied buffer, that is an indicator of overflow. In the overflow case,
  * overflown bytes are not printed.
@@ -154,6 +538,30 @@ typedef int (*json_printf_callback_t)(struct json_out *, va_list *ap);
 int json_printf(struct json_out *, const char *fmt, ...);
 int json_vprintf(struct json_out *, const char *fmt, va_list ap);
 
+/*
+ * A `json_printf()` format string compiled by `json_printf_compile()` into a
+ * list of operations: runs of literal text, keys included, are printed with
+ * a single printer call, and conversions are classified once. A plan is never
+ * modified once compiled, so it can be shared by several threads.
+ */
+struct json_printf_plan;
+
+/*
+ * Compile format string `fmt`. Return NULL if out of memory.
+ * Release with `json_printf_plan_free()`.
+ */
+struct json_printf_plan *json_printf_compile(const char *fmt);
+void json_printf_plan_free(struct json_printf_plan *plan);
+
+/*
+ * Same as `json_printf()`, with the format compiled into `plan`.
+ * The arguments are the ones the format string would take.
+ */
+int json_printf_exec(struct json_out *, const struct json_printf_plan *plan,
+                     ...);
+int json_vprintf_exec(struct json_out *, const struct json_printf_plan *plan,
+                      va_list ap);
+
 /*
  * Same as json_printf, but prints to a file.
  * File is created if does not exist. File is truncated if already exists.
@@ -168,6 +576,85 @@ int json_vfprintf(const char *file_name, const char *fmt, va_list ap);
  */
 int json_printf_array(struct json_out *, va_list *ap);
 
+/*
+ * Helper %M callbacks that print contiguous C arrays of a given type, e.g.
+ * json_printf(out, "%M", json_printf_array_double, values, count).
+ * Consume const T *array_ptr, size_t count: the number of elements, not bytes.
+ * Numbers are printed as by `json_itoa()`, `json_ftoa()` and `json_dtoa()`,
+ * and strings as by `%Q`: json_printf_array_string() consumes
+ * `const char **`, and prints NULL elements as `null`.
+ * Return number of bytes printed.
+ */
+int json_printf_array_int8(struct json_out *, va_list *ap);
+int json_printf_array_int16(struct json_out *, va_list *ap);
+int json_printf_array_int32(struct json_out *, va_list *ap);
+int json_printf_array_int64(struct json_out *, va_list *ap);
+int json_printf_array_uint8(struct json_out *, va_list *ap);
+int json_printf_array_uint16(struct json_out *, va_list *ap);
+int json_printf_array_uint32(struct json_out *, va_list *ap);
+int json_printf_array_uint64(struct json_out *, va_list *ap);
+int json_printf_array_float(struct json_out *, va_list *ap);
+int json_printf_array_double(struct json_out *, va_list *ap);
+int json_printf_array_bool(struct json_out *, va_list *ap);
+int json_printf_array_string(struct json_out *, va_list *ap);
+
+/* Flags of `json_writer_init()` */
+#define JSON_WRITER_PRETTY 1 /* Indent like `json_prettify()` */
+
+/* Flag of `json_writer_init()`, as JSON_WALK_MAX_DEPTH() is for the walk */
+#define JSON_WRITER_MAX_DEPTH(n) ((n) << JSON_WALK_DEPTH_SHIFT)
+
+/*
+ * Streaming JSON writer: values are printed to `out` as the functions below
+ * are called, with the commas, and the line breaks and indentation of the
+ * pretty mode, managed by the writer. There is no format string to parse.
+ * Objects and arrays may nest up to JSON_MAX_DEPTH levels, or fewer with the
+ * JSON_WRITER_MAX_DEPTH() flag. Treat as opaque.
+ */
+struct json_writer {
+  struct json_out *out;
+  int flags;
+  int depth;     /* Number of open objects and arrays */
+  int max_depth; /* Nesting limit */
+  int count;     /* Number of entries of the innermost one, or root values */
+  int after_key; /* Non-0 if a key was written, and its value is next */
+  int len;       /* Number of bytes printed so far */
+  int error;     /* First error, or 0 */
+  unsigned char objects[(JSON_MAX_DEPTH + 7) / 8]; /* Bit set for objects */
+};
+
+void json_writer_init(struct json_writer *w, struct json_out *out, int flags);
+
+/*
+ * Write a value, or a key of the innermost object. Each key must be
+ * followed by its value. `json_writer_string()` writes NULL as `null`, and
+ * `json_writer_raw()` writes `len` bytes of JSON as they are.
+ *
+ * Return the number of bytes printed, or a negative error code if the call
+ * would not produce valid JSON: JSON_STRING_INVALID, e.g. for a key in an
+ * array or a second root value, or JSON_DEPTH_EXCEEDED. Nothing is printed
+ * then, and further calls return the same error.
+ */
+int json_writer_begin_object(struct json_writer *w);
+int json_writer_end_object(struct json_writer *w);
+int json_writer_begin_array(struct json_writer *w);
+int json_writer_end_array(struct json_writer *w);
+int json_writer_key(struct json_writer *w, const char *key);
+int json_writer_string(struct json_writer *w, const char *str);
+int json_writer_string_len(struct json_writer *w, const char *str,
+                           size_t len);
+int json_writer_int(struct json_writer *w, int64_t v);
+int json_writer_double(struct json_writer *w, double d);
+int json_writer_bool(struct json_writer *w, int v);
+int json_writer_null(struct json_writer *w);
+int json_writer_raw(struct json_writer *w, const char *json, size_t len);
+
+/*
+ * Return the number of bytes printed by `w`, or the first error of `w`, or
+ * JSON_STRING_INCOMPLETE if the root value is missing or not closed.
+ */
+int json_writer_finish(struct json_writer *w);
+
 /*
  * Scan JSON string `str`, performing scanf-like conversions according to `fmt`.
  * This is a `scanf()` - like function, with following differences:
@@ -178,25 +665,98 @@ int json_printf_array(struct json_out *, va_list *ap);
  *    - %B: consumes `bool *`, expects boolean `true` or `false`.
  *    - %Q: consumes `char **`, expects quoted, JSON-encoded string. Scanned
  *       string is malloc-ed, caller must free() the string.
+ *    - %.*Q: consumes `int`, `char *`: size and address of a buffer. Same as
+ *       %Q, but the string is unescaped into the buffer and NUL-terminated.
+ *       If it does not fit, it is truncated, and the conversion is not
+ *       counted.
  *    - %V: consumes `char **`, `int *`. Expects base64-encoded string.
  *       Result string is base64-decoded, malloced and NUL-terminated.
  *       The length of result string is stored in `int *` placeholder.
- *       Caller must free() the result.
+ *       Caller must free() the result. If the string is not base64, the
+ *       result is NULL and the conversion is not counted.
  *    - %H: consumes `int *`, `char **`.
  *       Expects a hex-encoded string, e.g. "fa014f".
  *       Result string is hex-decoded, malloced and NUL-terminated.
  *       The length of the result string is stored in `int *` placeholder.
- *       Caller must free() the result.
+ *       Caller must free() the result. If the string is not hex, the result
+ *       is NULL and the conversion is not counted.
  *    - %M: consumes custom scanning function pointer and
  *       `void *user_data` parameter - see json_scanner_t definition.
  *    - %T: consumes `struct json_token *`, fills it out with matched token.
  *
+ * If a key appears more than once, its first value is taken, and the later
+ * ones are not converted. Scanning stops once every conversion is done.
+ *
  * Return number of elements successfully scanned & converted.
  * Negative number means scan error.
  */
 int json_scanf(const char *str, int str_len, const char *fmt, ...);
 int json_vscanf(const char *str, int str_len, const char *fmt, va_list ap);
 
+/*
+ * Bump allocator over caller memory, that continues in heap chunks when the
+ * caller memory is used up. Everything allocated is released at once with
+ * `json_arena_reset()`. Treat as opaque.
+ */
+struct json_arena {
+  char *buf;                       /* Block being allocated from */
+  size_t size;                     /* Its size */
+  size_t used;                     /* Bytes of it allocated so far */
+  char *user_buf;                  /* Caller memory */
+  size_t user_size;                /* Its size */
+  struct json_arena_chunk *chunks; /* Heap chunks, most recent first */
+};
+
+/*
+ * Initialise arena `a` over `size` bytes at `buf`. `buf` may be NULL, in
+ * which case everything is allocated from heap chunks.
+ */
+void json_arena_init(struct json_arena *a, void *buf, size_t size);
+
+/*
+ * Allocate `n` bytes, aligned for pointers, from `a`.
+ * Return NULL if out of memory.
+ */
+void *json_arena_alloc(struct json_arena *a, size_t n);
+
+/* Release everything allocated from `a`, which can then be used again */
+void json_arena_reset(struct json_arena *a);
+
+/*
+ * Same as `json_scanf()`, but the strings and blobs of %Q, %V and %H are
+ * allocated from `arena` instead of malloc-ed: they must not be free()-d,
+ * and live until `json_arena_reset()`. The working memory of large formats
+ * also comes from `arena`, so nothing is malloc-ed while it has room.
+ */
+int json_scanf_arena(const char *str, int str_len, struct json_arena *arena,
+                     const char *fmt, ...);
+int json_vscanf_arena(const char *str, int str_len, struct json_arena *arena,
+                      const char *fmt, va_list ap);
+
+/*
+ * A `json_scanf()` format string parsed once by `json_scanf_compile()`, to
+ * scan many documents without parsing the format or its paths again. A plan
+ * is never modified once compiled, so it can be shared by several threads.
+ */
+struct json_scanf_plan;
+
+/*
+ * Compile format string `fmt`. Return NULL if out of memory.
+ * Release with `json_scanf_plan_free()`.
+ */
+struct json_scanf_plan *json_scanf_compile(const char *fmt);
+void json_scanf_plan_free(struct json_scanf_plan *plan);
+
+/*
+ * Same as `json_scanf_arena()`, with the format compiled into `plan`.
+ * The arguments are the ones the format string would take. `arena` may be
+ * NULL, in which case strings are malloc-ed as by `json_scanf()`.
+ */
+int json_scanf_exec(const struct json_scanf_plan *plan, const char *str,
+                    int str_len, struct json_arena *arena, ...);
+int json_vscanf_exec(const struct json_scanf_plan *plan, const char *str,
+                     int str_len, struct json_arena *arena, va_list ap);
+
 /* json_scanf's %M handler  */
 typedef void (*json_scanner_t)(const char *str, int len, void *user_data);
 
@@ -208,6 +768,27 @@ typedef void (*json_scanner_t)(const char *str, int len, void *user_data);
 int json_scanf_array_elem(const char *s, int len, const char *path, int index,
                           struct json_token *token);
 
+/*
+ * Fill `tokens` with the elements of the array at `path`, e.g. ".a.b", in a
+ * single pass. Tokens are filled the same way as `json_scanf()` fills `%T`.
+ * At most `max_tokens` tokens are stored, but all elements are counted, so
+ * that a call with `max_tokens` 0 (and `tokens` NULL) sizes the buffer.
+ * Return the number of elements, or a negative error code:
+ * JSON_STRING_INVALID if there is no array at `path`.
+ */
+int json_scanf_array(const char *s, int len, const char *path,
+                     struct json_token *tokens, int max_tokens);
+
+/*
+ * Same as `json_scanf_array()`, but stores the values of the elements, which
+ * must all be numbers (integers that fit for `json_scanf_array_int64()`),
+ * otherwise JSON_STRING_INVALID is returned.
+ */
+int json_scanf_array_int64(const char *s, int len, const char *path,
+                           int64_t *values, int max_values);
+int json_scanf_array_double(const char *s, int len, const char *path,
+                            double *values, int max_values);
+
 /*
  * Unescape JSON-encoded string src,slen into dst, dlen.
  * src and dst may overlap.
@@ -224,11 +805,41 @@ int json_unescape(const char *src, int slen, char *dst, int dlen);
 int json_escape(struct json_out *out, const char *str, size_t str_len);
 
 /*
- * Read the whole file in memory.
- * Return malloc-ed file content, or NULL on error. The caller must free().
+ * Read the whole file in memory. Files without a known size, like pipes, are
+ * read to the end too.
+ * Return malloc-ed, NUL-terminated file content, or NULL on error.
+ * The caller must free().
  */
 char *json_fread(const char *file_name);
 
+/* Flags of `json_map_file()` */
+#define JSON_MAP_POPULATE 1 /* Read the whole file in at once, if possible */
+
+/* Content of a file loaded by `json_map_file()` */
+struct json_file {
+  const char *data; /* Read-only file content, not NUL-terminated */
+  size_t len;       /* Length of the file content */
+  int kind;         /* How the content is held, private */
+};
+
+/*
+ * Load the file `file_name` for parsing, without copying it: regular files
+ * are mapped read-only in memory (with mmap(), where available), and read
+ * sequentially. Other files, like pipes, and platforms without mmap(), fall
+ * back to reading the file into a heap buffer. Pass `f->data`, `f->len` to
+ * `json_walk()`, `json_scanf()`, `json_prettify()`, etc.
+ *
+ * With JSON_MAP_POPULATE, the whole file is read in by the call, rather than
+ * page by page while parsing, where the platform supports it.
+ *
+ * Return 0 on success, or -1 on error. The file must not be modified while
+ * it is loaded.
+ */
+int json_map_file(struct json_file *f, const char *file_name, int flags);
+
+/* Release a file loaded by `json_map_file()` */
+void json_unmap_file(struct json_file *f);
+
 /*
  * Update given JSON string `s,len` by changing the value at given `json_path`.
  * The result is saved to `out`. If `json_fmt` == NULL, that deletes the key.
@@ -266,6 +877,8 @@ int json_prettify_file(const char *file_name);
  * On each iteration, fill the `key` and `val` tokens. It is OK to pass NULL
  * for `key`, or `val`, in which case they won't be populated.
  * Return an opaque value suitable for the next iteration, or NULL when done.
+ * Each call scans the JSON string up to the returned entry, so prefer
+ * `json_iter_next()` for large objects and arrays.
  *
  * Example:
  *
@@ -288,6 +901,128 @@ void *json_next_key(const char *s, int len, void *handle, const char *path,
 void *json_next_elem(const char *s, int len, void *handle, const char *path,
                      int *idx, struct json_token *val);
 
+/*
+ * Iterator over the entries of an object or an array. Unlike `json_next_key()`
+ * and `json_next_elem()`, it remembers its position between calls, so that
+ * iterating over a container costs O(n) in total. Treat as opaque.
+ */
+struct json_iter {
+  const char *cur; /* Position of the next entry */
+  const char *end; /* End of the JSON string */
+  int idx;         /* Number of entries fetched so far */
+  int is_array;    /* Non-0 if iterating over an array */
+};
+
+/*
+ * Initialise iterator `it` over the object or array at given JSON `path`,
+ * e.g. ".foo.bar[2]". Use "" for the root value.
+ * Return 0 on success, JSON_STRING_INVALID if there is no object or array at
+ * `path`, or JSON_STRING_INCOMPLETE if the JSON string is truncated.
+ *
+ * To iterate over a nested object or array fetched by `json_iter_next()`,
+ * initialise another iterator with `val.ptr`, `val.len` and path "".
+ */
+int json_iter_init(struct json_iter *it, const char *s, int len,
+                   const char *path);
+
+/*
+ * Fetch the next entry. For objects, fill the `key` token; for arrays, `key`
+ * is reset, and the index of the entry is `it->idx - 1`. The `val` token is
+ * filled the same way as `json_scanf()` fills `%T`. Nested objects and arrays
+ * are skipped by matching brackets, without parsing their content. It is OK
+ * to pass NULL for `key`, or `val`.
+ * Return 1 if an entry was fetched, 0 when done, or a negative error code.
+ * Once done, it keeps returning 0: it never reads past the end of the object
+ * or array.
+ *
+ * Example:
+ *
+ * ```c
+ * struct json_iter it;
+ * struct json_token key, val;
+ * if (json_iter_init(&it, s, len, ".foo") == 0) {
+ *   while (json_iter_next(&it, &key, &val) > 0) {
+ *     printf("[%.*s] -> [%.*s]\n", key.len, key.ptr, val.len, val.ptr);
+ *   }
+ * }
+ * ```
+ */
+int json_iter_next(struct json_iter *it, struct json_token *key,
+                   struct json_token *val);
+
+/*
+ * A token of a tape filled by `json_tokenize()`. Offsets and lengths are the
+ * same as the ones of the `struct json_token` passed to `json_walk()`
+ * callbacks: string values and keys exclude the quotes, objects and arrays
+ * span from the opening to the closing bracket.
+ */
+struct json_tape_token {
+  int type;       /* One of `enum json_token_type`, *_END for objects/arrays */
+  int offset;     /* Offset of the value in the JSON string */
+  int len;        /* Length of the value */
+  int key_offset; /* Offset of the key in the JSON string, or -1 */
+  int key_len;    /* Length of the key */
+  int parent;     /* Index of the enclosing object or array, or -1 */
+  int next;       /* Index of the token that follows this value's content */
+};
+
+/*
+ * Parse `s` once into a flat tape of tokens, one per value, in document
+ * order. Queries against the tape hop over whole subtrees using
+ * `json_tape_token.next`, instead of parsing the JSON string again.
+ * Return the number of tokens in the JSON string, or a negative error code.
+ * If it is larger than `max_tokens`, only the first `max_tokens` tokens are
+ * stored: `tokens` may be NULL to just count them.
+ */
+int json_tokenize(const char *s, int len, struct json_tape_token *tokens,
+                  int max_tokens);
+
+/*
+ * Return the index of the token at given JSON `path` (same syntax as
+ * `json_iter_init()`), or -1 if there is none. `n` is the number of tokens
+ * in `tape`. If a key is repeated, the first one is found.
+ */
+int json_tape_find(const char *s, const struct json_tape_token *tape, int n,
+                   const char *path);
+
+/*
+ * Return the index of the entry of the object or array `parent` that follows
+ * entry `i`, or its first entry if `i` is -1. Return -1 when done.
+ *
+ * Example:
+ *
+ * ```c
+ * int i = json_tape_find(s, tape, n, ".foo"), j = -1;
+ * while ((j = json_tape_next(tape, n, i, j)) >= 0) {
+ *   printf("[%.*s] -> [%.*s]\n", tape[j].key_len, s + tape[j].key_offset,
+ *          tape[j].len, s + tape[j].offset);
+ * }
+ * ```
+ */
+int json_tape_next(const struct json_tape_token *tape, int n, int parent,
+                   int i);
+
+/*
+ * Same as `json_scanf()`, but looks the values up in the `n` tokens of a
+ * tape filled by `json_tokenize()` from `s`.
+ */
+int json_tape_scanf(const char *s, const struct json_tape_token *tape, int n,
+                    const char *fmt, ...);
+int json_tape_vscanf(const char *s, const struct json_tape_token *tape, int n,
+                     const char *fmt, va_list ap);
+
+/*
+ * Same as `json_setf()`, but finds the value to modify or delete in the `n`
+ * tokens of a tape filled by `json_tokenize()` from `s`. If there is no
+ * value at `json_path`, falls back to `json_setf()` to add it.
+ */
+int json_tape_setf(const char *s, int len, const struct json_tape_token *tape,
+                   int n, struct json_out *out, const char *json_path,
+                   const char *json_fmt, ...);
+int json_tape_vsetf(const char *s, int len, const struct json_tape_token *tape,
+                    int n, struct json_out *out, const char *json_path,
+                    const char *json_fmt, va_list ap);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -15,17 +15,59 @@
  * GNU General Public License for more details.
  */
 
+/* Before any system header, for elsa/fread.c which is included below */
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+
+/* Heap allocations of the library, counted by redirecting the allocator */
+static int static_num_allocs = 0;
+
+static void *test_malloc(size_t size) {
+  static_num_allocs++;
+  return malloc(size);
+}
+
+static void *test_calloc(size_t n, size_t size) {
+  static_num_allocs++;
+  return calloc(n, size);
+}
+
+static void *test_realloc(void *ptr, size_t size) {
+  static_num_allocs++;
+  return realloc(ptr, size);
+}
+
+#define malloc test_malloc
+#define calloc test_calloc
+#define realloc test_realloc
+
+#include "elsa/arena.c"
+#include "elsa/base64.c"
+#include "elsa/dtoa.c"
 #include "elsa/escape.c"
 #include "elsa/fread.c"
+#include "elsa/hex.c"
 #include "elsa/next.c"
+#include "elsa/number.c"
+#include "elsa/path.c"
 #include "elsa/prettify.c"
 #include "elsa/printer.c"
 #include "elsa/printf.c"
+#include "elsa/query.c"
 #include "elsa/scanf.c"
 #include "elsa/setf.c"
+#include "elsa/stream.c"
+#include "elsa/tape.c"
 #include "elsa/walk.c"
+#include "elsa/writer.c"
+
+#undef malloc
+#undef calloc
+#undef realloc
 
 #include <inttypes.h>
+#include <locale.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -58,6 +100,15 @@ static const char *tok_type_names[] = {
 
 static int static_num_tests = 0;
 
+static void cb_count(void *data, const char *name, size_t name_len,
+                     const char *path, const struct json_token *token) {
+  (void) name;
+  (void) name_len;
+  (void) path;
+  (void) token;
+  (*(int *) data)++;
+}
+
 static const char *test_errors(void) {
   /* clang-format off */
   static const char *invalid_tests[] = {
@@ -136,6 +187,70 @@ static const char *test_errors(void) {
   ASSERT(json_walk("{}", 2, NULL, NULL) == 2);
   ASSERT(json_walk(s1, strlen(s1), NULL, 0) > 0);
 
+  {
+    /* Special characters at every position of a long string */
+    char str[80];
+    int n;
+    for (i = 1; i < 75; i++) {
+      memset(str, 'x', sizeof(str));
+      str[0] = str[76] = '"';
+      str[i] = '\x01';
+      ASSERT(json_walk(str, 77, NULL, NULL) == JSON_STRING_INVALID);
+      str[i] = '\\';
+      str[i + 1] = 'n';
+      ASSERT(json_walk(str, 77, NULL, NULL) == 77);
+      str[i + 1] = 'q';
+      ASSERT(json_walk(str, 77, NULL, NULL) == JSON_STRING_INVALID);
+      /* Nothing after the backslash is looked at */
+      ASSERT(json_walk(str, i + 1, NULL, NULL) == JSON_STRING_INCOMPLETE);
+      memcpy(str + i, "\xd1\x8b", 2);
+      ASSERT(json_walk(str, 77, NULL, NULL) == 77);
+      ASSERT(json_walk(str, i + 1, NULL, NULL) == JSON_STRING_INCOMPLETE);
+      str[i] = '"';
+      ASSERT(json_walk(str, 77, NULL, NULL) == i + 1);
+    }
+    memset(str, 'x', sizeof(str));
+    str[0] = str[76] = '"';
+    for (n = 1; n < 77; n++) {
+      ASSERT(json_walk(str, n, NULL, NULL) == JSON_STRING_INCOMPLETE);
+    }
+  }
+
+  {
+    /* Nesting is limited to JSON_MAX_DEPTH levels */
+    int n = 1000000;
+    char *str = (char *) malloc(n);
+    memset(str, '[', n);
+    ASSERT(json_walk(str, n, NULL, NULL) == JSON_DEPTH_EXCEEDED);
+    memset(str, '{', n);
+    ASSERT(json_walk(str, n, NULL, NULL) == JSON_STRING_INVALID);
+    memset(str, '[', JSON_MAX_DEPTH);
+    memset(str + JSON_MAX_DEPTH, ']', JSON_MAX_DEPTH);
+    n = 0;
+    ASSERT(json_walk(str, JSON_MAX_DEPTH * 2, cb_count, &n) ==
+           JSON_MAX_DEPTH * 2);
+    ASSERT(n == JSON_MAX_DEPTH * 2);
+    memset(str, '[', JSON_MAX_DEPTH + 1);
+    memset(str + JSON_MAX_DEPTH + 1, ']', JSON_MAX_DEPTH + 1);
+    ASSERT(json_walk(str, JSON_MAX_DEPTH * 2 + 2, cb_count, &n) ==
+           JSON_DEPTH_EXCEEDED);
+    free(str);
+  }
+
+  {
+    /* Tighter limits at run time, capped by JSON_MAX_DEPTH */
+    const char *str = "[[[1]]]";
+    ASSERT(json_walk_ex(str, 7, NULL, NULL, JSON_WALK_MAX_DEPTH(2)) ==
+           JSON_DEPTH_EXCEEDED);
+    ASSERT(json_walk_ex(str, 7, NULL, NULL, JSON_WALK_MAX_DEPTH(3)) == 7);
+    ASSERT(json_walk_ex(str, 7, NULL, NULL,
+                        JSON_WALK_NO_PATH | JSON_WALK_MAX_DEPTH(1)) ==
+           JSON_DEPTH_EXCEEDED);
+    ASSERT(json_walk_ex("1", 1, NULL, NULL, JSON_WALK_MAX_DEPTH(1)) == 1);
+    ASSERT(json_walk_ex(str, 7, NULL, NULL,
+                        JSON_WALK_MAX_DEPTH(JSON_MAX_DEPTH + 1)) == 7);
+  }
+
   return NULL;
 }
 
@@ -148,6 +263,27 @@ static int print_my_struct(struct json_out *out, va_list *ap) {
   return json_printf(out, "{a: %d, b: %d}", p->a, p->b);
 }
 
+/* Printer that counts its calls in `u.buf.size`, and appends to `u.buf.buf` */
+static int count_printer(struct json_out *out, const char *buf, size_t len) {
+  memcpy(out->u.buf.buf + out->u.buf.len, buf, len);
+  out->u.buf.len += len;
+  out->u.buf.buf[out->u.buf.len] = '\0';
+  out->u.buf.size++;
+  return len;
+}
+
+/* Allocator for JSON_OUT_DYNBUF that counts calls, and fails above 1KB */
+static int num_reallocs;
+
+static void *limited_realloc(void *ptr, size_t size) {
+  num_reallocs++;
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+  return size > 1024 ? NULL : realloc(ptr, size);
+}
+
 static const char *test_json_printf(void) {
   char buf[200] = "";
 
@@ -277,6 +413,64 @@ static const char *test_json_printf(void) {
     ASSERT(strcmp(buf, result) == 0);
   }
 
+  {
+    struct json_out out = JSON_OUT_BUF(buf, sizeof(buf));
+    int8_t i8[] = {-128, 0, 127};
+    uint16_t u16[] = {65535, 1};
+    int64_t i64[] = {INT64_MIN, INT64_MAX};
+    float f[] = {0.1f, -2.5f};
+    double d[] = {0.1, 1e21, NAN};
+    bool b[] = {true, false};
+    const char *str[] = {"a\"b", NULL, ""};
+    const char *result =
+        "{\"a\": [-128, 0, 127], \"b\": [65535, 1], "
+        "\"c\": [-9223372036854775808, 9223372036854775807], "
+        "\"d\": [0.1, -2.5], \"e\": [0.1, 1e+21, null], "
+        "\"f\": [true, false], \"g\": [\"a\\\"b\", null, \"\"], \"h\": []}";
+    int n = json_printf(
+        &out, "{a: %M, b: %M, c: %M, d: %M, e: %M, f: %M, g: %M, h: %M}",
+        json_printf_array_int8, i8, (size_t) 3, json_printf_array_uint16, u16,
+        (size_t) 2, json_printf_array_int64, i64, (size_t) 2,
+        json_printf_array_float, f, (size_t) 2, json_printf_array_double, d,
+        (size_t) 3, json_printf_array_bool, b, (size_t) 2,
+        json_printf_array_string, str, (size_t) 3, json_printf_array_uint32,
+        NULL, (size_t) 0);
+    ASSERT(strcmp(buf, result) == 0);
+    ASSERT(n == (int) strlen(result));
+  }
+
+  {
+    /* Large arrays are printed in blocks */
+    struct json_out out = JSON_OUT_BUF(NULL, 0);
+    int32_t arr[1000];
+    int i, n;
+    for (i = 0; i < 1000; i++) arr[i] = i * 1000;
+    out.printer = count_printer;
+    out.u.buf.buf = (char *) malloc(10000);
+    n = json_printf(&out, "%M", json_printf_array_int32, arr, (size_t) 1000);
+    ASSERT(n == (int) out.u.buf.len);
+    ASSERT(out.u.buf.size < 20);
+    ASSERT(strncmp(out.u.buf.buf, "[0, 1000, 2000, ", 16) == 0);
+    ASSERT(strncmp(out.u.buf.buf + n - 9, ", 999000]", 9) == 0);
+    free(out.u.buf.buf);
+  }
+
+  {
+    struct json_out out = JSON_OUT_BUF(NULL, 0);
+    const char *str[200];
+    int i, n;
+    for (i = 0; i < 200; i++) str[i] = i % 2 ? "hello, world" : NULL;
+    out.printer = count_printer;
+    out.u.buf.buf = (char *) malloc(10000);
+    n = json_printf(&out, "%M", json_printf_array, str, sizeof(str),
+                    sizeof(str[0]), "%Q");
+    ASSERT(n == (int) out.u.buf.len);
+    ASSERT(n == 2 + 199 * 2 + 100 * 4 + 100 * 14);
+    ASSERT(out.u.buf.size < 10);
+    ASSERT(strncmp(out.u.buf.buf, "[null, \"hello, world\", null", 27) == 0);
+    free(out.u.buf.buf);
+  }
+
   {
     struct json_out out = JSON_OUT_BUF(buf, sizeof(buf));
     struct my_struct mys = {1, 2};
@@ -430,6 +624,128 @@ static const char *test_json_printf(void) {
     ASSERT(strcmp(buf, result) == 0);
   }
 
+  {
+    /* Plain runs are printed at once, wherever the escapes fall */
+    struct json_out out = {count_printer, {{buf, 0, 0, NULL}}};
+    char str[80];
+    int i;
+    ASSERT(json_escape(&out, "\x01\x1f\x7f\x0b", 4) == 20);
+    ASSERT(strcmp(buf, "\\u0001\\u001f\\u007f\\v") == 0);
+    for (i = 0; i < 70; i++) {
+      memset(str, 'a', sizeof(str));
+      memcpy(str + i, "\xd1\x8f\"", 3);
+      out.u.buf.len = out.u.buf.size = 0;
+      ASSERT(json_escape(&out, str, sizeof(str)) == (int) sizeof(str) + 1);
+      ASSERT(memcmp(buf + i, "\xd1\x8f\\\"", 4) == 0);
+      ASSERT(out.u.buf.size <= 3);
+    }
+  }
+
+  {
+    /* Native integers and shortest doubles */
+    struct json_out out = JSON_OUT_BUF(buf, sizeof(buf));
+    const char *result = "[-5, 42, -128, 65535, 18446744073709551615, 0.1, "
+                         "1e+21, null, 0.10, 7]";
+    ASSERT(json_printf(&out, "[%d, %i, %hhd, %hu, %llu, %D, %D, %D, %.2f, %D]",
+                       -5, 42, -128, 65535, (unsigned long long) UINT64_MAX,
+                       0.1, 1e21, NAN, 0.1, 7.0) == (int) strlen(result));
+    ASSERT(strcmp(buf, result) == 0);
+  }
+
+  {
+    /* A compiled format prints the same as json_printf(), with fewer calls */
+    const char *fmt =
+        "{id_1: %d, %Q: [%B, %.*Q], s: %M, v: %V, h: %H, f: %.2f, p: 100%%, "
+        "w: \"%*.*s\", n: %lld%n}";
+    struct json_printf_plan *plan = json_printf_compile(fmt);
+    struct my_struct mys = {1, 2};
+    char buf2[200];
+    struct json_out out = JSON_OUT_BUF(buf, sizeof(buf));
+    struct json_out out2 = JSON_OUT_BUF(buf2, sizeof(buf2));
+    const char *result =
+        "{\"id_1\": -7, \"k\": [true, \"ab\"], \"s\": {\"a\": 1, \"b\": 2}, "
+        "\"v\": \"YTI=\", \"h\": \"0aff\", \"f\": 1.50, \"p\": 100%, "
+        "\"w\": \"   ab\", \"n\": 123456789012}";
+    int n1 = 0, n2 = 0, len;
+
+    ASSERT(plan != NULL);
+    len = json_printf(&out, fmt, -7, "k", 1, 2, "abc", print_my_struct, &mys,
+                      "a2", 2, 2, "\x0a\xff", 1.5, 5, 2, "abc",
+                      (long long) 123456789012, &n1);
+    ASSERT(strcmp(buf, result) == 0 && len == (int) strlen(result));
+    ASSERT(json_printf_exec(&out2, plan, -7, "k", 1, 2, "abc", print_my_struct,
+                            &mys, "a2", 2, 2, "\x0a\xff", 1.5, 5, 2, "abc",
+                            (long long) 123456789012, &n2) == len);
+    ASSERT(strcmp(buf2, result) == 0);
+    ASSERT(n1 == len - 1 && n2 == n1);
+
+    /* The plan is reusable */
+    out2.u.buf.len = 0;
+    ASSERT(json_printf_exec(&out2, plan, 0, NULL, 0, 1, "x", print_my_struct,
+                            &mys, "", 0, 0, "", 0.0, 0, 0, "", 0LL, &n2) > 0);
+    ASSERT(strncmp(buf2, "{\"id_1\": 0, null: [false, \"x\"]", 30) == 0);
+    json_printf_plan_free(plan);
+
+    plan = json_printf_compile("");
+    ASSERT(plan != NULL && json_printf_exec(&out2, plan) == 0);
+    json_printf_plan_free(plan);
+  }
+
+  {
+    /* Buffered output coalesces small writes */
+    const char *fmt = "{a: %d, b: [%B, %Q]}", *result;
+    char stage[8], big[20];
+    struct json_out dest = {count_printer, {{buf, 0, 0, NULL}}};
+    struct json_out_buffered b;
+
+    result = "{\"a\": 1, \"b\": [true, \"x\"]}";
+    ASSERT(json_printf(&dest, fmt, 1, 1, "x") == (int) strlen(result));
+    ASSERT(strcmp(buf, result) == 0 && dest.u.buf.size > 15);
+
+    dest.u.buf.len = dest.u.buf.size = 0;
+    json_out_buffered_init(&b, &dest, stage, sizeof(stage));
+    ASSERT(json_printf(&b.out, fmt, 1, 1, "x") == (int) strlen(result));
+    ASSERT(dest.u.buf.len < strlen(result));
+    ASSERT(json_out_flush(&b) > 0 && json_out_flush(&b) == 0);
+    ASSERT(strcmp(buf, result) == 0 && dest.u.buf.size <= 5);
+
+    /* Writes larger than the buffer go straight through */
+    dest.u.buf.len = dest.u.buf.size = 0;
+    memset(big, 'x', sizeof(big));
+    ASSERT(json_printer_buffered(&b.out, "ab", 2) == 2);
+    ASSERT(json_printer_buffered(&b.out, big, sizeof(big)) == sizeof(big));
+    ASSERT(dest.u.buf.size == 2 && dest.u.buf.len == 2 + sizeof(big));
+    ASSERT(json_out_flush(&b) == 0);
+  }
+
+  {
+    /* Heap output grows as needed, and keeps its memory when reset */
+    struct json_out out = JSON_OUT_DYNBUF(NULL);
+    struct json_out out2 = JSON_OUT_DYNBUF(limited_realloc);
+    char *p;
+    int i, n = 0;
+
+    for (i = 0; i < 100; i++) n += json_printf(&out, "[%d, %Q]", i, "abc");
+    ASSERT(out.u.buf.len == (size_t) n && strlen(out.u.buf.buf) == (size_t) n);
+    ASSERT(strcmp(out.u.buf.buf + n - 11, "[99, \"abc\"]") == 0);
+    p = out.u.buf.buf;
+    json_out_dynbuf_reset(&out);
+    ASSERT(out.u.buf.len == 0 && out.u.buf.buf[0] == '\0');
+    ASSERT(json_printf(&out, "{a: %d}", 1) == 8);
+    ASSERT(out.u.buf.buf == p && strcmp(p, "{\"a\": 1}") == 0);
+    json_out_dynbuf_free(&out);
+    ASSERT(out.u.buf.buf == NULL && out.u.buf.size == 0);
+
+    /* When the allocator fails, the output is truncated */
+    num_reallocs = 0;
+    for (i = 0, n = 0; i < 100; i++) n += json_printf(&out2, "%d,", i);
+    ASSERT(n == 290 && out2.u.buf.len == 290 && num_reallocs == 2);
+    for (i = 0; i < 300; i++) n += json_printf(&out2, "%d,", i);
+    ASSERT(n == 1380 && out2.u.buf.len == 1024 && out2.u.buf.size == 1024);
+    ASSERT(strlen(out2.u.buf.buf) == 1023);
+    json_out_dynbuf_free(&out2);
+  }
+
   return NULL;
 }
 
@@ -476,6 +792,79 @@ static const char *test_callback_api(void) {
   return NULL;
 }
 
+static int cb_ex(void *data, const char *name, size_t name_len,
+                 const char *path, const struct json_token *token) {
+  cb(data, name, name_len, path, token);
+  if (strcmp(path, ".a") == 0) return JSON_WALK_SKIP_SUBTREE;
+  if (strcmp(path, ".c") == 0) return JSON_WALK_SKIP_SUBTREE;
+  if (strcmp(path, ".d") == 0) return JSON_WALK_STOP;
+  return JSON_WALK_CONTINUE;
+}
+
+static int cb_no_path(void *data, const char *name, size_t name_len,
+                      const char *path, const struct json_token *token) {
+  char *buf = (char *) data;
+  sprintf(buf + strlen(buf), "%s%.*s:%s ", path == NULL ? "" : "path!",
+          (int) (name == NULL ? 1 : name_len), name == NULL ? "-" : name,
+          tok_type_names[token->type]);
+  return JSON_WALK_CONTINUE;
+}
+
+static const char *test_walk_ex(void) {
+  const char *s = "{\"a\": [1, {\"x\": \"]}\"}], \"b\": {\"y\": 2}, \"c\": 3, "
+                  "\"d\": \"z\", \"e\": 4}";
+  const char *result =
+      "name:'<null>', path:'', type:OBJECT_START, val:'<null>'\n"
+      "name:'a', path:'.a', type:ARRAY_START, val:'<null>'\n"
+      "name:'b', path:'.b', type:OBJECT_START, val:'<null>'\n"
+      "name:'y', path:'.b.y', type:NUMBER, val:'2'\n"
+      "name:'<null>', path:'.b', type:OBJECT_END, val:'{\"y\": 2}'\n"
+      "name:'c', path:'.c', type:NUMBER, val:'3'\n"
+      "name:'d', path:'.d', type:STRING, val:'z'\n";
+  char buf[4096] = "";
+
+  ASSERT(json_walk_ex(s, strlen(s), cb_ex, buf, 0) ==
+         (int) (strstr(s, "\"z\"") - s + 3));
+  ASSERT(strcmp(buf, result) == 0);
+
+  /* Skipped subtrees must still be complete */
+  ASSERT(json_walk_ex(s, 20, cb_ex, buf, 0) == JSON_STRING_INCOMPLETE);
+
+  {
+    /* Skip containers spanning several blocks, with brackets in strings */
+    char big[600];
+    int i, n = 0;
+    n += sprintf(big + n, "{\"a\": [");
+    for (i = 0; i < 20; i++) {
+      n += sprintf(big + n, "{\"s\\\\\": \"}\\\\\\\"]\"}, ");
+    }
+    n += sprintf(big + n, "%*s[]], \"d\": 1}", 70, "");
+    buf[0] = '\0';
+    ASSERT(json_walk_ex(big, n, cb_ex, buf, 0) == n - 1);
+    ASSERT(strstr(buf, "path:'.d', type:NUMBER") != NULL);
+    ASSERT(strstr(buf, ".a[") == NULL);
+    ASSERT(json_walk_ex(big, n - 15, cb_ex, buf, 0) ==
+           JSON_STRING_INCOMPLETE);
+  }
+
+  /* Stop right after the value, before the end of the enclosing object */
+  ASSERT(json_walk_ex("{\"d\": 1} ", 9, cb_ex, buf, 0) == 7);
+  ASSERT(json_walk_ex("{\"d\": 1 ", 8, cb_ex, buf, 0) == 7);
+
+  {
+    /* Without the path, array elements have no name */
+    const char *s2 = "{\"a\": [1, {x: true}], \"\": 2, b: {}}";
+    buf[0] = '\0';
+    ASSERT(json_walk_ex(s2, strlen(s2), cb_no_path, buf, JSON_WALK_NO_PATH) ==
+           (int) strlen(s2));
+    ASSERT(strcmp(buf,
+                  "-:OBJECT_START a:ARRAY_START -:NUMBER -:OBJECT_START "
+                  "x:TRUE -:OBJECT_END -:ARRAY_END :NUMBER b:OBJECT_START "
+                  "-:OBJECT_END -:OBJECT_END ") == 0);
+  }
+  return NULL;
+}
+
 /*
  * Tests with the path which is longer than JSON_MAX_PATH_LEN (at the moment,
  * 60)
@@ -627,6 +1016,33 @@ static const char *test_scanf(void) {
     ASSERT(json_scanf_array_elem(str, strlen(str), ".a", 3, &t) == -1);
   }
 
+  {
+    /* Whole arrays in one pass */
+    const char *str =
+        "{a: [\"foo\", {b: [1]}, 3], n: [1, -2, 3e2], i: [7, 8, 9], x: {}}";
+    int len = strlen(str);
+    struct json_token t[3];
+    int64_t iv[3];
+    double dv[3];
+    ASSERT(json_scanf_array(str, len, ".a", NULL, 0) == 3);
+    ASSERT(json_scanf_array(str, len, ".a", t, 2) == 3);
+    ASSERT(t[0].type == JSON_TYPE_STRING && t[0].len == 3);
+    ASSERT(t[1].type == JSON_TYPE_OBJECT_END && t[1].len == 8);
+    ASSERT(json_scanf_array(str, len, ".x", t, 3) == JSON_STRING_INVALID);
+    ASSERT(json_scanf_array(str, len, ".y", t, 3) == JSON_STRING_INVALID);
+    ASSERT(json_scanf_array(str, 20, ".a", t, 3) == JSON_STRING_INCOMPLETE);
+    ASSERT(json_scanf_array("[]", 2, "", t, 3) == 0);
+
+    ASSERT(json_scanf_array_double(str, len, ".n", dv, 3) == 3);
+    ASSERT(dv[0] == 1 && dv[1] == -2 && dv[2] == 300);
+    ASSERT(json_scanf_array_int64(str, len, ".i", iv, 3) == 3);
+    ASSERT(iv[0] == 7 && iv[1] == 8 && iv[2] == 9);
+    ASSERT(json_scanf_array_int64(str, len, ".n", iv, 3) ==
+           JSON_STRING_INVALID);
+    ASSERT(json_scanf_array_double(str, len, ".a", dv, 3) ==
+           JSON_STRING_INVALID);
+  }
+
   {
     const char *str = "{a : \"foo\\b\\f\\n\\r\\t\\\\\" }";
     char *result;
@@ -675,6 +1091,64 @@ static const char *test_scanf(void) {
     free(result);
   }
 
+  {
+    /* Base64 blobs long enough for the vectorised codec, or malformed */
+    const char *str = "{a: \"YWJj\", b: \"YW*j\", c: \"YQ\"}";
+    unsigned char data[100];
+    char enc[JSON_BASE64_ENC_LEN(100) + 1], big[200], *result = NULL;
+    int i, n, len = -1;
+
+    for (i = 0; i < (int) sizeof(data); i++) data[i] = (unsigned char) (i * 7);
+    for (n = 0; n <= (int) sizeof(data); n += 11) {
+      struct json_out out = JSON_OUT_BUF(big, sizeof(big));
+      json_printf(&out, "{a: %V}", data, n);
+      ASSERT(json_scanf(big, strlen(big), "{a: %V}", &result, &len) == 1);
+      ASSERT(len == n && memcmp(result, data, n) == 0);
+      free(result);
+      ASSERT(json_base64_encode(data, n, enc) == JSON_BASE64_ENC_LEN(n));
+      enc[n / 2] = '.';
+      ASSERT(n == 0 ||
+             json_base64_decode(enc, JSON_BASE64_ENC_LEN(n),
+                                (unsigned char *) big) == JSON_STRING_INVALID);
+    }
+
+    ASSERT(json_scanf(str, strlen(str), "{b: %V}", &result, &len) == 0);
+    ASSERT(result == NULL && len == 0);
+    ASSERT(json_scanf(str, strlen(str), "{c: %V}", &result, &len) == 1);
+    ASSERT(len == 1 && strcmp(result, "a") == 0);
+    free(result);
+    ASSERT(json_base64_decode("YWJjZ", 5, data) == JSON_STRING_INVALID);
+    ASSERT(json_base64_decode("YW=j", 4, data) == JSON_STRING_INVALID);
+  }
+
+  {
+    /* Hex blobs long enough for the vectorised codec, or malformed */
+    const char *str = "{a: \"0aFf\", b: \"0g\", c: \"abc\"}";
+    unsigned char data[100], dec[100];
+    char big[300], *result = NULL;
+    int i, n, len = -1;
+
+    for (i = 0; i < (int) sizeof(data); i++) data[i] = (unsigned char) (i * 7);
+    for (n = 0; n <= (int) sizeof(data); n += 11) {
+      struct json_out out = JSON_OUT_BUF(big, sizeof(big));
+      json_printf(&out, "{a: %H}", n, data);
+      ASSERT(json_scanf(big, strlen(big), "{a: %H}", &len, &result) == 1);
+      ASSERT(len == n && memcmp(result, data, n) == 0);
+      free(result);
+      big[2 * n / 3 + 6] = 'x';
+      ASSERT(n == 0 || json_hex_decode(big + 6, 2 * n, dec) ==
+                           JSON_STRING_INVALID);
+    }
+
+    ASSERT(json_scanf(str, strlen(str), "{a: %H}", &len, &result) == 1);
+    ASSERT(len == 2 && memcmp(result, "\x0a\xff", 3) == 0);
+    free(result);
+    ASSERT(json_scanf(str, strlen(str), "{b: %H}", &len, &result) == 0);
+    ASSERT(result == NULL && len == 0);
+    ASSERT(json_scanf(str, strlen(str), "{c: %H}", &len, &result) == 0);
+    ASSERT(result == NULL);
+  }
+
   {
     const char *str = "{a : null }";
     char *result = (char *) 123;
@@ -707,6 +1181,205 @@ static const char *test_scanf(void) {
     ASSERT(fc == c);
   }
 
+  {
+    /* Integers are exact, and long numbers are not dropped */
+    const char *str =
+        "{a: -9223372036854775807, b: 18446744073709551615, c: -1, d: 2.9,"
+        " e: 0.1000000000000000000000000000000000001, f: \"12\"}";
+    long long a = 0;
+    unsigned long long b = 0;
+    unsigned c = 0;
+    int d = 0, f = 0;
+    double e = 0;
+    ASSERT(json_scanf(str, strlen(str), "{a: %lld, b: %llu, c: %u, d: %d, "
+                      "e: %lf, f: %d}", &a, &b, &c, &d, &e, &f) == 6);
+    ASSERT(a == -9223372036854775807LL);
+    ASSERT(b == 18446744073709551615ULL);
+    ASSERT(c == (unsigned) -1);
+    ASSERT(d == 2);
+    ASSERT(e == 0.1);
+    ASSERT(f == 12);
+  }
+
+  {
+    /* Strings and blobs allocated from an arena, or unescaped in place */
+    const char *str =
+        "{a: \"x\\ty\", b: \"aGVsbG8=\", c: \"fa01\", d: null, e: \"long\"}";
+    char mem[64], buf[5], *a = NULL, *b = NULL, *c = NULL;
+    int b_len = 0, c_len = 0;
+    struct json_arena arena;
+
+    json_arena_init(&arena, mem, sizeof(mem));
+    ASSERT(json_scanf_arena(str, strlen(str), &arena, "{a: %Q, b: %V, c: %H}",
+                            &a, &b, &b_len, &c_len, &c) == 3);
+    ASSERT(strcmp(a, "x\ty") == 0);
+    ASSERT(b_len == 5 && strcmp(b, "hello") == 0);
+    ASSERT(c_len == 2 && memcmp(c, "\xfa\x01", 3) == 0);
+    ASSERT(a >= mem && c < mem + sizeof(mem) && arena.chunks == NULL);
+    /* When the caller memory is used up, heap chunks take over */
+    a = (char *) json_arena_alloc(&arena, sizeof(mem));
+    ASSERT(a != NULL && arena.chunks != NULL);
+    ASSERT(json_arena_alloc(&arena, 1) != NULL);
+    ASSERT(((uintptr_t) json_arena_alloc(&arena, 8) % sizeof(void *)) == 0);
+    json_arena_reset(&arena);
+    ASSERT(arena.chunks == NULL && json_arena_alloc(&arena, 1) == mem);
+    json_arena_reset(&arena);
+
+    json_arena_init(&arena, NULL, 0);
+    ASSERT(json_scanf_arena(str, strlen(str), &arena, "{a: %Q}", &a) == 1);
+    ASSERT(strcmp(a, "x\ty") == 0);
+    json_arena_reset(&arena);
+
+    memset(buf, 'z', sizeof(buf));
+    ASSERT(json_scanf(str, strlen(str), "{a: %.*Q}", (int) sizeof(buf),
+                      buf) == 1);
+    ASSERT(strcmp(buf, "x\ty") == 0);
+    ASSERT(json_scanf(str, strlen(str), "{d: %.*Q}", (int) sizeof(buf),
+                      buf) == 0);
+    ASSERT(buf[0] == '\0');
+    ASSERT(json_scanf(str, strlen(str), "{e: %.*Q, a: %.*Q}", 4, buf, 0,
+                      NULL) == 0);
+    ASSERT(strcmp(buf, "lon") == 0);
+  }
+
+  {
+    /* Scans into an arena over caller memory do not touch the heap */
+    const char *str =
+        "{a: 1, b: 2, c: 3, d: 4, e: 5, f: 6, g: 7, h: 8, i: 9, j: 10, k: 11,"
+        " l: 12, m: 13, n: 14, o: 15, p: 16, q: 17, r: \"x\","
+        " s: {t: {u: {v: {w: {x: {y: {z: {zz: true}}}}}}}}}";
+    static char mem[16384];
+    int v[17], n;
+    char *r = NULL;
+    bool zz = false;
+    struct json_arena arena;
+
+    json_arena_init(&arena, mem, sizeof(mem));
+    static_num_allocs = 0;
+    ASSERT(json_scanf_arena(str, strlen(str), &arena, "{a: %d, r: %Q}", &v[0],
+                            &r) == 2);
+    ASSERT(static_num_allocs == 0);
+    ASSERT(v[0] == 1 && strcmp(r, "x") == 0);
+
+    /* Larger than the conversions, trie and levels kept on the stack */
+    n = json_scanf_arena(
+        str, strlen(str), &arena,
+        "{a:%d, b:%d, c:%d, d:%d, e:%d, f:%d, g:%d, h:%d, i:%d, j:%d, k:%d, "
+        "l:%d, m:%d, n:%d, o:%d, p:%d, q:%d, r: %Q, "
+        "s: {t: {u: {v: {w: {x: {y: {z: {zz: %B}}}}}}}}}",
+        &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9],
+        &v[10], &v[11], &v[12], &v[13], &v[14], &v[15], &v[16], &r, &zz);
+    ASSERT(n == 19);
+    ASSERT(static_num_allocs == 0);
+    ASSERT(v[16] == 17 && strcmp(r, "x") == 0 && zz == true);
+    ASSERT(arena.chunks == NULL);
+    json_arena_reset(&arena);
+  }
+
+  {
+    /* A compiled format reused on several documents */
+    const char *docs[] = {
+        "{a: 1, b: \"one\", c: [1], d: 1.5, e: \"x\"}",
+        "{a: 2, b: \"two\", c: [2, 2], d: 2.5}",
+        "{e: \"y\", b: \"three\", a: 3}",
+    };
+    struct json_scanf_plan *plan =
+        json_scanf_compile("{a: %d, b: %.*Q, c: %M, x[: %d, d: %f, e: %Q}");
+    char buf[8], arr[8] = "", mem[64], *e;
+    int i, a, x, counts[3] = {5, 4, 3};
+    float d;
+    struct json_arena arena;
+
+    ASSERT(plan != NULL);
+    json_arena_init(&arena, mem, sizeof(mem));
+    for (i = 0; i < 3; i++) {
+      const char *s = docs[i];
+      a = x = 0;
+      d = 0;
+      e = NULL;
+      static_num_allocs = 0;
+      ASSERT(json_scanf_exec(plan, s, strlen(s), &arena, &a, (int) sizeof(buf),
+                             buf, scan_array, arr, &x, &d, &e) == counts[i]);
+      ASSERT(static_num_allocs == 0);
+      ASSERT(a == i + 1 && x == 0);
+      ASSERT(strcmp(buf, i == 0 ? "one" : i == 1 ? "two" : "three") == 0);
+      ASSERT(d == (i == 2 ? 0 : i + 1.5f));
+      ASSERT(i == 1 ? e == NULL : e[0] == (i == 0 ? 'x' : 'y'));
+      json_arena_reset(&arena);
+    }
+    ASSERT(json_scanf_exec(plan, docs[0], strlen(docs[0]), NULL, &a,
+                           (int) sizeof(buf), buf, scan_array, arr, &x, &d,
+                           &e) == 5);
+    ASSERT(strcmp(e, "x") == 0 && arr[0] == '\0');
+    free(e);
+    json_scanf_plan_free(plan);
+  }
+
+  {
+    /* More conversions than fit on the stack, including a repeated path */
+    const char *str =
+        "{a: 1, b: 2, c: 3, d: 4, e: 5, f: 6, g: 7, h: 8, i: 9, j: 10, k: 11,"
+        " l: 12, m: 13, n: 14, o: 15, p: 16, q: 17, r: 18, s: {t: true}}";
+    int v[20], i;
+    bool t = false;
+    memset(v, 0, sizeof(v));
+    ASSERT(json_scanf(str, strlen(str),
+                      "{a:%d, b:%d, c:%d, d:%d, e:%d, f:%d, g:%d, h:%d, i:%d, "
+                      "j:%d, k:%d, l:%d, m:%d, n:%d, o:%d, p:%d, q:%d, r:%d, "
+                      "a:%d, s: {t: %B}}",
+                      &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7],
+                      &v[8], &v[9], &v[10], &v[11], &v[12], &v[13], &v[14],
+                      &v[15], &v[16], &v[17], &v[18], &t) == 20);
+    for (i = 0; i < 18; i++) ASSERT(v[i] == i + 1);
+    ASSERT(v[18] == 1);
+    ASSERT(t == true);
+  }
+
+  {
+    /* A number conversion followed by '}' closes its object */
+    const char *str = "{a: {b: 1, c: [2]}, d: {b: 3}, a: {b: 4}}";
+    int a = 0, d = 0;
+    ASSERT(json_scanf(str, strlen(str), "{a: {b: %d}, d: {b: %d}}", &a, &d) ==
+           2);
+    /* The first of duplicate keys is taken */
+    ASSERT(a == 1);
+    ASSERT(d == 3);
+  }
+
+  {
+    /* Each conversion is done once, with the first of duplicate keys */
+    const char *str =
+        "{a: 1, s: \"x\", o: {b: true}, a: 2, s: \"y\", o: {b: false}}";
+    const char *fmt = "{a: %d, s: %Q, o: {b: %B}}";
+    struct json_scanf_plan *plan = json_scanf_compile(fmt);
+    char *s = NULL;
+    int a = 0, b = 0;
+    ASSERT(json_scanf(str, strlen(str), fmt, &a, &s, &b) == 3);
+    ASSERT(a == 1);
+    ASSERT(s != NULL && strcmp(s, "x") == 0);
+    ASSERT(b == 1);
+    free(s);
+    s = NULL;
+    ASSERT(plan != NULL);
+    ASSERT(json_scanf_exec(plan, str, strlen(str), NULL, &a, &s, &b) == 3);
+    ASSERT(a == 1);
+    ASSERT(s != NULL && strcmp(s, "x") == 0);
+    ASSERT(b == 1);
+    free(s);
+    json_scanf_plan_free(plan);
+  }
+
+  {
+    /* Paths deeper than the levels kept on the stack */
+    const char *str = "{a:{b:{c:{d:{e:{f:{g:{h:{i:{j:7}}}}}}}}}, k: 8}";
+    int j = 0, k = 0;
+    ASSERT(json_scanf(str, strlen(str),
+                      "{a:{b:{c:{d:{e:{f:{g:{h:{i:{j:%d}}}}}}}}}, k: %d}", &j,
+                      &k) == 2);
+    ASSERT(j == 7);
+    ASSERT(k == 8);
+  }
+
   return NULL;
 }
 
@@ -779,6 +1452,62 @@ static const char *test_fprintf(void) {
   return NULL;
 }
 
+static const char *test_json_map_file(void) {
+  const char *fname = "a.json";
+  struct json_file f;
+  int a = 0, i;
+
+  ASSERT(json_fprintf(fname, "{a:%d}", 123) > 0);
+  ASSERT(json_map_file(&f, fname, 0) == 0);
+  ASSERT(f.len == 10 && memcmp(f.data, "{\"a\":123}\n", 10) == 0);
+  ASSERT(json_scanf(f.data, f.len, "{a: %d}", &a) == 1 && a == 123);
+  json_unmap_file(&f);
+  ASSERT(f.data == NULL && f.len == 0);
+
+  {
+    /* Larger than the read buffer, and compared with json_fread() */
+    FILE *fp = fopen(fname, "wb");
+    struct json_out out = JSON_OUT_FILE(fp);
+    int arr[3000];
+    char *p;
+    for (i = 0; i < 3000; i++) arr[i] = i;
+    json_printf(&out, "%M", json_printf_array_int32, arr, (size_t) 3000);
+    fclose(fp);
+    ASSERT((p = json_fread(fname)) != NULL);
+    ASSERT(json_map_file(&f, fname, JSON_MAP_POPULATE) == 0);
+    ASSERT(f.len == strlen(p) && f.len > JSON_FILE_BUF_SIZE);
+    ASSERT(memcmp(f.data, p, f.len) == 0);
+    ASSERT(json_walk(f.data, f.len, NULL, NULL) == (int) f.len);
+    ASSERT(json_scanf_array(f.data, f.len, "", NULL, 0) == 3000);
+    json_unmap_file(&f);
+    free(p);
+  }
+
+  {
+    FILE *fp = fopen(fname, "wb");
+    fclose(fp);
+    ASSERT(json_map_file(&f, fname, 0) == 0 && f.len == 0);
+    json_unmap_file(&f);
+  }
+
+  remove(fname);
+  ASSERT(json_map_file(&f, fname, 0) == -1 && f.data == NULL);
+
+#ifdef __linux__
+  {
+    /* Files of /proc have no size, they are read to the end */
+    char *p = json_fread("/proc/self/status");
+    ASSERT(p != NULL && strlen(p) > 0);
+    ASSERT(json_map_file(&f, "/proc/self/status", 0) == 0);
+    ASSERT(f.len > 0 && memcmp(f.data, p, 5) == 0);
+    json_unmap_file(&f);
+    free(p);
+  }
+#endif
+
+  return NULL;
+}
+
 static const char *test_json_setf(void) {
   char buf[200];
   const char *s1 = "{ \"a\": 123, \"b\": [ 1 ], \"c\": true }";
@@ -877,6 +1606,15 @@ static const char *test_json_setf(void) {
     ASSERT(strcmp(buf, s2) == 0);
   }
 
+  {
+    /* Add keys longer than one character, and into an empty object */
+    struct json_out out = JSON_OUT_BUF(buf, sizeof(buf));
+    const char *s = "{\"a\": {}, \"bc\": 1}";
+    int res = json_setf(s, strlen(s), &out, ".a.cd", "%d", 2);
+    ASSERT(res == 0);
+    ASSERT(strcmp(buf, "{\"a\": {\"cd\":2}, \"bc\": 1}") == 0);
+  }
+
   {
     /* Create array and push value  */
     struct json_out out = JSON_OUT_BUF(buf, sizeof(buf));
@@ -998,18 +1736,760 @@ static const char *test_json_next(void) {
   return NULL;
 }
 
+static const char *test_json_iter(void) {
+  const char *s =
+      "{ \"a\": [], b: [ 1, {\"x\": [2]}, \"y\" ], \"c\": {\"d\": true} }";
+  struct json_iter it;
+  struct json_token key, val;
+  char buf[100];
+  int len = strlen(s);
+
+  {
+    /* Traverse an object, skipping nested values */
+    int i = 0;
+    const char *results[] = {"[a] -> [[]]",
+                             "[b] -> [[ 1, {\"x\": [2]}, \"y\" ]]",
+                             "[c] -> [{\"d\": true}]"};
+    ASSERT(json_iter_init(&it, s, len, "") == 0);
+    ASSERT(it.is_array == 0);
+    while (json_iter_next(&it, &key, &val) > 0) {
+      snprintf(buf, sizeof(buf), "[%.*s] -> [%.*s]", key.len, key.ptr, val.len,
+               val.ptr);
+      ASSERT(strcmp(results[i], buf) == 0);
+      i++;
+    }
+    ASSERT(i == 3);
+    ASSERT(json_iter_next(&it, &key, &val) == 0);
+  }
+
+  {
+    /* Traverse an array */
+    ASSERT(json_iter_init(&it, s, len, ".b") == 0);
+    ASSERT(it.is_array == 1);
+    ASSERT(json_iter_next(&it, &key, &val) == 1);
+    ASSERT(key.ptr == NULL && it.idx == 1);
+    ASSERT(val.type == JSON_TYPE_NUMBER && val.len == 1 && val.ptr[0] == '1');
+    ASSERT(json_iter_next(&it, NULL, &val) == 1);
+    ASSERT(val.type == JSON_TYPE_OBJECT_END && val.len == 10);
+    ASSERT(json_iter_next(&it, NULL, &val) == 1);
+    ASSERT(val.type == JSON_TYPE_STRING && val.len == 1 && val.ptr[0] == 'y');
+    ASSERT(json_iter_next(&it, NULL, NULL) == 0);
+    ASSERT(it.idx == 3);
+    /* A finished iterator stays at the end of its array */
+    ASSERT(json_iter_next(&it, &key, &val) == 0);
+    ASSERT(it.idx == 3 && *it.cur == ']');
+  }
+
+  {
+    /* Nested paths */
+    ASSERT(json_iter_init(&it, s, len, ".b[1].x") == 0);
+    ASSERT(it.is_array == 1);
+    ASSERT(json_iter_next(&it, NULL, &val) == 1);
+    ASSERT(val.type == JSON_TYPE_NUMBER && val.ptr[0] == '2');
+    ASSERT(json_iter_next(&it, NULL, &val) == 0);
+
+    ASSERT(json_iter_init(&it, s, len, ".c") == 0);
+    ASSERT(json_iter_next(&it, &key, &val) == 1);
+    ASSERT(key.len == 1 && key.ptr[0] == 'd' && val.type == JSON_TYPE_TRUE);
+  }
+
+  {
+    /* Errors */
+    ASSERT(json_iter_init(&it, s, len, ".x") == JSON_STRING_INVALID);
+    ASSERT(json_iter_init(&it, s, len, ".b[5]") == JSON_STRING_INVALID);
+    ASSERT(json_iter_init(&it, s, len, "[0]") == JSON_STRING_INVALID);
+    ASSERT(json_iter_init(&it, s, len, ".b[0]") == JSON_STRING_INVALID);
+  }
+
+  {
+    /* Truncated and non-numeric index segments */
+    const char *s2 = "{\"a\":[1,2,{\"b\":3}]}";
+    struct json_token tok;
+    ASSERT(json_iter_init(&it, s2, strlen(s2), ".a[2]") == 0);
+    ASSERT(json_iter_init(&it, s2, strlen(s2), ".a[2") == JSON_STRING_INVALID);
+    ASSERT(json_iter_init(&it, s2, strlen(s2), ".a[") == JSON_STRING_INVALID);
+    ASSERT(json_iter_init(&it, s2, strlen(s2), ".a[]") == JSON_STRING_INVALID);
+    ASSERT(json_iter_init(&it, s2, strlen(s2), ".a[x]") == JSON_STRING_INVALID);
+    ASSERT(json_iter_init(&it, s2, strlen(s2), ".a[2x]") ==
+           JSON_STRING_INVALID);
+    ASSERT(json_next_elem(s2, strlen(s2), NULL, ".a[2", NULL, &tok) == NULL);
+    ASSERT(json_scanf_array(s2, strlen(s2), ".a[2", NULL, 0) ==
+           JSON_STRING_INVALID);
+  }
+
+  {
+    ASSERT(json_iter_init(&it, s, 0, "") == JSON_STRING_INCOMPLETE);
+    ASSERT(json_iter_init(&it, s, 30, ".c") == JSON_STRING_INCOMPLETE);
+    ASSERT(json_iter_init(&it, "[1, x]", 6, "") == 0);
+    ASSERT(json_iter_next(&it, NULL, NULL) == 1);
+    ASSERT(json_iter_next(&it, NULL, NULL) == JSON_STRING_INVALID);
+    ASSERT(json_iter_init(&it, "{a 1}", 5, "") == 0);
+    ASSERT(json_iter_next(&it, NULL, NULL) == JSON_STRING_INVALID);
+    ASSERT(json_iter_init(&it, "{1: 1}", 6, "") == 0);
+    ASSERT(json_iter_next(&it, NULL, NULL) == JSON_STRING_INVALID);
+    ASSERT(json_iter_init(&it, "{\"a\": [1, \"]\"", 14, "") == 0);
+    ASSERT(json_iter_next(&it, NULL, NULL) == JSON_STRING_INCOMPLETE);
+  }
+
+  return NULL;
+}
+
+static const char *test_json_tape(void) {
+  const char *s =
+      "{ \"a\": [], b: [ 1, {\"x\": [2]}, \"y\" ], \"c\": {\"d\": true} }";
+  struct json_tape_token tape[20];
+  char buf[100];
+  int len = strlen(s), n, i;
+
+  {
+    /* Token layout */
+    ASSERT((n = json_tokenize(s, len, tape, 20)) == 10);
+    ASSERT(json_tokenize(s, len, NULL, 0) == 10);
+    ASSERT(tape[0].type == JSON_TYPE_OBJECT_END && tape[0].offset == 0 &&
+           tape[0].len == len && tape[0].parent == -1 && tape[0].next == 10 &&
+           tape[0].key_offset == -1);
+    ASSERT(tape[1].type == JSON_TYPE_ARRAY_END && tape[1].parent == 0 &&
+           tape[1].next == 2 && tape[1].key_len == 1 &&
+           s[tape[1].key_offset] == 'a');
+    ASSERT(tape[2].type == JSON_TYPE_ARRAY_END && tape[2].next == 8);
+    ASSERT(tape[3].type == JSON_TYPE_NUMBER && tape[3].parent == 2 &&
+           tape[3].key_offset == -1 && s[tape[3].offset] == '1');
+    ASSERT(tape[4].type == JSON_TYPE_OBJECT_END && tape[4].len == 10 &&
+           tape[4].next == 7);
+    ASSERT(tape[6].type == JSON_TYPE_NUMBER && tape[6].parent == 5);
+    ASSERT(tape[7].type == JSON_TYPE_STRING && tape[7].len == 1 &&
+           s[tape[7].offset] == 'y');
+    ASSERT(tape[9].type == JSON_TYPE_TRUE && tape[9].parent == 8);
+  }
+
+  {
+    /* Lookups and iteration */
+    ASSERT(json_tape_find(s, tape, n, "") == 0);
+    ASSERT(json_tape_find(s, tape, n, ".b") == 2);
+    ASSERT(json_tape_find(s, tape, n, ".b[1].x[0]") == 6);
+    ASSERT(json_tape_find(s, tape, n, ".c.d") == 9);
+    ASSERT(json_tape_find(s, tape, n, ".x") == -1);
+    ASSERT(json_tape_find(s, tape, n, ".b[3]") == -1);
+    ASSERT(json_tape_find(s, tape, n, "[0]") == -1);
+    ASSERT(json_tape_find(s, tape, n, ".c.d.e") == -1);
+    ASSERT(json_tape_find(s, tape, 4, ".c") == -1);
+    ASSERT(json_tape_find(s, tape, n, ".b[1") == -1);
+    ASSERT(json_tape_find(s, tape, n, ".b[]") == -1);
+    ASSERT(json_tape_find(s, tape, n, ".b[x]") == -1);
+    ASSERT(json_tape_find(s, tape, n, ".b[1x]") == -1);
+
+    buf[0] = '\0';
+    for (i = json_tape_next(tape, n, 0, -1); i >= 0;
+         i = json_tape_next(tape, n, 0, i)) {
+      sprintf(buf + strlen(buf), "%.*s:%d ", tape[i].key_len,
+              s + tape[i].key_offset, i);
+    }
+    ASSERT(strcmp(buf, "a:1 b:2 c:8 ") == 0);
+    ASSERT(json_tape_next(tape, n, 1, -1) == -1);
+    ASSERT(json_tape_next(tape, n, 3, -1) == -1);
+  }
+
+  {
+    /* Tape that is too small, and errors */
+    ASSERT(json_tokenize(s, len, tape, 5) == 10);
+    ASSERT(tape[0].next == 10 && tape[2].next == 8 && tape[4].next == 7);
+    ASSERT(json_tape_find(s, tape, 5, ".b[1]") == 4);
+    ASSERT(json_tape_find(s, tape, 5, ".b[2]") == -1);
+    ASSERT(json_tokenize(s, 30, tape, 20) == JSON_STRING_INCOMPLETE);
+    ASSERT(json_tokenize("[1, x]", 6, tape, 20) == JSON_STRING_INVALID);
+  }
+
+  {
+    /* scanf */
+    int a = 0, d = 0;
+    char *y = NULL;
+    struct json_token t;
+    const char *s2 = "{a: 1, b: {c: \"foo\", d: [2]}, e: true}";
+    n = json_tokenize(s2, strlen(s2), tape, 20);
+    ASSERT(json_tape_scanf(s2, tape, n, "{a: %d, b: {c: %Q, d: %T}, e: %B}",
+                           &a, &y, &t, &d) == 4);
+    ASSERT(a == 1 && d == 1 && y != NULL && strcmp(y, "foo") == 0);
+    ASSERT(t.type == JSON_TYPE_ARRAY_END && t.len == 3);
+    free(y);
+    ASSERT(json_tape_scanf(s2, tape, n, "{x: %d}", &a) == 0);
+  }
+
+  {
+    /* setf */
+    const char *s2 = "{\"a\": \"x\", \"b\": [1, 2], \"c\": 3}";
+    struct json_out out = JSON_OUT_BUF(buf, sizeof(buf));
+    n = json_tokenize(s2, strlen(s2), tape, 20);
+
+    ASSERT(json_tape_setf(s2, strlen(s2), tape, n, &out, ".a", "%Q", "y") == 1);
+    ASSERT(strcmp(buf, "{\"a\": \"y\", \"b\": [1, 2], \"c\": 3}") == 0);
+
+    out.u.buf.len = 0;
+    ASSERT(json_tape_setf(s2, strlen(s2), tape, n, &out, ".b[1]", "%d", 7) ==
+           1);
+    ASSERT(strcmp(buf, "{\"a\": \"x\", \"b\": [1, 7], \"c\": 3}") == 0);
+
+    out.u.buf.len = 0;
+    ASSERT(json_tape_setf(s2, strlen(s2), tape, n, &out, ".b", NULL) == 1);
+    ASSERT(strcmp(buf, "{\"a\": \"x\", \"c\": 3}") == 0);
+
+    out.u.buf.len = 0;
+    ASSERT(json_tape_setf(s2, strlen(s2), tape, n, &out, ".a", NULL) == 1);
+    ASSERT(strcmp(buf, "{ \"b\": [1, 2], \"c\": 3}") == 0);
+
+    out.u.buf.len = 0;
+    ASSERT(json_tape_setf(s2, strlen(s2), tape, n, &out, ".b[0]", NULL) == 1);
+    ASSERT(strcmp(buf, "{\"a\": \"x\", \"b\": [ 2], \"c\": 3}") == 0);
+
+    out.u.buf.len = 0;
+    ASSERT(json_tape_setf(s2, strlen(s2), tape, n, &out, ".d", "%d", 4) == 0);
+    ASSERT(strcmp(buf, "{\"a\": \"x\", \"b\": [1, 2], \"c\": 3,\"d\":4}") == 0);
+  }
+
+  return NULL;
+}
+
+static int path_cb(void *data, const char *name, size_t name_len,
+                   const char *path, const struct json_token *token) {
+  struct json_path *p = (struct json_path *) data;
+  char *buf = (char *) p->path + strlen(p->path) + 1;
+  int res = json_path_match(p, name, name_len, token);
+  (void) path;
+  sprintf(buf + strlen(buf), "%d", res);
+  if (token->ptr == NULL && res == JSON_PATH_NO_MATCH) {
+    json_path_skip(p);
+    return JSON_WALK_SKIP_SUBTREE;
+  }
+  return JSON_WALK_CONTINUE;
+}
+
+static const char *test_json_path(void) {
+  const char *s = "{a: [1, {b: 2, c: [3, 4]}, 5], ab: {c: 6}, d: 7}";
+  struct json_path p;
+  char buf[64];
+
+  ASSERT(json_path_compile(&p, "") == 0);
+  ASSERT(json_path_compile(&p, ".a[1].c[]") == 0);
+  ASSERT(json_path_compile(&p, "a") == JSON_STRING_INVALID);
+  ASSERT(json_path_compile(&p, ".a[x]") == JSON_STRING_INVALID);
+  ASSERT(json_path_compile(&p, ".a[1") == JSON_STRING_INVALID);
+
+  /*
+   * Results for all events, the path is followed by the output buffer.
+   * Non-matching objects and arrays are skipped, no events for their content.
+   */
+  memcpy(buf, ".a[1].c[1]\0", 12);
+  ASSERT(json_path_compile(&p, buf) == 0);
+  ASSERT(json_walk_ex(s, strlen(s), path_cb, &p, 0) == (int) strlen(s));
+  ASSERT(strcmp(buf + 11, "110101021101001") == 0);
+  ASSERT(p.level == 0 && p.matched == 0);
+
+  memcpy(buf, ".a\0", 4);
+  ASSERT(json_path_compile(&p, buf) == 0);
+  ASSERT(json_walk_ex(s, strlen(s), path_cb, &p, JSON_WALK_NO_PATH) ==
+         (int) strlen(s));
+  ASSERT(strcmp(buf + 3, "120002001") == 0);
+
+  memcpy(buf, "\0", 2);
+  ASSERT(json_path_compile(&p, buf) == 0);
+  ASSERT(json_walk_ex("[[1]]", 5, path_cb, &p, 0) == 5);
+  ASSERT(strcmp(buf + 1, "202") == 0);
+
+  return NULL;
+}
+
+static void query_cb(void *data, const char *path,
+                     const struct json_token *token) {
+  char *buf = (char *) data;
+  sprintf(buf + strlen(buf), "%s=%.*s ", path, token->len, token->ptr);
+}
+
+static const char *test_json_query(void) {
+  const char *s =
+      "{a: [1, {b: 2, c: [3, 4]}, 5], ab: {c: 6}, d: 7, d: 8, e: \"x\"}";
+  struct json_query_set *q = json_query_new();
+  struct json_token t[6];
+  char buf[100] = "";
+
+  ASSERT(q != NULL);
+  ASSERT(json_query_run(q, s, strlen(s)) == 0);
+  ASSERT(json_query_add(q, ".a[1].c[1]", &t[0], NULL, NULL) == 0);
+  ASSERT(json_query_add(q, ".ab.c", &t[1], query_cb, buf) == 0);
+  ASSERT(json_query_add(q, ".d", &t[2], query_cb, buf) == 0);
+  ASSERT(json_query_add(q, ".a[1]", &t[3], NULL, NULL) == 0);
+  ASSERT(json_query_add(q, ".x.y", &t[4], NULL, NULL) == 0);
+  ASSERT(json_query_add(q, ".e", NULL, query_cb, buf) == 0);
+  ASSERT(json_query_add(q, "", &t[5], NULL, NULL) == 0);
+  ASSERT(json_query_add(q, "a", NULL, NULL, NULL) == -1);
+  ASSERT(json_query_add(q, ".a[]", NULL, NULL, NULL) == -1);
+  ASSERT(json_query_add(q, ".a[1", NULL, NULL, NULL) == -1);
+  ASSERT(json_query_add(q, ".a[1x]", NULL, NULL, NULL) == -1);
+
+  ASSERT(json_query_run(q, s, strlen(s)) == 6);
+  ASSERT(t[0].type == JSON_TYPE_NUMBER && t[0].ptr[0] == '4');
+  ASSERT(t[1].type == JSON_TYPE_NUMBER && t[1].ptr[0] == '6');
+  ASSERT(t[2].type == JSON_TYPE_NUMBER && t[2].ptr[0] == '7');
+  ASSERT(t[3].type == JSON_TYPE_OBJECT_END && t[3].len == 17);
+  ASSERT(t[4].type == JSON_TYPE_INVALID && t[4].ptr == NULL);
+  ASSERT(t[5].type == JSON_TYPE_OBJECT_END && t[5].len == (int) strlen(s));
+  ASSERT(strcmp(buf, ".ab.c=6 .d=7 .e=x ") == 0);
+
+  json_query_free(q);
+
+  /* Runs are independent, and stop once every path is found */
+  q = json_query_new();
+  ASSERT(json_query_add(q, ".d", &t[0], NULL, NULL) == 0);
+  ASSERT(json_query_run(q, "{\"d\": 1, x", 10) == 1);
+  ASSERT(t[0].type == JSON_TYPE_NUMBER && t[0].ptr[0] == '1');
+  ASSERT(json_query_run(q, "{\"e\": 1", 7) == JSON_STRING_INCOMPLETE);
+  ASSERT(t[0].type == JSON_TYPE_INVALID);
+  json_query_free(q);
+
+  return NULL;
+}
+
+static void stream_cb(void *data, const char *name, size_t name_len,
+                      const char *path, const struct json_token *token) {
+  char *buf = (char *) data;
+  sprintf(buf + strlen(buf), "%.*s|%s|%s|%d|%.*s\n",
+          (int) (name == NULL ? 1 : name_len), name == NULL ? "-" : name, path,
+          tok_type_names[token->type], token->len,
+          token->ptr == NULL || token->type == JSON_TYPE_OBJECT_END ||
+                  token->type == JSON_TYPE_ARRAY_END
+              ? 0
+              : token->len,
+          token->ptr);
+}
+
+static const char *test_json_stream(void) {
+  const char *docs[] = {
+      "{\"a\": [1, -2.5e+3, {\"b\": \"x\\u00e9\\\"\xc3\xa9\"}, [], {}],"
+      " c: {d: [true, false, null]} , e1_: 0.25, \"\": {f: 1}, g: \"\"}",
+      "[1 2, [3,], {a:1 b:2,}]", "  12e5 ", "\"\\\\\"", "-0", "true"};
+  struct json_stream st;
+  char expected[1024], buf[1024];
+  size_t i;
+  int k, n, len;
+
+  /* Fed in chunks of every size, the events are the ones of json_walk() */
+  for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+    len = strlen(docs[i]);
+    expected[0] = '\0';
+    n = json_walk(docs[i], len, stream_cb, expected);
+    ASSERT(n > 0);
+    for (k = 1; k <= len; k++) {
+      int off;
+      buf[0] = '\0';
+      json_stream_init(&st, stream_cb, buf);
+      for (off = 0; off < len; off += k) {
+        int size = off + k > len ? len - off : k;
+        char chunk[128];
+        /* Chunks do not outlive json_stream_feed() */
+        memcpy(chunk, docs[i] + off, size);
+        ASSERT(json_stream_feed(&st, chunk, size) >= 0);
+        memset(chunk, '#', size);
+      }
+      ASSERT(json_stream_finish(&st) == n);
+      ASSERT(strcmp(buf, expected) == 0);
+    }
+  }
+
+  /* Only the value is consumed */
+  json_stream_init(&st, NULL, NULL);
+  ASSERT(json_stream_feed(&st, "[1] [2]", 7) == 3);
+  ASSERT(json_stream_feed(&st, "[3]", 3) == 0);
+  ASSERT(json_stream_finish(&st) == 3);
+
+  /* Errors */
+  json_stream_init(&st, NULL, NULL);
+  ASSERT(json_stream_feed(&st, "{\"a\": [1, 2", 11) == 11);
+  ASSERT(json_stream_finish(&st) == JSON_STRING_INCOMPLETE);
+  ASSERT(json_stream_feed(&st, "]}", 2) == 2);
+  ASSERT(json_stream_finish(&st) == 13);
+
+  json_stream_init(&st, NULL, NULL);
+  ASSERT(json_stream_feed(&st, "{\"a\": 1.", 8) == 8);
+  ASSERT(json_stream_feed(&st, "x}", 2) == JSON_STRING_INVALID);
+  ASSERT(json_stream_feed(&st, "}", 1) == JSON_STRING_INVALID);
+  ASSERT(json_stream_finish(&st) == JSON_STRING_INVALID);
+
+  json_stream_init(&st, NULL, NULL);
+  ASSERT(json_stream_feed(&st, "\"\\u12", 5) == 5);
+  ASSERT(json_stream_feed(&st, "x\"", 2) == JSON_STRING_INVALID);
+
+  json_stream_init(&st, NULL, NULL);
+  ASSERT(json_stream_feed(&st, "[1,,2]", 6) == JSON_STRING_INVALID);
+  json_stream_init(&st, NULL, NULL);
+  ASSERT(json_stream_feed(&st, "{a 1}", 5) == JSON_STRING_INVALID);
+  json_stream_init(&st, NULL, NULL);
+  ASSERT(json_stream_finish(&st) == JSON_STRING_INCOMPLETE);
+
+  json_stream_init(&st, NULL, NULL);
+  memset(buf, '[', JSON_MAX_DEPTH + 1);
+  ASSERT(json_stream_feed(&st, buf, JSON_MAX_DEPTH) == JSON_MAX_DEPTH);
+  ASSERT(json_stream_feed(&st, buf, 1) == JSON_DEPTH_EXCEEDED);
+  json_stream_init(&st, NULL, NULL);
+  json_stream_set_max_depth(&st, 2);
+  ASSERT(json_stream_feed(&st, buf, 2) == 2);
+  ASSERT(json_stream_feed(&st, buf, 1) == JSON_DEPTH_EXCEEDED);
+  json_stream_init(&st, NULL, NULL);
+  json_stream_set_max_depth(&st, 0);
+  ASSERT(json_stream_feed(&st, buf, JSON_MAX_DEPTH) == JSON_MAX_DEPTH);
+  ASSERT(json_stream_feed(&st, buf, 1) == JSON_DEPTH_EXCEEDED);
+
+  /* Tokens only need buffering when they are split across chunks */
+  json_stream_init(&st, NULL, NULL);
+  memset(buf, 'x', sizeof(buf));
+  buf[0] = '"';
+  ASSERT(json_stream_feed(&st, buf, sizeof(buf)) == JSON_TOKEN_TOO_LONG);
+  json_stream_init(&st, NULL, NULL);
+  buf[sizeof(buf) - 1] = '"';
+  ASSERT(json_stream_feed(&st, buf, sizeof(buf)) == (int) sizeof(buf));
+  ASSERT(json_stream_finish(&st) == (int) sizeof(buf));
+
+  return NULL;
+}
+
+static int number_cb(void *data, const char *name, size_t name_len,
+                     const char *path, const struct json_token *token) {
+  (void) name;
+  (void) name_len;
+  (void) path;
+  if (token->type == JSON_TYPE_NUMBER) {
+    const struct json_number_token *t = (const struct json_number_token *) token;
+    *(double *) data += t->num.d;
+  }
+  return JSON_WALK_CONTINUE;
+}
+
+static const char *test_json_number(void) {
+  static const struct {
+    const char *str;
+    int flags;
+    int64_t i;
+    uint64_t u;
+    double d;
+  } tests[] = {
+      {"0", JSON_NUMBER_INT64 | JSON_NUMBER_UINT64, 0, 0, 0},
+      {"-0", JSON_NUMBER_INT64 | JSON_NUMBER_UINT64, 0, 0, -0.0},
+      {"-123", JSON_NUMBER_INT64, -123, 0, -123},
+      {"9223372036854775807", JSON_NUMBER_INT64 | JSON_NUMBER_UINT64,
+       INT64_MAX, INT64_MAX, 9223372036854775807.0},
+      {"-9223372036854775808", JSON_NUMBER_INT64, INT64_MIN, 0,
+       -9223372036854775808.0},
+      {"-9223372036854775809", 0, 0, 0, -9223372036854775809.0},
+      {"18446744073709551615", JSON_NUMBER_UINT64, 0, UINT64_MAX,
+       18446744073709551615.0},
+      {"18446744073709551616", 0, 0, 0, 18446744073709551616.0},
+      {"1.5", 0, 0, 0, 1.5},
+      {"1e3", 0, 0, 0, 1000},
+      {"-2.5E-3", 0, 0, 0, -2.5e-3},
+      {"0.1", 0, 0, 0, 0.1},
+      {"9007199254740993", JSON_NUMBER_INT64 | JSON_NUMBER_UINT64,
+       9007199254740993LL, 9007199254740993ULL, 9007199254740993.0},
+      {"123456789012345678901234567890.5", 0, 0, 0,
+       123456789012345678901234567890.5},
+      {"0.30000000000000000000000000000000000000000001", 0, 0, 0, 0.3},
+      {"2.2250738585072011e-308", 0, 0, 0, 2.2250738585072011e-308},
+      {"1e-400", 0, 0, 0, 0},
+      /* Beyond the fast path */
+      {"0.30000000000000004", 0, 0, 0, 0.30000000000000004},
+      {"1.2345678901234567", 0, 0, 0, 1.2345678901234567},
+      {"8.98846567431158e307", 0, 0, 0, 8.98846567431158e307},
+      {"1.7976931348623157e308", 0, 0, 0, 1.7976931348623157e308},
+      {"4.9406564584124654e-324", 0, 0, 0, 4.9406564584124654e-324},
+      {"2.4703282292062328e-324", 0, 0, 0, 4.9406564584124654e-324},
+      {"2.4703282292062327e-324", 0, 0, 0, 0},
+      {"7.2057594037927933e16", 0, 0, 0, 72057594037927936.0},
+      /* Halfway between two doubles: to even, unless a dropped digit says */
+      {"9007199254740993.0", 0, 0, 0, 9007199254740992.0},
+      {"9007199254740995.0", 0, 0, 0, 9007199254740996.0},
+      {"9007199254740993.00000000000000000001", 0, 0, 0,
+       9007199254740994.0},
+      {"900719925474099299999999999999999e-17", 0, 0, 0,
+       9007199254740992.0},
+  };
+  static const char *invalid[] = {"", "-", "1.", ".5", "1e", "1e+", "1x",
+                                  " 1", "+1", "abc"};
+  struct json_number num;
+  double sum = 0;
+  size_t i;
+
+  for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    ASSERT(json_parse_number(tests[i].str, strlen(tests[i].str), &num) == 0);
+    ASSERT(num.flags == tests[i].flags);
+    ASSERT(num.i == tests[i].i);
+    ASSERT(num.u == tests[i].u);
+    ASSERT(num.d == tests[i].d);
+  }
+  ASSERT(json_parse_number("-0", 2, &num) == 0 && signbit(num.d));
+  ASSERT(json_parse_number("1e400", 5, &num) == 0);
+  ASSERT(num.flags == JSON_NUMBER_OVERFLOW && isinf(num.d) && num.d > 0);
+  ASSERT(json_parse_number("1.7976931348623159e308", 22, &num) == 0);
+  ASSERT(num.flags == JSON_NUMBER_OVERFLOW && isinf(num.d));
+  ASSERT(json_parse_number("12345", 2, &num) == 0 && num.i == 12);
+
+  {
+    /* Long numbers are rounded on all their digits, without allocating */
+    char buf[1024];
+    memset(buf, '0', sizeof(buf));
+    memcpy(buf, "9007199254740993.", 17);
+    buf[sizeof(buf) - 1] = '1';
+    static_num_allocs = 0;
+    ASSERT(json_parse_number(buf, sizeof(buf) - 1, &num) == 0);
+    ASSERT(num.d == 9007199254740992.0);
+    ASSERT(json_parse_number(buf, sizeof(buf), &num) == 0);
+    ASSERT(num.d == 9007199254740994.0);
+    buf[0] = '1';
+    memset(buf + 1, '0', 999);
+    memcpy(buf + 1000, "e-999", 5);
+    ASSERT(json_parse_number(buf, 1005, &num) == 0 && num.d == 1.0);
+    ASSERT(static_num_allocs == 0);
+  }
+
+  {
+    /* The decimal point is always '.', whatever the locale */
+    static const char *locales[] = {"de_DE.UTF-8", "fr_FR.UTF-8", "de_DE",
+                                    "fr_FR", "ru_RU.UTF-8"};
+    for (i = 0; i < sizeof(locales) / sizeof(locales[0]); i++) {
+      if (setlocale(LC_NUMERIC, locales[i]) != NULL) break;
+    }
+    ASSERT(json_parse_number("0.30000000000000004", 19, &num) == 0);
+    ASSERT(num.d == 0.30000000000000004);
+    ASSERT(json_parse_number("1.5e-320", 8, &num) == 0);
+    ASSERT(num.d == 1.5e-320);
+    ASSERT(json_parse_number("2.5", 3, &num) == 0 && num.d == 2.5);
+    setlocale(LC_NUMERIC, "C");
+  }
+
+  for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+    ASSERT(json_parse_number(invalid[i], strlen(invalid[i]), &num) ==
+           JSON_STRING_INVALID);
+  }
+
+  /* Decoded during the walk */
+  ASSERT(json_walk_ex("[1, 2.5, {a: -0.5e1}, \"7\"]", 26, number_cb, &sum,
+                      JSON_WALK_NUMBERS) == 26);
+  ASSERT(sum == -1.5);
+
+  return NULL;
+}
+
+static const char *test_json_dtoa(void) {
+  static const struct {
+    double d;
+    const char *str;
+  } tests[] = {
+      {0, "0"},
+      {-0.0, "-0"},
+      {1, "1"},
+      {-123, "-123"},
+      {0.1, "0.1"},
+      {0.3, "0.3"},
+      {1.0 / 3, "0.3333333333333333"},
+      {1234.5678, "1234.5678"},
+      {1e20, "100000000000000000000"},
+      {1e21, "1e+21"},
+      {1.5e300, "1.5e+300"},
+      {0.000001, "0.000001"},
+      {1.5e-7, "1.5e-7"},
+      {-2.5e-10, "-2.5e-10"},
+      {9007199254740993.0, "9007199254740992"},
+      {5e-324, "5e-324"},
+      {1.7976931348623157e308, "1.7976931348623157e+308"},
+      {2.2250738585072014e-308, "2.2250738585072014e-308"},
+      /* Where Grisu3 can't tell, from exact arithmetic */
+      {4.140664967298407e-15, "4.140664967298407e-15"},
+      {829177663549693.25, "829177663549693.2"},
+  };
+  char buf[JSON_NUMBER_BUF_SIZE];
+  uint64_t bits = 0x123456789abcdefULL;
+  size_t i;
+
+  for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    ASSERT(json_dtoa(tests[i].d, buf) == (int) strlen(tests[i].str));
+    ASSERT(strcmp(buf, tests[i].str) == 0);
+  }
+  ASSERT(json_dtoa(HUGE_VAL, buf) == 4 && strcmp(buf, "null") == 0);
+  ASSERT(json_dtoa(NAN, buf) == 4 && strcmp(buf, "null") == 0);
+
+  /* Pseudo-random doubles read back exactly, and no shorter digits do */
+  for (i = 0; i < 10000; i++) {
+    char shorter[JSON_NUMBER_BUF_SIZE];
+    const char *p;
+    double d;
+    int digits = 0, zeros = 0;
+    bits = bits * 6364136223846793005ULL + 1442695040888963407ULL;
+    memcpy(&d, &bits, sizeof(d));
+    if (isnan(d) || isinf(d)) continue;
+    ASSERT(json_dtoa(d, buf) < (int) sizeof(buf) && strtod(buf, NULL) == d);
+    for (p = buf; *p != '\0' && *p != 'e'; p++) {
+      if (*p == '0') {
+        zeros++;
+      } else if (*p >= '1' && *p <= '9') {
+        if (digits > 0) digits += zeros;
+        digits++;
+        zeros = 0;
+      }
+    }
+    if (digits > 1) {
+      snprintf(shorter, sizeof(shorter), "%.*e", digits - 2, d);
+      ASSERT(strtod(shorter, NULL) != d);
+    }
+  }
+
+  ASSERT(json_ftoa(0.1f, buf) == 3 && strcmp(buf, "0.1") == 0);
+  ASSERT(json_ftoa(-1.5e-7f, buf) == 7 && strcmp(buf, "-1.5e-7") == 0);
+  ASSERT(json_ftoa(3.4028235e38f, buf) == 13 &&
+         strcmp(buf, "3.4028235e+38") == 0);
+  ASSERT(json_ftoa(1e-45f, buf) == 5 && strcmp(buf, "1e-45") == 0);
+  ASSERT(json_ftoa((float) HUGE_VAL, buf) == 4 && strcmp(buf, "null") == 0);
+  for (i = 0; i < 10000; i++) {
+    float f;
+    uint32_t fbits;
+    bits = bits * 6364136223846793005ULL + 1442695040888963407ULL;
+    fbits = (uint32_t) (bits >> 32);
+    memcpy(&f, &fbits, sizeof(f));
+    if (isnan(f) || isinf(f)) continue;
+    ASSERT(json_ftoa(f, buf) < (int) sizeof(buf) && strtof(buf, NULL) == f);
+  }
+
+  ASSERT(json_itoa(0, buf) == 1 && strcmp(buf, "0") == 0);
+  ASSERT(json_itoa(-1000003, buf) == 8 && strcmp(buf, "-1000003") == 0);
+  ASSERT(json_itoa(INT64_MIN, buf) == 20);
+  ASSERT(strcmp(buf, "-9223372036854775808") == 0);
+  ASSERT(json_utoa(UINT64_MAX, buf) == 20);
+  ASSERT(strcmp(buf, "18446744073709551615") == 0);
+
+  return NULL;
+}
+
+/* Write {"a": 1, "b": 2, "c": [null, "aa", {}, true], "d": 1.5} with `w` */
+static int write_sample(struct json_writer *w) {
+  json_writer_begin_object(w);
+  json_writer_key(w, "a");
+  json_writer_int(w, 1);
+  json_writer_key(w, "b");
+  json_writer_int(w, 2);
+  json_writer_key(w, "c");
+  json_writer_begin_array(w);
+  json_writer_string(w, NULL);
+  json_writer_string(w, "aa");
+  json_writer_begin_object(w);
+  json_writer_end_object(w);
+  json_writer_bool(w, 1);
+  json_writer_end_array(w);
+  json_writer_key(w, "d");
+  json_writer_double(w, 1.5);
+  json_writer_end_object(w);
+  return json_writer_finish(w);
+}
+
+static const char *test_json_writer(void) {
+  char buf[200], buf2[200];
+  struct json_writer w;
+
+  {
+    struct json_out out = JSON_OUT_BUF(buf, sizeof(buf));
+    const char *result =
+        "{\"a\":1,\"b\":2,\"c\":[null,\"aa\",{},true],\"d\":1.5}";
+    json_writer_init(&w, &out, 0);
+    ASSERT(write_sample(&w) == (int) strlen(result));
+    ASSERT(strcmp(buf, result) == 0);
+  }
+
+  {
+    /* Pretty mode prints what json_prettify() does */
+    struct json_out out = JSON_OUT_BUF(buf, sizeof(buf));
+    struct json_out out2 = JSON_OUT_BUF(buf2, sizeof(buf2));
+    json_writer_init(&w, &out, JSON_WRITER_PRETTY);
+    ASSERT(write_sample(&w) == (int) strlen(buf));
+    ASSERT(json_prettify(buf, strlen(buf), &out2) > 0);
+    ASSERT(strcmp(buf, buf2) == 0);
+  }
+
+  {
+    struct json_out out = JSON_OUT_BUF(buf, sizeof(buf));
+    const char *result = "[\"a\\\"b\",\"x\",-9223372036854775808,false,[1,2]]";
+    json_writer_init(&w, &out, 0);
+    json_writer_begin_array(&w);
+    json_writer_string(&w, "a\"b");
+    json_writer_string_len(&w, "xyz", 1);
+    json_writer_int(&w, INT64_MIN);
+    json_writer_bool(&w, 0);
+    ASSERT(json_writer_raw(&w, "[1,2]", 5) == 6);
+    json_writer_end_array(&w);
+    ASSERT(json_writer_finish(&w) == (int) strlen(result));
+    ASSERT(strcmp(buf, result) == 0);
+  }
+
+  {
+    /* Misuse is reported, prints nothing, and sticks */
+    struct json_out out = JSON_OUT_BUF(buf, sizeof(buf));
+    json_writer_init(&w, &out, 0);
+    ASSERT(json_writer_finish(&w) == JSON_STRING_INCOMPLETE);
+    ASSERT(json_writer_key(&w, "a") == JSON_STRING_INVALID);
+    ASSERT(json_writer_int(&w, 1) == JSON_STRING_INVALID);
+    ASSERT(json_writer_finish(&w) == JSON_STRING_INVALID);
+    ASSERT(out.u.buf.len == 0);
+
+    json_writer_init(&w, &out, 0);
+    json_writer_begin_object(&w);
+    ASSERT(json_writer_int(&w, 1) == JSON_STRING_INVALID);
+    json_writer_init(&w, &out, 0);
+    json_writer_begin_object(&w);
+    json_writer_key(&w, "a");
+    ASSERT(json_writer_key(&w, "b") == JSON_STRING_INVALID);
+    json_writer_init(&w, &out, 0);
+    json_writer_begin_array(&w);
+    ASSERT(json_writer_finish(&w) == JSON_STRING_INCOMPLETE);
+    ASSERT(json_writer_end_object(&w) == JSON_STRING_INVALID);
+    json_writer_init(&w, &out, 0);
+    json_writer_null(&w);
+    ASSERT(json_writer_null(&w) == JSON_STRING_INVALID);
+  }
+
+  {
+    struct json_out out = JSON_OUT_BUF(NULL, 0);
+    int i;
+    json_writer_init(&w, &out, JSON_WRITER_PRETTY);
+    for (i = 0; i < JSON_MAX_DEPTH; i++) {
+      ASSERT(json_writer_begin_array(&w) > 0);
+    }
+    ASSERT(json_writer_begin_object(&w) == JSON_DEPTH_EXCEEDED);
+  }
+
+  {
+    struct json_out out = JSON_OUT_BUF(NULL, 0);
+    json_writer_init(&w, &out, JSON_WRITER_PRETTY | JSON_WRITER_MAX_DEPTH(1));
+    ASSERT(json_writer_begin_array(&w) > 0);
+    ASSERT(json_writer_begin_array(&w) == JSON_DEPTH_EXCEEDED);
+  }
+
+  return NULL;
+}
+
 static const char *run_all_tests(void) {
+  RUN_TEST(test_json_iter);
+  RUN_TEST(test_json_tape);
+  RUN_TEST(test_json_path);
+  RUN_TEST(test_json_query);
+  RUN_TEST(test_json_stream);
+  RUN_TEST(test_json_number);
+  RUN_TEST(test_json_dtoa);
   RUN_TEST(test_json_next);
   RUN_TEST(test_prettify);
+  RUN_TEST(test_json_writer);
   RUN_TEST(test_eos);
   RUN_TEST(test_scanf);
   RUN_TEST(test_errors);
   RUN_TEST(test_json_printf);
   RUN_TEST(test_callback_api);
+  RUN_TEST(test_walk_ex);
   RUN_TEST(test_callback_api_long_path);
   RUN_TEST(test_json_unescape);
   RUN_TEST(test_parse_string);
   RUN_TEST(test_fprintf);
+  RUN_TEST(test_json_map_file);
   RUN_TEST(test_json_setf);
   return NULL;
 }